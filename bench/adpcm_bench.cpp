@@ -0,0 +1,155 @@
+// Benchmark: CPU cost of IMA-ADPCM encoding (ima_adpcm.h) against the bytes
+// it saves on a 30 second recording, and how closely the decoded audio
+// matches the original.
+//
+//   pio run -e bench_adpcm && .pio/build/bench_adpcm/program [speech.wav|- [out.wav]]
+//
+// speech.wav is a 16-bit mono recording; without one (or given "-"), a
+// synthetic voiced signal is used. out.wav receives the encoded file, for checking with
+// another decoder (e.g. ffmpeg -i out.wav). On the host, the encode time is
+// only a guide to the ESP32's: scale it by the difference in clock speed.
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+#include "../ima_adpcm.h"
+
+#define BENCH_SAMPLE_RATE 16000
+#define BENCH_SECONDS 30
+#define BENCH_REPEATS 20
+#define BENCH_WRITE_SAMPLES 1024 // as the capture task hands them over
+
+// Function to load 16-bit mono samples from a WAV file; false if it is not one
+static bool loadWav(const char* path, std::vector<int16_t>& samples) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    uint8_t header[12];
+    bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) && memcmp(header, "RIFF", 4) == 0;
+    uint8_t chunk[8];
+    while (ok && fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+        uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+        if (memcmp(chunk, "data", 4) == 0) {
+            samples.resize(size / 2);
+            samples.resize(fread(samples.data(), 2, samples.size(), file));
+            break;
+        }
+        fseek(file, size, SEEK_CUR);
+    }
+    fclose(file);
+    return !samples.empty();
+}
+
+// Function to make a stand-in for speech: a gliding voiced tone with
+// harmonics, syllable-rate loudness changes, pauses and a noise floor
+static void synthesiseVoice(std::vector<int16_t>& samples) {
+    samples.resize(BENCH_SAMPLE_RATE * BENCH_SECONDS);
+    double phase = 0;
+    uint32_t noise = 1;
+    for (size_t i = 0; i < samples.size(); i++) {
+        double t = (double)i / BENCH_SAMPLE_RATE;
+        double pitch = 140 + 40 * sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * pitch / BENCH_SAMPLE_RATE;
+        double envelope = fmax(0, sin(2 * M_PI * 4 * t)) * (fmod(t, 5) < 4 ? 1 : 0);
+        double voice = 0;
+        for (int harmonic = 1; harmonic <= 8; harmonic++) {
+            voice += sin(harmonic * phase) / harmonic;
+        }
+        noise = noise * 1103515245 + 12345;
+        double hiss = ((int)(noise >> 16 & 0x7FFF) - 16384) / 16384.0;
+        samples[i] = (int16_t)(9000 * envelope * voice + 200 * hiss);
+    }
+}
+
+// Function to decode IMA-ADPCM blocks as a WAV reader does, to measure the error
+static void decode(const uint8_t* data, size_t length, std::vector<int16_t>& samples) {
+    samples.clear();
+    for (size_t block = 0; block + ADPCM_BLOCK_BYTES <= length; block += ADPCM_BLOCK_BYTES) {
+        const uint8_t* in = data + block;
+        int predictor = (int16_t)(in[0] | (in[1] << 8));
+        int stepIndex = in[2];
+        samples.push_back(predictor);
+        for (size_t i = 4; i < ADPCM_BLOCK_BYTES; i++) {
+            for (int shift = 0; shift <= 4; shift += 4) {
+                uint8_t code = (in[i] >> shift) & 0xF;
+                int step = adpcmStepTable[stepIndex];
+                int delta = step >> 3;
+                if (code & 4) delta += step;
+                if (code & 2) delta += step >> 1;
+                if (code & 1) delta += step >> 2;
+                predictor += (code & 8) ? -delta : delta;
+                predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+                stepIndex += adpcmIndexTable[code];
+                stepIndex = stepIndex < 0 ? 0 : (stepIndex > 88 ? 88 : stepIndex);
+                samples.push_back(predictor);
+            }
+        }
+    }
+}
+
+// Function to encode the whole recording the way StreamingUploader does
+static size_t encodeRecording(const std::vector<int16_t>& samples, std::vector<uint8_t>& output) {
+    ImaAdpcmEncoder encoder;
+    output.resize(ADPCM_ENCODED_SIZE(samples.size()) + ADPCM_BLOCK_BYTES);
+    size_t length = 0;
+    for (size_t i = 0; i < samples.size(); i += BENCH_WRITE_SAMPLES) {
+        size_t count = samples.size() - i < BENCH_WRITE_SAMPLES ? samples.size() - i : BENCH_WRITE_SAMPLES;
+        length += encoder.encode(samples.data() + i, count, output.data() + length);
+    }
+    length += encoder.finish(output.data() + length);
+    output.resize(length);
+    return length;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int16_t> samples;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        if (!loadWav(argv[1], samples)) {
+            Serial.printf("Could not read 16-bit samples from %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        synthesiseVoice(samples);
+    }
+    double seconds = (double)samples.size() / BENCH_SAMPLE_RATE;
+
+    std::vector<uint8_t> encoded;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_REPEATS; i++) {
+        encodeRecording(samples, encoded);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / BENCH_REPEATS;
+
+    // Signal to noise ratio of the decoded audio
+    std::vector<int16_t> decoded;
+    decode(encoded.data(), encoded.size(), decoded);
+    double signal = 0, error = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        signal += (double)samples[i] * samples[i];
+        error += ((double)samples[i] - decoded[i]) * ((double)samples[i] - decoded[i]);
+    }
+
+    size_t pcmBytes = 44 + samples.size() * 2;
+    size_t adpcmBytes = ADPCM_WAV_HEADER_SIZE + encoded.size();
+    Serial.printf("Recording:  %.1f s, %u samples\n", seconds, (unsigned)samples.size());
+    Serial.printf("PCM WAV:    %u bytes\n", (unsigned)pcmBytes);
+    Serial.printf("ADPCM WAV:  %u bytes (%.2f:1, %u bytes saved)\n", (unsigned)adpcmBytes,
+                  (double)pcmBytes / adpcmBytes, (unsigned)(pcmBytes - adpcmBytes));
+    Serial.printf("Encode:     %.2f ms per recording, %.1f ns per sample, %.0fx real time\n",
+                  elapsed * 1000, elapsed * 1e9 / samples.size(), seconds / elapsed);
+    Serial.printf("SNR:        %.1f dB\n", 10 * log10(signal / (error > 0 ? error : 1)));
+
+    if (argc > 2) {
+        uint8_t header[ADPCM_WAV_HEADER_SIZE];
+        buildAdpcmWavHeader(header, BENCH_SAMPLE_RATE, encoded.size(), samples.size());
+        FILE* file = fopen(argv[2], "wb");
+        if (file == NULL) {
+            Serial.printf("Could not write %s\n", argv[2]);
+            return 1;
+        }
+        fwrite(header, 1, sizeof(header), file);
+        fwrite(encoded.data(), 1, encoded.size(), file);
+        fclose(file);
+    }
+    return 0;
+}
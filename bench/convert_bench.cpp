@@ -0,0 +1,117 @@
+// Microbenchmark: the sample conversion kernel in sample_convert.h against
+// the old conversion loop (samples_32[i] >> 16), on a 30 second recording
+// in the INMP441's format: quiet voice plus the mic's DC offset, as 24-bit
+// samples left-justified in 32-bit slots.
+//
+//   pio run -e bench_convert && .pio/build/bench_convert/program
+//
+// Reports the time per sample, the DC left in the output, and the
+// signal-to-error ratio of the rounding: each output is compared with the
+// same conversion done in floating point, so the high-pass's phase shift
+// is not counted as error.
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+#include "../sample_convert.h"
+
+#define BENCH_SAMPLE_RATE 16000
+#define BENCH_SECONDS 30
+#define BENCH_BLOCK 1024 // samples per I2S read, as in the capture task
+#define BENCH_REPEATS 20
+#define BENCH_DC_OFFSET -40000 // in 24-bit units, about -0.5% of full scale
+#define BENCH_LEVEL 60000 // voice amplitude in 24-bit units, about -43 dBFS
+
+static std::vector<int32_t> slots; // what i2s_read returns
+static std::vector<double> exact;    // the slots at 16-bit scale, DC included, no rounding
+static std::vector<double> filtered; // the same through the high-pass, in floating point
+
+// Function to make the test recording: a gliding voiced tone at syllable rate, hiss and a DC offset
+static void synthesise() {
+    size_t count = BENCH_SAMPLE_RATE * BENCH_SECONDS;
+    slots.resize(count);
+    exact.resize(count);
+    filtered.resize(count);
+    double previousInput = 0, previousOutput = 0;
+    const double pole = 1 - 1.0 / (1 << CONVERT_DC_POLE_BITS);
+    double phase = 0;
+    uint32_t noise = 1;
+    for (size_t i = 0; i < count; i++) {
+        double t = (double)i / BENCH_SAMPLE_RATE;
+        phase += 2 * M_PI * (140 + 40 * sin(2 * M_PI * 0.7 * t)) / BENCH_SAMPLE_RATE;
+        double voice = 0;
+        for (int harmonic = 1; harmonic <= 8; harmonic++) {
+            voice += sin(harmonic * phase) / harmonic;
+        }
+        noise = noise * 1103515245 + 12345;
+        double hiss = ((int)(noise >> 16 & 0x7FFF) - 16384) / 16384.0;
+        double signal = BENCH_LEVEL * fmax(0, sin(2 * M_PI * 3 * t)) * voice + 400 * hiss;
+        int32_t sample = (int32_t)lround(signal + BENCH_DC_OFFSET);
+        slots[i] = sample * 256; // 24 bits, left-justified
+        exact[i] = sample / 256.0;
+        filtered[i] = exact[i] - previousInput + pole * previousOutput;
+        previousInput = exact[i];
+        previousOutput = filtered[i];
+    }
+}
+
+// The conversion loop the capture task used to run
+static size_t convertShift(const int32_t* input, size_t count, int16_t* output) {
+    for (size_t i = 0; i < count; i++) {
+        output[i] = input[i] >> 16;
+    }
+    return count;
+}
+
+// Function to time a conversion over the whole recording, block by block; returns ns per sample
+template <typename Convert>
+static double measure(std::vector<int16_t>& output, Convert convert) {
+    output.resize(slots.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        for (size_t i = 0; i < slots.size(); i += BENCH_BLOCK) {
+            size_t count = slots.size() - i < BENCH_BLOCK ? slots.size() - i : BENCH_BLOCK;
+            convert(slots.data() + i, count, output.data() + i);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return elapsed * 1e9 / ((double)slots.size() * BENCH_REPEATS);
+}
+
+// Function to report the quality of output, skipping the first second while the high-pass settles
+static void report(const char* name, double nanoseconds, const std::vector<int16_t>& output,
+                   const std::vector<double>& reference, double gain) {
+    size_t settled = BENCH_SAMPLE_RATE;
+    double dc = 0, signal = 0, error = 0;
+    for (size_t i = settled; i < output.size(); i++) {
+        double expected = reference[i] * gain;
+        dc += output[i];
+        signal += filtered[i] * gain * filtered[i] * gain; // the voice, without the DC
+        error += (output[i] - expected) * (output[i] - expected);
+    }
+    dc /= output.size() - settled;
+    Serial.printf("%-16s %6.2f ns/sample  DC %8.1f  SER %5.1f dB\n",
+                  name, nanoseconds, dc, 10 * log10(signal / error));
+}
+
+int main() {
+    synthesise();
+    std::vector<int16_t> output;
+
+    double nanoseconds = measure(output, convertShift);
+    report("shift >> 16", nanoseconds, output, exact, 1);
+
+    // The high-pass state runs on from one repeat to the next, as it does from block to block
+    Inmp441Converter converter;
+    nanoseconds = measure(output, [&](const int32_t* in, size_t n, int16_t* out) { return converter.convert(in, n, out); });
+    report("kernel", nanoseconds, output, filtered, 1);
+
+    converter.setGain(4);
+    nanoseconds = measure(output, [&](const int32_t* in, size_t n, int16_t* out) { return converter.convert(in, n, out); });
+    report("kernel, gain 4", nanoseconds, output, filtered, 4);
+
+    converter.setGain(1, 8);
+    converter.reset();
+    nanoseconds = measure(output, [&](const int32_t* in, size_t n, int16_t* out) { return converter.convert(in, n, out); });
+    Serial.printf("%-16s %6.2f ns/sample  settles at gain %.2f\n", "kernel, AGC", nanoseconds, converter.currentGain());
+    return 0;
+}
@@ -0,0 +1,283 @@
+// Microbenchmark and fuzzer for the streaming NMEA parser in nmea_parser.h.
+//
+//   pio run -e bench_nmea && .pio/build/bench_nmea/program
+//   pio run -e bench_nmea && .pio/build/bench_nmea/program fuzz [iterations] bench/nmea_corpus/*.nmea
+//
+// The benchmark feeds a minute of a typical receiver's output (GGA, RMC and
+// the GSA/GSV/VTG/GLL sentences the sketch ignores) through the parser and
+// through the String-splitting code getGPSData used to run, reporting the
+// time per byte and the heap allocations each makes. On the host, String is
+// std::string, whose short values need no allocation; on the ESP32 every
+// String is one, so the old code's count there is higher still.
+//
+// The fuzzer first replays each corpus file as it is, printing what the
+// parser made of it, then feeds it mutated copies (flipped bits, inserted,
+// deleted and repeated bytes, splices of two files) and checks that every
+// fix the parser reports is a real position.
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include "../nmea_parser.h"
+
+#define BENCH_SECONDS 60
+#define BENCH_REPEATS 200
+#define FUZZ_ITERATIONS 200000
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* memory = malloc(size ? size : 1);
+    if (memory == NULL) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+// Function to append a sentence with its checksum
+static void appendSentence(std::string& out, const char* body) {
+    uint8_t checksum = 0;
+    for (const char* c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+    out += "$";
+    out += body;
+    out += tail;
+}
+
+// Function to make a minute of a NEO-6M's output at the Sydney Opera House, one epoch per second
+static std::string synthesise() {
+    std::string out;
+    char body[96];
+    for (int second = 0; second < BENCH_SECONDS; second++) {
+        snprintf(body, sizeof(body), "GPRMC,0230%02d.00,A,3351.4080,S,15112.9180,E,0.012,,170626,,,A", second);
+        appendSentence(out, body);
+        appendSentence(out, "GPVTG,,T,,M,0.012,N,0.022,K,A");
+        snprintf(body, sizeof(body), "GPGGA,0230%02d.00,3351.4080,S,15112.9180,E,1,08,0.91,4.0,M,22.0,M,,", second);
+        appendSentence(out, body);
+        appendSentence(out, "GPGSA,A,3,10,12,15,18,24,25,29,32,,,,,1.62,0.91,1.34");
+        appendSentence(out, "GPGSV,3,1,11,10,63,137,17,12,38,288,24,15,15,099,21,18,51,048,30");
+        appendSentence(out, "GPGSV,3,2,11,20,05,219,,24,46,002,35,25,22,315,26,29,12,173,19");
+        appendSentence(out, "GPGSV,3,3,11,32,19,124,22,41,,,,42,,,");
+        snprintf(body, sizeof(body), "GPGLL,3351.40800,S,15112.91800,E,0230%02d.00,A,A", second);
+        appendSentence(out, body);
+    }
+    return out;
+}
+
+// The conversion getGPSData used
+static float convertToDecimalDegrees(String coord, String direction) {
+    double rawCoord = coord.toDouble();
+    int degrees = (int)(rawCoord / 100);
+    double minutes = rawCoord - (degrees * 100);
+    float decimalDegrees = degrees + (minutes / 60);
+    if (direction == "S" || direction == "W") {
+        decimalDegrees = -decimalDegrees;
+    }
+    return decimalDegrees;
+}
+
+// The line splitting getGPSData used, over the bytes in memory instead of the UART
+static size_t parseOld(const std::string& data, float& latitude, float& longitude) {
+    size_t lines = 0;
+    size_t position = 0;
+    while (position < data.size()) {
+        String nmeaData = "";
+        String lat, latDir, lon, lonDir;
+        while (position < data.size()) {
+            char c = data[position++];
+            if (c == '\n') {
+                break;
+            }
+            nmeaData += c;
+        }
+        if (nmeaData.startsWith("$GPGGA") || nmeaData.startsWith("$GPRMC")) {
+            int commaIndex = 0;
+            String nmeaFields[15];
+            int fieldIndex = 0;
+            while (fieldIndex < 15) {
+                commaIndex = nmeaData.indexOf(',', commaIndex + 1);
+                if (commaIndex == -1) break;
+                nmeaFields[fieldIndex++] = nmeaData.substring(commaIndex + 1, nmeaData.indexOf(',', commaIndex + 1));
+            }
+            lat = nmeaFields[1];
+            latDir = nmeaFields[2];
+            lon = nmeaFields[3];
+            lonDir = nmeaFields[4];
+        }
+        latitude = convertToDecimalDegrees(lat, latDir);
+        longitude = convertToDecimalDegrees(lon, lonDir);
+        lines++;
+    }
+    return lines;
+}
+
+// Function to feed a buffer to a parser; returns the fixes it reported
+static size_t parseNew(NmeaParser& parser, const std::string& data) {
+    size_t fixes = 0;
+    for (char c : data) {
+        if (parser.feed(c)) {
+            fixes++;
+        }
+    }
+    return fixes;
+}
+
+static int benchmark() {
+    std::string data = synthesise();
+    float latitude = 0, longitude = 0;
+
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        parseOld(data, latitude, longitude);
+    }
+    double oldSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t oldAllocations = (allocations - before) / BENCH_REPEATS;
+
+    NmeaParser parser;
+    size_t fixes = 0;
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        fixes = parseNew(parser, data);
+    }
+    double newSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t newAllocations = (allocations - before) / BENCH_REPEATS;
+
+    double bytes = (double)data.size() * BENCH_REPEATS;
+    Serial.printf("Input: %u bytes, %d s of receiver output\n", (unsigned)data.size(), BENCH_SECONDS);
+    Serial.printf("%-14s %6.2f ns/byte  %6u allocations/minute  last %.6f, %.6f\n", "String split",
+                  oldSeconds * 1e9 / bytes, (unsigned)oldAllocations, latitude, longitude);
+    const GpsFix& fix = parser.fix();
+    Serial.printf("%-14s %6.2f ns/byte  %6u allocations/minute  last %.6f, %.6f (HDOP %.2f, %d satellites)\n",
+                  "NmeaParser", newSeconds * 1e9 / bytes, (unsigned)newAllocations, fix.latitude, fix.longitude,
+                  fix.hdop, fix.satellites);
+    Serial.printf("NmeaParser: %u fixes per minute, %u bytes of state\n", (unsigned)fixes, (unsigned)sizeof(NmeaParser));
+    return 0;
+}
+
+// Function to check a fix is a real position; false if the parser let a bad one through
+static bool plausible(const GpsFix& fix) {
+    return fix.valid && fix.latitude >= -90 && fix.latitude <= 90 &&
+           fix.longitude >= -180 && fix.longitude <= 180 && fix.hdop >= 0 && fix.quality > 0;
+}
+
+// Function to make a mutated copy of a corpus file
+static std::string mutate(const std::vector<std::string>& corpus, uint32_t& seed) {
+    auto next = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+    std::string data = corpus[next(corpus.size())];
+    int mutations = 1 + next(8);
+    for (int i = 0; i < mutations && !data.empty(); i++) {
+        size_t at = next(data.size());
+        switch (next(6)) {
+        case 0:
+            data[at] ^= 1 << next(8);
+            break;
+        case 1:
+            data.insert(at, 1, "$,*.\r\n0A"[next(8)]);
+            break;
+        case 2:
+            data.erase(at, 1 + next(8));
+            break;
+        case 3:
+            data.insert(at, data.substr(at, 1 + next(40)));
+            break;
+        case 4: {
+            const std::string& other = corpus[next(corpus.size())];
+            data = data.substr(0, at) + other.substr(next(other.size()));
+            break;
+        }
+        default:
+            data[at] = (char)next(256);
+            break;
+        }
+    }
+    return data;
+}
+
+static int fuzz(long iterations, int fileCount, char** files) {
+    std::vector<std::string> corpus;
+    for (int i = 0; i < fileCount; i++) {
+        FILE* file = fopen(files[i], "rb");
+        if (file == NULL) {
+            Serial.printf("Could not open %s\n", files[i]);
+            return 1;
+        }
+        std::string data;
+        char block[512];
+        size_t length;
+        while ((length = fread(block, 1, sizeof(block), file)) > 0) {
+            data.append(block, length);
+        }
+        fclose(file);
+
+        NmeaParser parser;
+        size_t fixes = parseNew(parser, data);
+        const GpsFix& fix = parser.fix();
+        Serial.printf("%-36s %3u sentences  %3u fixes  %2u bad checksums  %2u malformed  ", files[i],
+                      (unsigned)parser.sentences, (unsigned)fixes, (unsigned)parser.checksumErrors,
+                      (unsigned)parser.malformed);
+        if (fix.valid) {
+            Serial.printf("fix %.6f, %.6f (quality %d, HDOP %.2f)\n", fix.latitude, fix.longitude, fix.quality, fix.hdop);
+        } else {
+            Serial.printf("no fix\n");
+        }
+        if (fix.valid && !plausible(fix)) {
+            Serial.printf("Implausible fix from %s\n", files[i]);
+            return 1;
+        }
+        corpus.push_back(data);
+    }
+    if (corpus.empty()) {
+        Serial.printf("No corpus files given\n");
+        return 1;
+    }
+
+    uint32_t seed = 1;
+    size_t fixes = 0;
+    for (long i = 0; i < iterations; i++) {
+        std::string data = mutate(corpus, seed);
+        NmeaParser parser;
+        for (char c : data) {
+            if (parser.feed(c)) {
+                fixes++;
+                if (!plausible(parser.fix())) {
+                    Serial.printf("Implausible fix %.6f, %.6f after iteration %ld\n",
+                                  parser.fix().latitude, parser.fix().longitude, i);
+                    return 1;
+                }
+            }
+        }
+    }
+    Serial.printf("Fuzzed %ld mutated inputs: %u fixes, all plausible\n", iterations, (unsigned)fixes);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "fuzz") == 0) {
+        int first = 2;
+        long iterations = FUZZ_ITERATIONS;
+        if (argc > 2 && isDigit(argv[2][0])) {
+            iterations = atol(argv[2]);
+            first = 3;
+        }
+        return fuzz(iterations, argc - first, argv + first);
+    }
+    return benchmark();
+}
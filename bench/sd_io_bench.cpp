@@ -0,0 +1,97 @@
+// Microbenchmark: the sketch's old per-byte SD loops against the block
+// primitives in sd_io.h, on files the size of a transcript, a story and a
+// speech clip.
+//
+//   pio run -e bench_sd_io && .pio/build/bench_sd_io/program
+//
+// Runs against the native HAL, where SD is a directory (STORYBOX_SD_DIR,
+// default "sdcard"), so the numbers show the per-call overhead the block
+// primitives remove rather than the speed of a real card.
+#include <Arduino.h>
+#include <SD.h>
+#include <chrono>
+#include "../sd_io.h"
+
+#define BENCH_SOURCE "/bench_source.txt"
+#define BENCH_COPY "/bench_copy.txt"
+#define BENCH_MIN_BYTES (4 * 1024 * 1024) // Move at least this much per measurement
+
+static const size_t benchSizes[] = {1024, 16 * 1024, 256 * 1024};
+
+// Function to time one operation repeated until it has moved BENCH_MIN_BYTES; returns MB/s
+template <typename Operation>
+static double measure(size_t size, Operation operation) {
+    int repeats = BENCH_MIN_BYTES / size + 1;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        operation();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)size * repeats / seconds / (1024 * 1024);
+}
+
+// Function to create the source file: printable text with line breaks, like a transcript
+static void createSource(size_t size) {
+    String text;
+    text.reserve(size);
+    while (text.length() < size) {
+        text += (text.length() % 80 == 79) ? '\n' : (char)('a' + text.length() % 26);
+    }
+    sdWrite(SD, BENCH_SOURCE, text);
+}
+
+// The loop readTextFromSD used: one read() per byte, growing the String as it goes
+static String perByteRead() {
+    String text = "";
+    File file = SD.open(BENCH_SOURCE);
+    while (file.available()) {
+        text += (char)file.read();
+    }
+    file.close();
+    return text;
+}
+
+// The loop addContextToStory used: one read() and one write() per byte
+static void perByteAppend() {
+    File context = SD.open(BENCH_COPY, FILE_APPEND);
+    File contribution = SD.open(BENCH_SOURCE);
+    while (contribution.available()) {
+        context.write(contribution.read());
+    }
+    contribution.close();
+    context.close();
+}
+
+static void report(const char* name, size_t size, double before, double after) {
+    Serial.printf("%-8s %7u B  per-byte %8.2f MB/s  block %8.2f MB/s  x%.1f\n",
+                  name, (unsigned)size, before, after, after / before);
+}
+
+int main() {
+    if (!SD.begin()) {
+        Serial.println("SD directory not available");
+        return 1;
+    }
+
+    for (size_t size : benchSizes) {
+        createSource(size);
+
+        String text;
+        double before = measure(size, [] { perByteRead(); });
+        double after = measure(size, [&] { sdReadText(SD, BENCH_SOURCE, text); });
+        if (text != perByteRead()) {
+            Serial.println("Block read does not match the per-byte read");
+            return 1;
+        }
+        report("read", size, before, after);
+
+        // Restart the destination every pass so appends do not grow without bound
+        before = measure(size, [] { SD.remove(BENCH_COPY); perByteAppend(); });
+        after = measure(size, [] { SD.remove(BENCH_COPY); sdCopyFile(SD, BENCH_SOURCE, BENCH_COPY, true); });
+        report("append", size, before, after);
+
+        SD.remove(BENCH_COPY);
+        SD.remove(BENCH_SOURCE);
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Capture ring: a lock-free ring buffer between the I2S capture task and the
+// stages that use the live audio (SD writer, STT uploader, level meter).
+//
+// There is one producer and any number of consumers, each reading through
+// its own cursor, so a slow consumer never holds up the producer or the
+// other consumers. The producer never waits: when a consumer falls more than
+// a ring behind, the samples it missed are overwritten and counted in its
+// cursor's dropped total, and it carries on from the oldest intact block.
+//
+// Only the producer writes head and only a consumer writes its cursor, so no
+// locks are needed. A consumer checks head again after copying, in case the
+// producer lapped it during the copy (as in a seqlock).
+//
+// Header-only and free of sketch globals so it can be used by any task.
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+
+#define CAPTURE_RING_MAX_WRITE 2048 // largest single write; one I2S read of 1024 16-bit samples
+
+// Read position of one consumer
+struct CaptureCursor {
+    uint32_t position;
+    uint32_t dropped; // bytes overwritten before this consumer read them
+};
+
+class CaptureRing {
+private:
+    uint8_t* buffer;
+    uint32_t capacity; // a power of two, so positions wrap with a mask
+    std::atomic<uint32_t> head; // total bytes ever written
+    std::atomic<bool> closed;
+
+    // Function to return the oldest position still safe to read, given head;
+    // the producer may be part way through writing the next block past it
+    uint32_t oldest(uint32_t h) {
+        return h - (capacity - CAPTURE_RING_MAX_WRITE);
+    }
+
+    // Function to move a lapped cursor on to the oldest intact data
+    void skipLapped(CaptureCursor& cursor, uint32_t h) {
+        if ((int32_t)(h - cursor.position) > (int32_t)(capacity - CAPTURE_RING_MAX_WRITE)) {
+            cursor.dropped += oldest(h) - cursor.position;
+            cursor.position = oldest(h);
+        }
+    }
+
+public:
+    CaptureRing() : buffer(NULL), capacity(0), head(0), closed(false) {}
+
+    // Function to allocate the ring in internal RAM, which stays fast while
+    // the SD card or flash is busy; size must be a power of two
+    bool begin(uint32_t size) {
+        if (buffer != NULL) {
+            return capacity == size;
+        }
+        if (size <= CAPTURE_RING_MAX_WRITE || (size & (size - 1)) != 0) {
+            return false;
+        }
+        buffer = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (buffer == NULL) {
+            return false;
+        }
+        capacity = size;
+        return true;
+    }
+
+    // Function to start a new recording; consumers attach after this
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_release);
+    }
+
+    // Function to add captured bytes; never blocks (producer only)
+    void write(const uint8_t* data, size_t length) {
+        if (length > CAPTURE_RING_MAX_WRITE) {
+            length = CAPTURE_RING_MAX_WRITE;
+        }
+        uint32_t h = head.load(std::memory_order_relaxed);
+        // A consumer that sees any of these bytes must also see the head that precedes them
+        std::atomic_thread_fence(std::memory_order_release);
+        uint32_t offset = h & (capacity - 1);
+        size_t first = capacity - offset < length ? capacity - offset : length;
+        memcpy(buffer + offset, data, first);
+        memcpy(buffer, data + first, length - first);
+        head.store(h + length, std::memory_order_release);
+    }
+
+    // Function to mark the end of the recording (producer only)
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    // Function to start a consumer at the newest data
+    void attach(CaptureCursor& cursor) {
+        cursor.position = head.load(std::memory_order_acquire);
+        cursor.dropped = 0;
+    }
+
+    // Function to return the position just past the newest data
+    uint32_t written() {
+        return head.load(std::memory_order_acquire);
+    }
+
+    // Function to move a consumer forward to position without counting the
+    // bytes it passes over as dropped; it never moves backwards
+    void skipTo(CaptureCursor& cursor, uint32_t position) {
+        if ((int32_t)(position - cursor.position) > 0 && (int32_t)(written() - position) >= 0) {
+            cursor.position = position;
+        }
+    }
+
+    size_t available(CaptureCursor& cursor) {
+        uint32_t h = head.load(std::memory_order_acquire);
+        skipLapped(cursor, h);
+        return h - cursor.position;
+    }
+
+    // Function to tell a consumer it has read everything there will be
+    bool finished(CaptureCursor& cursor) {
+        return closed.load(std::memory_order_acquire) && available(cursor) == 0;
+    }
+
+    // Function to copy up to length bytes for a consumer, stopping at position
+    // limit if one is given; returns how many were read
+    size_t read(CaptureCursor& cursor, uint8_t* data, size_t length, uint32_t limit = 0) {
+        uint32_t h = head.load(std::memory_order_acquire);
+        skipLapped(cursor, h);
+        if (limit != 0 && (int32_t)(h - limit) > 0) {
+            h = limit;
+        }
+        if ((int32_t)(h - cursor.position) <= 0) {
+            return 0;
+        }
+        size_t count = h - cursor.position < length ? h - cursor.position : length;
+
+        uint32_t offset = cursor.position & (capacity - 1);
+        size_t first = capacity - offset < count ? capacity - offset : count;
+        memcpy(data, buffer + offset, first);
+        memcpy(data + first, buffer, count - first);
+
+        // If the producer lapped the cursor during the copy, the copy is torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint32_t after = head.load(std::memory_order_relaxed);
+        if ((int32_t)(after - cursor.position) > (int32_t)(capacity - CAPTURE_RING_MAX_WRITE)) {
+            skipLapped(cursor, after);
+            return 0;
+        }
+        cursor.position += count;
+        return count;
+    }
+};
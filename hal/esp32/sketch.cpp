@@ -0,0 +1,4 @@
+// Firmware entry point: the sketch lives in source_code.c at the top of the
+// repository and is compiled here as C++ against the ESP32 Arduino core
+#include <Arduino.h>
+#include "../../source_code.c"
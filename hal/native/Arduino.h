@@ -0,0 +1,334 @@
+// Host (Linux) stand-in for the subset of the ESP32 Arduino core used by the
+// firmware. Together with the other headers in hal/native it lets
+// source_code.c build and run as a normal process for profiling.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define HEX 16
+#define DEC 10
+#define OUTPUT 0x02
+#define INPUT 0x01
+#define HIGH 0x1
+#define LOW 0x0
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+// Timing. STORYBOX_TIME_SCALE > 1 compresses firmware time so a whole game can
+// be replayed faster than real time; the API stand-in scales its latencies to
+// match, so reported durations stay in device seconds.
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+double nativeTimeScale();
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+inline bool isDigit(int c) { return c >= '0' && c <= '9'; }
+inline bool isSpace(int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+inline bool isAlpha(int c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+inline bool isAlphaNumeric(int c) { return isAlpha(c) || isDigit(c); }
+inline bool isHexadecimalDigit(int c) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+// GPIO and LED PWM are no-ops on the host
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void ledcAttachPin(uint8_t, uint8_t) {}
+inline double ledcSetup(uint8_t, double freq, uint8_t) { return freq; }
+inline void ledcWrite(uint8_t, uint32_t) {}
+
+inline uint32_t ESP_getFreeHeap() { return 4 * 1024 * 1024; }
+
+// The host clock is already set, so there is no SNTP to start
+inline void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr) {}
+
+//------------------------------------------------------------------------------------------
+// String
+
+class String {
+public:
+    String() {}
+    String(const char* s) : s_(s ? s : "") {}
+    explicit String(const std::string& s) : s_(s) {}
+    String(const String& other) = default;
+    String(String&& other) = default;
+    explicit String(char c) : s_(1, c) {}
+    explicit String(unsigned char value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(int value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned int value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(long value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(long long value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned long long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(float value, unsigned int decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+    explicit String(double value, unsigned int decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+
+    String& operator=(const String& other) = default;
+    String& operator=(String&& other) = default;
+    String& operator=(const char* s) { s_ = s ? s : ""; return *this; }
+
+    unsigned int length() const { return (unsigned int)s_.size(); }
+    bool isEmpty() const { return s_.empty(); }
+    const char* c_str() const { return s_.c_str(); }
+    bool reserve(unsigned int size) { s_.reserve(size); return true; }
+    char charAt(unsigned int index) const { return index < s_.size() ? s_[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return s_[index]; }
+    void setCharAt(unsigned int index, char c) { if (index < s_.size()) s_[index] = c; }
+
+    bool concat(const String& other) { s_ += other.s_; return true; }
+    bool concat(const char* s) { if (s) s_ += s; return true; }
+    bool concat(const char* s, unsigned int len) { if (s) s_.append(s, len); return true; }
+    bool concat(char c) { s_ += c; return true; }
+    template <typename T> bool concat(T value) { s_ += String(value).s_; return true; }
+
+    String& operator+=(const String& other) { concat(other); return *this; }
+    String& operator+=(const char* s) { concat(s); return *this; }
+    String& operator+=(char c) { concat(c); return *this; }
+    template <typename T> String& operator+=(T value) { concat(value); return *this; }
+
+    bool equals(const String& other) const { return s_ == other.s_; }
+    bool equals(const char* s) const { return s_ == (s ? s : ""); }
+    bool equalsIgnoreCase(const String& other) const {
+        if (s_.size() != other.s_.size()) return false;
+        for (size_t i = 0; i < s_.size(); i++) {
+            if (tolower((unsigned char)s_[i]) != tolower((unsigned char)other.s_[i])) return false;
+        }
+        return true;
+    }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator==(const char* s) const { return equals(s); }
+    bool operator!=(const String& other) const { return !equals(other); }
+    bool operator!=(const char* s) const { return !equals(s); }
+    bool operator<(const String& other) const { return s_ < other.s_; }
+    int compareTo(const String& other) const { return s_.compare(other.s_); }
+
+    bool startsWith(const String& prefix, unsigned int offset = 0) const {
+        return s_.size() >= offset + prefix.s_.size() && s_.compare(offset, prefix.s_.size(), prefix.s_) == 0;
+    }
+    bool endsWith(const String& suffix) const {
+        return s_.size() >= suffix.s_.size() && s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return toIndex(s_.find(c, from)); }
+    int indexOf(const String& str, unsigned int from = 0) const { return toIndex(s_.find(str.s_, from)); }
+    int indexOf(const char* str, unsigned int from = 0) const { return toIndex(s_.find(str, from)); }
+    int lastIndexOf(char c) const { return toIndex(s_.rfind(c)); }
+    int lastIndexOf(char c, unsigned int from) const { return toIndex(s_.rfind(c, from)); }
+    int lastIndexOf(const String& str) const { return toIndex(s_.rfind(str.s_)); }
+
+    String substring(unsigned int from) const { return from >= s_.size() ? String() : String(s_.substr(from)); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= s_.size()) return String();
+        return String(s_.substr(from, std::min<size_t>(to, s_.size()) - from));
+    }
+
+    void replace(const String& find, const String& replacement) {
+        if (find.s_.empty()) return;
+        size_t pos = 0;
+        while ((pos = s_.find(find.s_, pos)) != std::string::npos) {
+            s_.replace(pos, find.s_.size(), replacement.s_);
+            pos += replacement.s_.size();
+        }
+    }
+    void replace(char find, char replacement) { std::replace(s_.begin(), s_.end(), find, replacement); }
+    void remove(unsigned int index) { if (index < s_.size()) s_.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < s_.size()) s_.erase(index, count); }
+    void toLowerCase() { for (auto& c : s_) c = (char)tolower((unsigned char)c); }
+    void toUpperCase() { for (auto& c : s_) c = (char)toupper((unsigned char)c); }
+    void trim() {
+        size_t start = 0;
+        while (start < s_.size() && isSpace((unsigned char)s_[start])) start++;
+        size_t end = s_.size();
+        while (end > start && isSpace((unsigned char)s_[end - 1])) end--;
+        s_ = s_.substr(start, end - start);
+    }
+
+    long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+    float toFloat() const { return (float)strtod(s_.c_str(), nullptr); }
+    double toDouble() const { return strtod(s_.c_str(), nullptr); }
+
+    void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const {
+        if (!bufsize) return;
+        size_t n = index < s_.size() ? std::min<size_t>(bufsize - 1, s_.size() - index) : 0;
+        memcpy(buf, s_.data() + index, n);
+        buf[n] = 0;
+    }
+
+    const std::string& str() const { return s_; }
+
+private:
+    static int toIndex(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+    void fromUnsigned(unsigned long long value, unsigned char base) {
+        char buf[72];
+        char* p = buf + sizeof(buf) - 1;
+        *p = 0;
+        do {
+            int digit = (int)(value % base);
+            *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+            value /= base;
+        } while (value);
+        s_ = p;
+    }
+    void fromSigned(long long value, unsigned char base) {
+        if (base == DEC && value < 0) {
+            fromUnsigned((unsigned long long)(-value), base);
+            s_ = "-" + s_;
+        } else {
+            fromUnsigned((unsigned long long)value, base);
+        }
+    }
+    void fromDouble(double value, unsigned int decimalPlaces) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+        s_ = buf;
+    }
+
+    std::string s_;
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String r(lhs); r.concat(rhs); return r; }
+inline String operator+(const String& lhs, const char* rhs) { String r(lhs); r.concat(rhs); return r; }
+inline String operator+(const char* lhs, const String& rhs) { String r(lhs); r.concat(rhs); return r; }
+inline String operator+(const String& lhs, char rhs) { String r(lhs); r.concat(rhs); return r; }
+template <typename T> String operator+(const String& lhs, T rhs) { String r(lhs); r.concat(String(rhs)); return r; }
+
+// The core's concatenation temporary; ArduinoJson's String adapter names it
+class StringSumHelper : public String {
+public:
+    using String::String;
+};
+
+//------------------------------------------------------------------------------------------
+// Print / Stream
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) {
+            if (!write(*buffer++)) break;
+            n++;
+        }
+        return n;
+    }
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual void flush() {}
+
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(unsigned int n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(unsigned long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(long long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(unsigned long long n, int base = DEC) { return print(String(n, (unsigned char)base)); }
+    size_t print(double n, int digits = 2) { return print(String(n, (unsigned int)digits)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (len < 0) return 0;
+        if ((size_t)len < sizeof(buf)) return write((const uint8_t*)buf, len);
+        std::string big(len + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&big[0], big.size(), format, args);
+        va_end(args);
+        return write((const uint8_t*)big.data(), len);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+
+    virtual size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        while (count < length) {
+            int c = timedRead();
+            if (c < 0) break;
+            *buffer++ = (char)c;
+            count++;
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    String readString() {
+        String ret;
+        int c = timedRead();
+        while (c >= 0) {
+            ret += (char)c;
+            c = timedRead();
+        }
+        return ret;
+    }
+    String readStringUntil(char terminator) {
+        String ret;
+        int c = timedRead();
+        while (c >= 0 && c != terminator) {
+            ret += (char)c;
+            c = timedRead();
+        }
+        return ret;
+    }
+
+protected:
+    int timedRead() {
+        unsigned long start = millis();
+        do {
+            int c = read();
+            if (c >= 0) return c;
+            if (_timeout == 0) break;
+            delay(1);
+        } while (millis() - start < _timeout);
+        return -1;
+    }
+
+    unsigned long _timeout = 1000;
+};
+
+#include "HardwareSerial.h"
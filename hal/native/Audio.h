@@ -0,0 +1,34 @@
+// Host stand-in for the ESP32-audioI2S player: a timing sink that consumes the
+// file at the bitrate found in its first MP3 frame header (or WAV header), so
+// playback takes as long as it would on the speaker
+#pragma once
+
+#include "Arduino.h"
+#include "FS.h"
+#include "driver/i2s.h"
+
+class Audio {
+public:
+    Audio(bool internalDAC = false, uint8_t channelEnabled = 3, uint8_t i2sPort = I2S_NUM_0) {}
+
+    bool setPinout(uint8_t BCLK, uint8_t LRC, uint8_t DOUT, int8_t DIN = -1) { return true; }
+    void setVolume(uint8_t vol) { _volume = vol; }
+    uint8_t getVolume() { return _volume; }
+
+    bool connecttoFS(fs::FS& fs, const char* path);
+    void loop();
+    bool isRunning() { return _running; }
+    uint32_t stopSong();
+    uint32_t getAudioCurrentTime();
+
+private:
+    bool readHeader();
+
+    File _file;
+    String _path;
+    bool _running = false;
+    uint8_t _volume = 21;
+    uint32_t _bytesPerSecond = 0;
+    uint32_t _bytesPlayed = 0;
+    unsigned long _startMillis = 0;
+};
@@ -0,0 +1,100 @@
+// Host stand-in for the ESP32 HTTPClient (HTTP/1.1 with keep-alive and
+// chunked responses), running over the socket-backed WiFiClient
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+#define HTTPCLIENT_DEFAULT_TCP_TIMEOUT (5000)
+
+typedef enum {
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_NO_CONTENT = 204,
+    HTTP_CODE_BAD_REQUEST = 400,
+    HTTP_CODE_UNAUTHORIZED = 401,
+    HTTP_CODE_NOT_FOUND = 404,
+    HTTP_CODE_TOO_MANY_REQUESTS = 429,
+    HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+    HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+typedef enum {
+    HTTPC_TE_IDENTITY,
+    HTTPC_TE_CHUNKED
+} transferEncoding_t;
+
+class HTTPClient {
+public:
+    HTTPClient() {}
+    ~HTTPClient();
+
+    bool begin(String url);
+    bool begin(WiFiClient& client, String url);
+    void end();
+    bool connected();
+
+    void setReuse(bool reuse) { _reuse = reuse; }
+    void setTimeout(uint16_t timeout) { _tcpTimeout = timeout; }
+    void setConnectTimeout(int32_t) {}
+    void useHTTP10(bool usehttp10 = true) { _useHTTP10 = usehttp10; }
+    void addHeader(const String& name, const String& value, bool first = false, bool replace = true);
+    void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+    String header(const char* name);
+    bool hasHeader(const char* name);
+
+    int GET();
+    int POST(uint8_t* payload, size_t size);
+    int POST(String payload);
+    int sendRequest(const char* type, String payload);
+    int sendRequest(const char* type, uint8_t* payload = nullptr, size_t size = 0);
+
+    int getSize(void) { return _size; }
+    WiFiClient& getStream(void) { return *_client; }
+    WiFiClient* getStreamPtr(void) { return _client; }
+    int writeToStream(Stream* stream);
+    String getString(void);
+
+    static String errorToString(int error);
+
+private:
+    bool connect();
+    int handleHeaderResponse();
+    int returnError(int error);
+    int writeToStreamDataBlock(Stream* stream, int size);
+    void disconnect(bool preserveClient = false);
+
+    std::unique_ptr<WiFiClient> _ownClient;
+    WiFiClient* _client = nullptr;
+
+    String _host;
+    uint16_t _port = 0;
+    String _uri;
+    String _protocol;
+    String _headers;
+    uint16_t _tcpTimeout = HTTPCLIENT_DEFAULT_TCP_TIMEOUT;
+    bool _reuse = true;
+    bool _useHTTP10 = false;
+    bool _canReuse = false;
+
+    std::vector<String> _collectKeys;
+    std::vector<String> _collectValues;
+
+    int _returnCode = 0;
+    int _size = -1;
+    transferEncoding_t _transferEncoding = HTTPC_TE_IDENTITY;
+};
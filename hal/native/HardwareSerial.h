@@ -0,0 +1,39 @@
+// Host stand-in for the ESP32 UARTs. UART0 (Serial) writes to stdout with a
+// millisecond timestamp per line; the other ports replay an NMEA capture file
+// named by STORYBOX_GPS_NMEA, paced at the configured baud rate.
+#pragma once
+
+#include "Arduino.h"
+
+#define SERIAL_8N1 0x800001c
+
+class HardwareSerial : public Stream {
+public:
+    explicit HardwareSerial(int uart_nr);
+    ~HardwareSerial();
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+    void end();
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    operator bool() const { return true; }
+
+private:
+    void refill();
+
+    int _uart_nr;
+    unsigned long _baud = 0;
+    FILE* _replay = nullptr;
+    unsigned long _replayStart = 0;
+    size_t _replayConsumed = 0;
+    int _peeked = -1;
+    bool _lineStart = true;
+};
+
+extern HardwareSerial Serial;
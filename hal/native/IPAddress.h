@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+    IPAddress() : _address{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address{a, b, c, d} {}
+
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t& operator[](int index) { return _address[index]; }
+    bool operator==(const IPAddress& other) const { return memcmp(_address, other._address, 4) == 0; }
+
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _address[0], _address[1], _address[2], _address[3]);
+        return String(buf);
+    }
+    operator String() const { return toString(); }
+
+private:
+    uint8_t _address[4];
+};
@@ -0,0 +1,28 @@
+// Host stand-in for the SPI SD card: the card is a directory on disk, named by
+// STORYBOX_SD_DIR (default ./sdcard)
+#pragma once
+
+#include "FS.h"
+#include "SPI.h"
+
+namespace fs {
+
+class SDFS : public FS {
+public:
+    SDFS(FSImplPtr impl) : FS(impl) {}
+    bool begin(uint8_t ssPin = 5, SPIClass& spi = SPI, uint32_t frequency = 4000000, const char* mountpoint = "/sd",
+               uint8_t max_files = 5);
+    void end() {}
+    uint64_t cardSize();
+    uint64_t totalBytes();
+    uint64_t usedBytes();
+};
+
+// Wraps a POSIX directory as an fs::FS, so other host code can mount its own
+FSImplPtr nativeDirectoryFS(const char* root);
+
+} // namespace fs
+
+extern fs::SDFS SD;
+
+using namespace fs;
@@ -0,0 +1,4 @@
+// Included by the firmware for completeness; no SD_MMC volume exists on the host
+#pragma once
+
+#include "FS.h"
@@ -0,0 +1,12 @@
+// Host stand-in for the SPI bus; the SD card backend does not need it
+#pragma once
+
+#include "Arduino.h"
+
+class SPIClass {
+public:
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+    void end() {}
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,4 @@
+// Included by the firmware for completeness; no SPIFFS volume exists on the host
+#pragma once
+
+#include "FS.h"
@@ -0,0 +1,47 @@
+// Host stand-in for the ESP32 WiFi station. The host network is always
+// "connected"; every hostname resolves to the local API stand-in configured
+// with STORYBOX_API_HOST / STORYBOX_API_PORT (see tools/mock_api_server.py).
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} wifi_mode_t;
+
+class WiFiClass {
+public:
+    bool mode(wifi_mode_t) { return true; }
+    wl_status_t begin(const char*, const char* = nullptr) { return WL_CONNECTED; }
+    bool disconnect(bool = false) { return true; }
+    wl_status_t status() { return WL_CONNECTED; }
+    bool isConnected() { return true; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    int8_t RSSI() { return -50; }
+    int hostByName(const char* host, IPAddress& result);
+};
+
+extern WiFiClass WiFi;
+
+class WiFiServer {
+public:
+    explicit WiFiServer(uint16_t port) : _port(port) {}
+    void begin() {}
+
+private:
+    uint16_t _port;
+};
@@ -0,0 +1,41 @@
+// Host stand-in for the lwIP TCP client, backed by a BSD socket
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class WiFiClient : public Stream {
+public:
+    WiFiClient() {}
+    virtual ~WiFiClient();
+
+    virtual int connect(IPAddress ip, uint16_t port);
+    virtual int connect(const char* host, uint16_t port);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    virtual int read(uint8_t* buf, size_t size);
+    int peek() override;
+    void flush() override {}
+    virtual void stop();
+    virtual uint8_t connected();
+    operator bool() { return connected(); }
+
+    // Like the ESP32 core, client timeouts are given in seconds
+    int setTimeout(uint32_t seconds) { _timeoutSeconds = seconds; Stream::setTimeout(seconds * 1000); return 0; }
+
+    // Traffic counters, so host benchmarks can report bytes on the wire
+    static uint64_t totalBytesSent();
+    static uint64_t totalBytesReceived();
+
+protected:
+    bool fill(int timeoutMs);
+
+    int _fd = -1;
+    uint32_t _timeoutSeconds = 30;
+    uint8_t _rx[4096];
+    size_t _rxStart = 0;
+    size_t _rxEnd = 0;
+};
@@ -0,0 +1,12 @@
+// Host stand-in for the mbedTLS client. The local API stand-in speaks plain
+// HTTP, so this is a WiFiClient with the certificate options ignored.
+#pragma once
+
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+    void setInsecure() {}
+    void setCACert(const char*) {}
+    void setHandshakeTimeout(unsigned long) {}
+};
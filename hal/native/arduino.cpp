@@ -0,0 +1,150 @@
+// Host implementation of the Arduino core timing, random and UART functions
+#include "Arduino.h"
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+static const auto bootTime = std::chrono::steady_clock::now();
+
+double nativeTimeScale() {
+    static double scale = [] {
+        const char* env = getenv("STORYBOX_TIME_SCALE");
+        double value = env ? atof(env) : 1.0;
+        return value > 0 ? value : 1.0;
+    }();
+    return scale;
+}
+
+unsigned long micros() {
+    auto elapsed = std::chrono::steady_clock::now() - bootTime;
+    return (unsigned long)(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * nativeTimeScale());
+}
+
+unsigned long millis() {
+    return micros() / 1000;
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds((long long)(us / nativeTimeScale())));
+}
+
+void delay(uint32_t ms) {
+    delayMicroseconds(ms * 1000);
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+static std::mt19937& rng() {
+    static std::mt19937 engine(12345);
+    return engine;
+}
+
+long random(long howbig) {
+    if (howbig <= 0) return 0;
+    return (long)(rng()() % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    rng().seed(seed);
+}
+
+//------------------------------------------------------------------------------------------
+// UARTs
+
+HardwareSerial Serial(0);
+
+static std::mutex serialLock;
+
+HardwareSerial::HardwareSerial(int uart_nr) : _uart_nr(uart_nr) {}
+
+HardwareSerial::~HardwareSerial() {
+    end();
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t, int8_t, int8_t) {
+    _baud = baud;
+    if (_uart_nr == 0 || _replay) return;
+
+    const char* path = getenv("STORYBOX_GPS_NMEA");
+    if (path) {
+        _replay = fopen(path, "rb");
+        if (!_replay) fprintf(stderr, "[native] cannot open GPS replay %s\n", path);
+    }
+    _replayStart = millis();
+    _replayConsumed = 0;
+}
+
+void HardwareSerial::end() {
+    if (_replay) {
+        fclose(_replay);
+        _replay = nullptr;
+    }
+}
+
+// Bytes the replayed UART would have received by now at 10 bits per byte
+void HardwareSerial::refill() {
+    if (_peeked >= 0 || !_replay || !_baud) return;
+    size_t due = (size_t)((millis() - _replayStart) * (_baud / 10) / 1000);
+    if (_replayConsumed >= due) return;
+    int c = fgetc(_replay);
+    if (c == EOF) {
+        rewind(_replay);
+        c = fgetc(_replay);
+    }
+    if (c != EOF) {
+        _peeked = c;
+        _replayConsumed++;
+    }
+}
+
+int HardwareSerial::available() {
+    if (_uart_nr == 0) return 0;
+    refill();
+    return _peeked >= 0 ? 1 : 0;
+}
+
+int HardwareSerial::read() {
+    if (_uart_nr == 0) return -1;
+    refill();
+    int c = _peeked;
+    _peeked = -1;
+    return c;
+}
+
+int HardwareSerial::peek() {
+    if (_uart_nr == 0) return -1;
+    refill();
+    return _peeked;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (_uart_nr != 0) return size;
+    std::lock_guard<std::mutex> guard(serialLock);
+    for (size_t i = 0; i < size; i++) {
+        if (_lineStart) {
+            fprintf(stdout, "[%9lu] ", millis());
+            _lineStart = false;
+        }
+        char c = (char)buffer[i];
+        if (c == '\r') continue;
+        fputc(c, stdout);
+        if (c == '\n') {
+            _lineStart = true;
+            fflush(stdout);
+        }
+    }
+    return size;
+}
@@ -0,0 +1,230 @@
+// Host implementation of the audio playback timing sink and the I2S microphone
+#include "Audio.h"
+#include "driver/i2s.h"
+
+#include <mutex>
+#include <vector>
+
+static const uint16_t mp3v1Bitrates[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+static const uint16_t mp3v2Bitrates[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+
+// Bytes per second of the stream starting at buf, or 0 if it is not recognised
+static uint32_t detectByteRate(const uint8_t* buf, size_t len) {
+    if (len >= 32 && memcmp(buf, "RIFF", 4) == 0 && memcmp(buf + 8, "WAVE", 4) == 0) {
+        return buf[28] | (buf[29] << 8) | (buf[30] << 16) | ((uint32_t)buf[31] << 24);
+    }
+    size_t pos = 0;
+    if (len >= 10 && memcmp(buf, "ID3", 3) == 0) {
+        pos = 10 + ((buf[6] & 0x7F) << 21 | (buf[7] & 0x7F) << 14 | (buf[8] & 0x7F) << 7 | (buf[9] & 0x7F));
+    }
+    for (; pos + 3 < len; pos++) {
+        if (buf[pos] != 0xFF || (buf[pos + 1] & 0xE0) != 0xE0) continue;
+        int version = (buf[pos + 1] >> 3) & 3;
+        int layer = (buf[pos + 1] >> 1) & 3;
+        int index = buf[pos + 2] >> 4;
+        if (layer != 1 || version == 1 || index == 0 || index == 15) continue;
+        uint16_t kbps = version == 3 ? mp3v1Bitrates[index] : mp3v2Bitrates[index];
+        return kbps * 1000 / 8;
+    }
+    return 0;
+}
+
+bool Audio::connecttoFS(fs::FS& fs, const char* path) {
+    stopSong();
+    _file = fs.open(path);
+    if (!_file) {
+        printf("[native] audio: cannot open %s\n", path);
+        return false;
+    }
+    _path = path;
+    _running = true;
+    _bytesPerSecond = 0;
+    _bytesPlayed = 0;
+    _startMillis = millis();
+    return true;
+}
+
+bool Audio::readHeader() {
+    uint8_t head[4096];
+    size_t n = _file.read(head, sizeof(head));
+    if (n == 0) return false;
+    _bytesPerSecond = detectByteRate(head, n);
+    if (!_bytesPerSecond) _bytesPerSecond = 8000; // assume 64 kbit/s
+    _bytesPlayed = n;
+    _startMillis = millis();
+    return true;
+}
+
+void Audio::loop() {
+    if (!_running) return;
+    if (!_bytesPerSecond && !readHeader()) {
+        stopSong();
+        return;
+    }
+
+    unsigned long elapsed = millis() - _startMillis;
+    uint64_t due = (uint64_t)elapsed * _bytesPerSecond / 1000;
+    if (due <= _bytesPlayed) return;
+
+    uint8_t buf[4096];
+    size_t want = (size_t)std::min<uint64_t>(due - _bytesPlayed, sizeof(buf));
+    size_t n = _file.read(buf, want);
+    if (n == 0) {
+        // The decoder only lets the last frames drain before reporting EOF
+        if (elapsed * (uint64_t)_bytesPerSecond / 1000 >= _bytesPlayed) stopSong();
+        return;
+    }
+    _bytesPlayed += n;
+
+    // A stalled source is an underrun: playback resumes from where it stopped
+    if (due - _bytesPlayed > _bytesPerSecond / 2) {
+        _startMillis = millis() - (unsigned long)((uint64_t)_bytesPlayed * 1000 / _bytesPerSecond);
+    }
+}
+
+uint32_t Audio::stopSong() {
+    uint32_t pos = _bytesPlayed;
+    if (_file) {
+        printf("[native] audio: %s played %.2f s\n", _path.c_str(),
+               _bytesPerSecond ? (double)_bytesPlayed / _bytesPerSecond : 0.0);
+        _file.close();
+    }
+    _running = false;
+    return pos;
+}
+
+uint32_t Audio::getAudioCurrentTime() {
+    return _bytesPerSecond ? _bytesPlayed / _bytesPerSecond : 0;
+}
+
+//------------------------------------------------------------------------------------------
+// I2S microphone replay
+
+struct NativeI2S {
+    bool installed = false;
+    bool running = false;
+    i2s_config_t config;
+    std::vector<int16_t> fixture;
+    size_t fixturePos = 0;
+    unsigned long startMicros = 0;
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+};
+
+static NativeI2S i2sPorts[I2S_NUM_MAX];
+
+static void loadFixture(NativeI2S& port) {
+    port.fixture.clear();
+    port.fixturePos = 0;
+    const char* path = getenv("STORYBOX_MIC_WAV");
+    FILE* file = path ? fopen(path, "rb") : nullptr;
+    if (!file) {
+        // No fixture: quiet noise floor so downstream stages still see audio
+        for (int i = 0; i < 16000; i++) port.fixture.push_back((int16_t)(random(64) - 32));
+        return;
+    }
+    uint8_t header[12];
+    int channels = 1;
+    if (fread(header, 1, 12, file) == 12 && memcmp(header, "RIFF", 4) == 0) {
+        uint8_t chunk[8];
+        while (fread(chunk, 1, 8, file) == 8) {
+            uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+            if (memcmp(chunk, "fmt ", 4) == 0) {
+                uint8_t fmt[16];
+                if (fread(fmt, 1, 16, file) != 16) break;
+                channels = fmt[2] | (fmt[3] << 8);
+                fseek(file, size - 16, SEEK_CUR);
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                int16_t frame[2];
+                while (fread(frame, sizeof(int16_t), channels, file) == (size_t)channels) {
+                    port.fixture.push_back(frame[0]);
+                }
+                break;
+            } else {
+                fseek(file, size, SEEK_CUR);
+            }
+        }
+    }
+    fclose(file);
+    if (port.fixture.empty()) port.fixture.push_back(0);
+}
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t* i2s_config, int, void*) {
+    NativeI2S& port = i2sPorts[i2s_num];
+    if (port.installed) return ESP_FAIL;
+    port.installed = true;
+    port.config = *i2s_config;
+    if (i2s_config->mode & I2S_MODE_RX) loadFixture(port);
+    return i2s_start(i2s_num);
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t i2s_num) {
+    NativeI2S& port = i2sPorts[i2s_num];
+    if (!port.installed) return ESP_FAIL;
+    if (port.dropped) {
+        printf("[native] i2s: DMA overrun dropped %llu samples\n", (unsigned long long)port.dropped);
+    }
+    port = NativeI2S();
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t*) {
+    return i2sPorts[i2s_num].installed ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num) {
+    return i2sPorts[i2s_num].installed ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t i2s_start(i2s_port_t i2s_num) {
+    NativeI2S& port = i2sPorts[i2s_num];
+    if (!port.installed) return ESP_FAIL;
+    port.running = true;
+    port.startMicros = micros();
+    port.delivered = 0;
+    return ESP_OK;
+}
+
+esp_err_t i2s_stop(i2s_port_t i2s_num) {
+    NativeI2S& port = i2sPorts[i2s_num];
+    if (!port.installed) return ESP_FAIL;
+    port.running = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_read(i2s_port_t i2s_num, void* dest, size_t size, size_t* bytes_read, TickType_t) {
+    NativeI2S& port = i2sPorts[i2s_num];
+    *bytes_read = 0;
+    if (!port.installed || !port.running) return ESP_FAIL;
+
+    size_t sampleBytes = port.config.bits_per_sample / 8;
+    size_t wanted = size / sampleBytes;
+    uint64_t rate = port.config.sample_rate;
+
+    // Samples older than the DMA ring would have been overwritten
+    uint64_t produced = (uint64_t)(micros() - port.startMicros) * rate / 1000000;
+    uint64_t capacity = (uint64_t)port.config.dma_buf_count * port.config.dma_buf_len;
+    if (produced > port.delivered + capacity) {
+        port.dropped += produced - port.delivered - capacity;
+        port.fixturePos = (port.fixturePos + (produced - port.delivered - capacity)) % port.fixture.size();
+        port.delivered = produced - capacity;
+    }
+
+    // Block until a full request worth of samples has been captured
+    uint64_t readyAt = port.startMicros + (port.delivered + wanted) * 1000000 / rate;
+    unsigned long now = micros();
+    if (readyAt > now) delayMicroseconds((uint32_t)(readyAt - now));
+
+    for (size_t i = 0; i < wanted; i++) {
+        int32_t sample = port.fixture[port.fixturePos];
+        port.fixturePos = (port.fixturePos + 1) % port.fixture.size();
+        if (sampleBytes == 4) {
+            ((int32_t*)dest)[i] = sample << 16;
+        } else {
+            ((int16_t*)dest)[i] = (int16_t)sample;
+        }
+    }
+    port.delivered += wanted;
+    *bytes_read = wanted * sampleBytes;
+    return ESP_OK;
+}
@@ -0,0 +1,308 @@
+// Host implementation of the FreeRTOS task, queue, semaphore and ring buffer
+// primitives on top of std::thread and condition variables
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "Arduino.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Ticks are milliseconds of (scaled) firmware time
+template <typename Predicate>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Predicate ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    auto timeout = std::chrono::microseconds((long long)(ticks * 1000.0 / nativeTimeScale()));
+    return cv.wait_for(lock, timeout, ready);
+}
+
+TickType_t xTaskGetTickCount() {
+    return (TickType_t)millis();
+}
+
+BaseType_t xPortGetCoreID() {
+    return 0;
+}
+
+static std::recursive_mutex criticalLock;
+
+void nativeEnterCritical(portMUX_TYPE*) {
+    criticalLock.lock();
+}
+
+void nativeExitCritical(portMUX_TYPE*) {
+    criticalLock.unlock();
+}
+
+//------------------------------------------------------------------------------------------
+// Tasks
+
+struct NativeTask {
+    std::mutex lock;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+    char name[16] = "loopTask"; // the thread running main() stands in for Arduino's loop task
+};
+
+struct NativeTaskExit {};
+
+static thread_local NativeTask* currentTask = nullptr;
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (!currentTask) currentTask = new NativeTask();
+    return currentTask;
+}
+
+char* pcTaskGetTaskName(TaskHandle_t handle) {
+    return (handle ? handle : xTaskGetCurrentTaskHandle())->name;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t, void* param,
+                                   UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+    NativeTask* nativeTask = new NativeTask();
+    snprintf(nativeTask->name, sizeof(nativeTask->name), "%s", name);
+    if (handle) *handle = nativeTask;
+    std::thread([task, param, nativeTask] {
+        currentTask = nativeTask;
+        try {
+            task(param);
+        } catch (const NativeTaskExit&) {
+        }
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackDepth, void* param,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(task, name, stackDepth, param, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+    if (handle == nullptr || handle == currentTask) throw NativeTaskExit();
+    fprintf(stderr, "[native] vTaskDelete of another task is not supported\n");
+}
+
+void vTaskDelay(TickType_t ticks) {
+    delay(ticks);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+    std::lock_guard<std::mutex> guard(handle->lock);
+    handle->notifications++;
+    handle->cv.notify_all();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks) {
+    NativeTask* self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(self->lock);
+    waitFor(self->cv, lock, ticks, [self] { return self->notifications > 0; });
+    uint32_t value = self->notifications;
+    if (value) self->notifications = clearCountOnExit ? 0 : value - 1;
+    return value;
+}
+
+//------------------------------------------------------------------------------------------
+// Queues
+
+struct NativeQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t itemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    NativeQueue* queue = new NativeQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticks, bool front) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if (!waitFor(queue->changed, lock, ticks, [queue] { return queue->items.size() < queue->length; })) {
+        return errQUEUE_FULL;
+    }
+    std::vector<uint8_t> copy((const uint8_t*)item, (const uint8_t*)item + queue->itemSize);
+    if (front) {
+        queue->items.push_front(std::move(copy));
+    } else {
+        queue->items.push_back(std::move(copy));
+    }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, true);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void* item, TickType_t ticks, bool remove) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if (!waitFor(queue->changed, lock, ticks, [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    if (remove) {
+        queue->items.pop_front();
+        queue->changed.notify_all();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->items.clear();
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return (UBaseType_t)queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return (UBaseType_t)(queue->length - queue->items.size());
+}
+
+//------------------------------------------------------------------------------------------
+// Semaphores (mutexes are binary semaphores without priority inheritance)
+
+struct NativeSemaphore {
+    std::mutex lock;
+    std::condition_variable changed;
+    UBaseType_t count;
+    UBaseType_t maxCount;
+};
+
+static SemaphoreHandle_t createSemaphore(UBaseType_t maxCount, UBaseType_t initialCount) {
+    NativeSemaphore* semaphore = new NativeSemaphore();
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return createSemaphore(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return createSemaphore(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    return createSemaphore(maxCount, initialCount);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(semaphore->lock);
+    if (!waitFor(semaphore->changed, lock, ticks, [semaphore] { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->lock);
+    if (semaphore->count >= semaphore->maxCount) return pdFALSE;
+    semaphore->count++;
+    semaphore->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->lock);
+    return semaphore->count;
+}
+
+//------------------------------------------------------------------------------------------
+// Byte ring buffers
+
+struct NativeRingbuf {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<uint8_t> bytes;
+    std::vector<uint8_t> item;
+    size_t capacity;
+};
+
+RingbufHandle_t xRingbufferCreate(size_t bufferSize, RingbufferType_t) {
+    NativeRingbuf* ringbuf = new NativeRingbuf();
+    ringbuf->capacity = bufferSize;
+    return ringbuf;
+}
+
+void vRingbufferDelete(RingbufHandle_t ringbuf) {
+    delete ringbuf;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void* data, size_t size, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(ringbuf->lock);
+    if (size > ringbuf->capacity) return pdFALSE;
+    if (!waitFor(ringbuf->changed, lock, ticks, [ringbuf, size] { return ringbuf->capacity - ringbuf->bytes.size() >= size; })) {
+        return pdFALSE;
+    }
+    ringbuf->bytes.insert(ringbuf->bytes.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+    ringbuf->changed.notify_all();
+    return pdTRUE;
+}
+
+void* xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t* itemSize, TickType_t ticks, size_t maxSize) {
+    std::unique_lock<std::mutex> lock(ringbuf->lock);
+    if (!waitFor(ringbuf->changed, lock, ticks, [ringbuf] { return !ringbuf->bytes.empty(); })) {
+        return nullptr;
+    }
+    size_t n = std::min(maxSize, ringbuf->bytes.size());
+    ringbuf->item.assign(ringbuf->bytes.begin(), ringbuf->bytes.begin() + n);
+    ringbuf->bytes.erase(ringbuf->bytes.begin(), ringbuf->bytes.begin() + n);
+    *itemSize = n;
+    return ringbuf->item.data();
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void*) {
+    std::lock_guard<std::mutex> guard(ringbuf->lock);
+    ringbuf->changed.notify_all();
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf) {
+    std::lock_guard<std::mutex> guard(ringbuf->lock);
+    return ringbuf->capacity - ringbuf->bytes.size();
+}
@@ -0,0 +1,36 @@
+// Host stand-in for the FreeRTOS kernel API used by the firmware, built on
+// std::thread. Core affinity and priorities are accepted and ignored.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+// Critical sections map to a single process-wide recursive lock
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void nativeEnterCritical(portMUX_TYPE* mux);
+void nativeExitCritical(portMUX_TYPE* mux);
+#define portENTER_CRITICAL(mux) nativeEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) nativeExitCritical(mux)
+
+TickType_t xTaskGetTickCount();
+BaseType_t xPortGetCoreID();
@@ -0,0 +1,19 @@
+// Host stand-in for the ESP-IDF byte ring buffer (RINGBUF_TYPE_BYTEBUF only)
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct NativeRingbuf* RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t bufferSize, RingbufferType_t type);
+void vRingbufferDelete(RingbufHandle_t ringbuf);
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void* data, size_t size, TickType_t ticks);
+void* xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t* itemSize, TickType_t ticks, size_t maxSize);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void* item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf);
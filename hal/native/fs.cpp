@@ -0,0 +1,268 @@
+// Host implementation of fs::FS/File and of the SD card as a plain directory
+#include "FS.h"
+#include "FSImpl.h"
+#include "SD.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace fs;
+
+size_t File::write(uint8_t c) {
+    return _p ? _p->write(&c, 1) : 0;
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+    return _p ? _p->write(buf, size) : 0;
+}
+
+int File::available() {
+    return _p ? (int)(_p->size() - _p->position()) : 0;
+}
+
+int File::read() {
+    uint8_t c;
+    if (!_p || _p->read(&c, 1) != 1) return -1;
+    return c;
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+    return _p ? _p->read(buf, size) : 0;
+}
+
+int File::peek() {
+    if (!_p) return -1;
+    size_t pos = _p->position();
+    int c = read();
+    _p->seek(pos, SeekSet);
+    return c;
+}
+
+void File::flush() {
+    if (_p) _p->flush();
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    return _p ? _p->seek(pos, mode) : false;
+}
+
+size_t File::position() const {
+    return _p ? _p->position() : 0;
+}
+
+size_t File::size() const {
+    return _p ? _p->size() : 0;
+}
+
+void File::close() {
+    if (_p) {
+        _p->close();
+        _p = nullptr;
+    }
+}
+
+File::operator bool() const {
+    return _p != nullptr && *_p != false;
+}
+
+time_t File::getLastWrite() {
+    return _p ? _p->getLastWrite() : 0;
+}
+
+const char* File::name() const {
+    return _p ? _p->name() : nullptr;
+}
+
+boolean File::isDirectory(void) {
+    return _p ? _p->isDirectory() : false;
+}
+
+File File::openNextFile(const char* mode) {
+    return _p ? File(_p->openNextFile(mode)) : File();
+}
+
+void File::rewindDirectory(void) {
+    if (_p) _p->rewindDirectory();
+}
+
+File FS::open(const char* path, const char* mode) {
+    if (!_impl || !path) return File();
+    return File(_impl->open(path, mode));
+}
+
+bool FS::exists(const char* path) {
+    return _impl && path && _impl->exists(path);
+}
+
+bool FS::remove(const char* path) {
+    return _impl && path && _impl->remove(path);
+}
+
+bool FS::rename(const char* pathFrom, const char* pathTo) {
+    return _impl && pathFrom && pathTo && _impl->rename(pathFrom, pathTo);
+}
+
+bool FS::mkdir(const char* path) {
+    return _impl && path && _impl->mkdir(path);
+}
+
+bool FS::rmdir(const char* path) {
+    return _impl && path && _impl->rmdir(path);
+}
+
+//------------------------------------------------------------------------------------------
+// POSIX directory backend
+
+class PosixFileImpl : public FileImpl {
+public:
+    PosixFileImpl(const std::string& hostPath, const std::string& name, FILE* file, DIR* dir)
+        : _hostPath(hostPath), _name(name), _file(file), _dir(dir) {}
+    ~PosixFileImpl() override { close(); }
+
+    size_t write(const uint8_t* buf, size_t size) override {
+        return _file ? fwrite(buf, 1, size, _file) : 0;
+    }
+    size_t read(uint8_t* buf, size_t size) override {
+        return _file ? fread(buf, 1, size, _file) : 0;
+    }
+    void flush() override {
+        if (_file) fflush(_file);
+    }
+    bool seek(uint32_t pos, SeekMode mode) override {
+        if (!_file) return false;
+        int whence = mode == SeekSet ? SEEK_SET : (mode == SeekCur ? SEEK_CUR : SEEK_END);
+        return fseek(_file, pos, whence) == 0;
+    }
+    size_t position() const override {
+        return _file ? (size_t)ftell(_file) : 0;
+    }
+    size_t size() const override {
+        if (!_file) return 0;
+        fflush(_file);
+        struct stat st;
+        return fstat(fileno(_file), &st) == 0 ? (size_t)st.st_size : 0;
+    }
+    void close() override {
+        if (_file) fclose(_file);
+        if (_dir) closedir(_dir);
+        _file = nullptr;
+        _dir = nullptr;
+    }
+    time_t getLastWrite() override {
+        struct stat st;
+        return stat(_hostPath.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+    const char* name() const override { return _name.c_str(); }
+    boolean isDirectory(void) override { return _dir != nullptr; }
+    FileImplPtr openNextFile(const char* mode) override;
+    void rewindDirectory(void) override {
+        if (_dir) rewinddir(_dir);
+    }
+    operator bool() override { return _file != nullptr || _dir != nullptr; }
+
+private:
+    std::string _hostPath;
+    std::string _name;
+    FILE* _file;
+    DIR* _dir;
+};
+
+class PosixFSImpl : public FSImpl {
+public:
+    explicit PosixFSImpl(const std::string& root) : _root(root) {}
+
+    std::string hostPath(const char* path) const {
+        std::string p = path;
+        if (p.empty() || p[0] != '/') p = "/" + p;
+        return _root + p;
+    }
+
+    FileImplPtr open(const char* path, const char* mode) override {
+        std::string host = hostPath(path);
+        struct stat st;
+        if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            DIR* dir = opendir(host.c_str());
+            return dir ? std::make_shared<PosixFileImpl>(host, path, nullptr, dir) : FileImplPtr();
+        }
+        const char* hostMode = "rb";
+        if (mode[0] == 'w') hostMode = "wb+";
+        if (mode[0] == 'a') hostMode = "ab+";
+        FILE* file = fopen(host.c_str(), hostMode);
+        return file ? std::make_shared<PosixFileImpl>(host, path, file, nullptr) : FileImplPtr();
+    }
+    bool exists(const char* path) override {
+        struct stat st;
+        return stat(hostPath(path).c_str(), &st) == 0;
+    }
+    bool rename(const char* pathFrom, const char* pathTo) override {
+        return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+    }
+    bool remove(const char* path) override {
+        return unlink(hostPath(path).c_str()) == 0;
+    }
+    bool mkdir(const char* path) override {
+        return ::mkdir(hostPath(path).c_str(), 0755) == 0 || errno == EEXIST;
+    }
+    bool rmdir(const char* path) override {
+        return ::rmdir(hostPath(path).c_str()) == 0;
+    }
+
+private:
+    std::string _root;
+};
+
+FileImplPtr PosixFileImpl::openNextFile(const char* mode) {
+    if (!_dir) return FileImplPtr();
+    struct dirent* entry;
+    while ((entry = readdir(_dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        std::string name = _name;
+        if (name.empty() || name.back() != '/') name += "/";
+        name += entry->d_name;
+        std::string host = _hostPath + "/" + entry->d_name;
+        struct stat st;
+        if (stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            DIR* dir = opendir(host.c_str());
+            if (dir) return std::make_shared<PosixFileImpl>(host, name, nullptr, dir);
+            continue;
+        }
+        FILE* file = fopen(host.c_str(), mode[0] == 'r' ? "rb" : "ab+");
+        if (file) return std::make_shared<PosixFileImpl>(host, name, file, nullptr);
+    }
+    return FileImplPtr();
+}
+
+FSImplPtr fs::nativeDirectoryFS(const char* root) {
+    return std::make_shared<PosixFSImpl>(root);
+}
+
+static std::string sdRoot() {
+    const char* env = getenv("STORYBOX_SD_DIR");
+    return env ? env : "sdcard";
+}
+
+SPIClass SPI;
+fs::SDFS SD(fs::nativeDirectoryFS(sdRoot().c_str()));
+
+bool SDFS::begin(uint8_t, SPIClass&, uint32_t, const char*, uint8_t) {
+    struct stat st;
+    if (stat(sdRoot().c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "[native] SD directory %s does not exist\n", sdRoot().c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t SDFS::cardSize() {
+    return 4ULL * 1024 * 1024 * 1024;
+}
+
+uint64_t SDFS::totalBytes() {
+    return cardSize();
+}
+
+uint64_t SDFS::usedBytes() {
+    return 0;
+}
@@ -0,0 +1,31 @@
+// Host entry point: builds the sketch as C++ and plays STORYBOX_GAMES games
+// (default 1) by calling setup() once and then loop() until they are over.
+//
+//   pio run -e native && .pio/build/native/program
+//
+// Environment:
+//   STORYBOX_SD_DIR      directory standing in for the SD card (default "sdcard");
+//                        it needs the clips from audio/ copied into it
+//   STORYBOX_API_HOST    where every API request is sent (default 127.0.0.1)
+//   STORYBOX_API_PORT    port of the API stand-in (default 8080)
+//   STORYBOX_MIC_WAV     16-bit WAV replayed as microphone input (default: noise floor)
+//   STORYBOX_GPS_NMEA    NMEA log replayed on the GPS UART
+//   STORYBOX_TIME_SCALE  run this many times faster than real time (default 1)
+//   STORYBOX_GAMES       number of games to play
+#include "../../source_code.c"
+
+#include <unistd.h>
+
+int main() {
+    const char* env = getenv("STORYBOX_GAMES");
+    int games = env ? atoi(env) : 1;
+
+    setup();
+    while (gamesPlayed < games) {
+        loop();
+    }
+    // The sketch's tasks never return, so leave without running the static
+    // destructors of the globals they may still be using
+    fflush(stdout);
+    _exit(0);
+}
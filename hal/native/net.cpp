@@ -0,0 +1,451 @@
+// Host implementation of WiFi, the TCP client and HTTPClient. Every hostname
+// is redirected to the local API stand-in so that the firmware's real request
+// code paths run unchanged against tools/mock_api_server.py.
+#include "WiFi.h"
+#include "WiFiClient.h"
+#include "HTTPClient.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+
+static const char* apiHost() {
+    const char* env = getenv("STORYBOX_API_HOST");
+    return env ? env : "127.0.0.1";
+}
+
+static uint16_t apiPort() {
+    const char* env = getenv("STORYBOX_API_PORT");
+    return env ? (uint16_t)atoi(env) : 8080;
+}
+
+int WiFiClass::hostByName(const char* host, IPAddress& result) {
+    (void)host;
+    struct addrinfo hints = {};
+    struct addrinfo* info = nullptr;
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(apiHost(), nullptr, &hints, &info) != 0 || !info) return 0;
+    uint32_t addr = ntohl(((struct sockaddr_in*)info->ai_addr)->sin_addr.s_addr);
+    result = IPAddress(addr >> 24, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF, addr & 0xFF);
+    freeaddrinfo(info);
+    return 1;
+}
+
+//------------------------------------------------------------------------------------------
+// WiFiClient
+
+// lwIP on the ESP32 buffers this much unacknowledged data per socket
+// (CONFIG_TCP_SND_BUF_DEFAULT), so a slow server pushes back on write()
+// almost at once; the host's own send buffer would absorb megabytes
+#define LWIP_TCP_SND_BUF 5744
+
+static std::atomic<uint64_t> bytesSent(0);
+static std::atomic<uint64_t> bytesReceived(0);
+
+uint64_t WiFiClient::totalBytesSent() {
+    return bytesSent.load();
+}
+
+uint64_t WiFiClient::totalBytesReceived() {
+    return bytesReceived.load();
+}
+
+WiFiClient::~WiFiClient() {
+    stop();
+}
+
+int WiFiClient::connect(IPAddress, uint16_t port) {
+    return connect(apiHost(), port);
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+    (void)host;
+    (void)port;
+    stop();
+
+    struct addrinfo hints = {};
+    struct addrinfo* info = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    String service(apiPort());
+    if (getaddrinfo(apiHost(), service.c_str(), &hints, &info) != 0 || !info) return 0;
+
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(info);
+        return 0;
+    }
+    if (::connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+        ::close(fd);
+        freeaddrinfo(info);
+        return 0;
+    }
+    freeaddrinfo(info);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int sendBuffer = LWIP_TCP_SND_BUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    _fd = fd;
+    _rxStart = _rxEnd = 0;
+    return 1;
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t size) {
+    if (_fd < 0) return 0;
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t n = ::send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            stop();
+            break;
+        }
+        sent += n;
+    }
+    bytesSent += sent;
+    return sent;
+}
+
+// Pulls more bytes from the socket, waiting up to timeoutMs for them
+bool WiFiClient::fill(int timeoutMs) {
+    if (_fd < 0) return false;
+    if (_rxStart == _rxEnd) _rxStart = _rxEnd = 0;
+    if (_rxEnd == sizeof(_rx)) return true;
+
+    struct pollfd pfd = {_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) return false;
+    ssize_t n = ::recv(_fd, _rx + _rxEnd, sizeof(_rx) - _rxEnd, 0);
+    if (n <= 0) {
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _rxEnd += n;
+    bytesReceived += n;
+    return true;
+}
+
+int WiFiClient::available() {
+    if (_rxStart == _rxEnd) fill(0);
+    return (int)(_rxEnd - _rxStart);
+}
+
+int WiFiClient::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buf, size_t size) {
+    if (_rxStart == _rxEnd && !fill(0)) return _fd < 0 ? -1 : 0;
+    size_t n = std::min(size, _rxEnd - _rxStart);
+    memcpy(buf, _rx + _rxStart, n);
+    _rxStart += n;
+    return (int)n;
+}
+
+int WiFiClient::peek() {
+    if (_rxStart == _rxEnd && !fill(0)) return -1;
+    return _rx[_rxStart];
+}
+
+void WiFiClient::stop() {
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+    _rxStart = _rxEnd = 0;
+}
+
+uint8_t WiFiClient::connected() {
+    if (_rxStart != _rxEnd) return 1;
+    if (_fd < 0) return 0;
+    struct pollfd pfd = {_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) > 0) {
+        // Readable with nothing buffered means either data or an orderly close
+        return fill(0) ? 1 : 0;
+    }
+    return 1;
+}
+
+//------------------------------------------------------------------------------------------
+// HTTPClient
+
+HTTPClient::~HTTPClient() {
+    if (_ownClient) _ownClient->stop();
+}
+
+bool HTTPClient::begin(String url) {
+    if (!_ownClient) _ownClient.reset(new WiFiClient());
+    return begin(*_ownClient, url);
+}
+
+bool HTTPClient::begin(WiFiClient& client, String url) {
+    _client = &client;
+    int index = url.indexOf("://");
+    if (index < 0) return false;
+    _protocol = url.substring(0, index);
+    if (_protocol != "http" && _protocol != "https") return false;
+    _port = _protocol == "https" ? 443 : 80;
+    url = url.substring(index + 3);
+
+    index = url.indexOf('/');
+    String host = index < 0 ? url : url.substring(0, index);
+    _uri = index < 0 ? String("/") : url.substring(index);
+    index = host.indexOf(':');
+    if (index >= 0) {
+        _port = (uint16_t)host.substring(index + 1).toInt();
+        host = host.substring(0, index);
+    }
+    _host = host;
+    _headers = "";
+    _returnCode = 0;
+    _size = -1;
+    return true;
+}
+
+void HTTPClient::end() {
+    disconnect(false);
+}
+
+void HTTPClient::disconnect(bool preserveClient) {
+    if (connected()) {
+        if (_reuse && _canReuse) {
+            // Leave the connection open for the next request on this client
+        } else {
+            _client->stop();
+            if (!preserveClient) _client = nullptr;
+        }
+    }
+}
+
+bool HTTPClient::connected() {
+    return _client && (_client->available() > 0 || _client->connected());
+}
+
+void HTTPClient::addHeader(const String& name, const String& value, bool first, bool replace) {
+    (void)replace;
+    String line = name + ": " + value + "\r\n";
+    if (first) {
+        _headers = line + _headers;
+    } else {
+        _headers += line;
+    }
+}
+
+void HTTPClient::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+    _collectKeys.clear();
+    for (size_t i = 0; i < headerKeysCount; i++) _collectKeys.push_back(String(headerKeys[i]));
+    _collectValues.assign(headerKeysCount, String());
+}
+
+String HTTPClient::header(const char* name) {
+    for (size_t i = 0; i < _collectKeys.size(); i++) {
+        if (_collectKeys[i].equalsIgnoreCase(String(name))) return _collectValues[i];
+    }
+    return String();
+}
+
+bool HTTPClient::hasHeader(const char* name) {
+    return header(name).length() > 0;
+}
+
+bool HTTPClient::connect() {
+    if (connected()) {
+        // Discard anything left over from the previous response
+        while (_client->available() > 0) _client->read();
+        return true;
+    }
+    if (!_client) return false;
+    if (!_client->connect(_host.c_str(), _port)) return false;
+    _client->setTimeout((_tcpTimeout + 999) / 1000);
+    return true;
+}
+
+int HTTPClient::returnError(int error) {
+    if (error < 0 && connected()) {
+        _client->stop();
+    }
+    return error;
+}
+
+int HTTPClient::GET() {
+    return sendRequest("GET");
+}
+
+int HTTPClient::POST(uint8_t* payload, size_t size) {
+    return sendRequest("POST", payload, size);
+}
+
+int HTTPClient::POST(String payload) {
+    return sendRequest("POST", (uint8_t*)payload.c_str(), payload.length());
+}
+
+int HTTPClient::sendRequest(const char* type, String payload) {
+    return sendRequest(type, (uint8_t*)payload.c_str(), payload.length());
+}
+
+int HTTPClient::sendRequest(const char* type, uint8_t* payload, size_t size) {
+    _canReuse = _reuse;
+    if (!connect()) return returnError(HTTPC_ERROR_CONNECTION_REFUSED);
+
+    String request = String(type) + " " + _uri + (_useHTTP10 ? " HTTP/1.0\r\n" : " HTTP/1.1\r\n");
+    request += "Host: " + _host + "\r\n";
+    request += "User-Agent: ESP32HTTPClient\r\n";
+    request += String("Connection: ") + (_reuse && !_useHTTP10 ? "keep-alive" : "close") + "\r\n";
+    if (payload && size > 0) request += "Content-Length: " + String((unsigned long)size) + "\r\n";
+    request += _headers + "\r\n";
+
+    if (_client->write((const uint8_t*)request.c_str(), request.length()) != request.length()) {
+        return returnError(HTTPC_ERROR_SEND_HEADER_FAILED);
+    }
+    if (payload && size > 0 && _client->write(payload, size) != size) {
+        return returnError(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+    }
+    return returnError(handleHeaderResponse());
+}
+
+int HTTPClient::handleHeaderResponse() {
+    if (!connected()) return HTTPC_ERROR_NOT_CONNECTED;
+
+    _returnCode = 0;
+    _size = -1;
+    _transferEncoding = HTTPC_TE_IDENTITY;
+    for (auto& value : _collectValues) value = "";
+
+    unsigned long lastDataTime = millis();
+    while (connected()) {
+        if (_client->available() > 0) {
+            String headerLine = _client->readStringUntil('\n');
+            headerLine.trim();
+            lastDataTime = millis();
+
+            if (headerLine.startsWith("HTTP/1.")) {
+                if (headerLine.startsWith("HTTP/1.0")) _canReuse = false;
+                _returnCode = headerLine.substring(9, headerLine.indexOf(' ', 9)).toInt();
+            } else if (headerLine.indexOf(':') > 0) {
+                String name = headerLine.substring(0, headerLine.indexOf(':'));
+                String value = headerLine.substring(headerLine.indexOf(':') + 1);
+                value.trim();
+                if (name.equalsIgnoreCase("Content-Length")) _size = value.toInt();
+                if (name.equalsIgnoreCase("Connection") && value.indexOf("close") >= 0 && value.indexOf("keep-alive") < 0) {
+                    _canReuse = false;
+                }
+                if (name.equalsIgnoreCase("Transfer-Encoding") && value.equalsIgnoreCase("chunked")) {
+                    _transferEncoding = HTTPC_TE_CHUNKED;
+                }
+                for (size_t i = 0; i < _collectKeys.size(); i++) {
+                    if (_collectKeys[i].equalsIgnoreCase(name)) _collectValues[i] = value;
+                }
+            }
+
+            if (headerLine == "") {
+                if (_returnCode) return _returnCode;
+                return HTTPC_ERROR_NO_HTTP_SERVER;
+            }
+        } else {
+            if (millis() - lastDataTime > (unsigned long)_tcpTimeout * 6) return HTTPC_ERROR_READ_TIMEOUT;
+            delay(1);
+        }
+    }
+    return HTTPC_ERROR_CONNECTION_LOST;
+}
+
+// Copies exactly size bytes (or until close when size < 0) from the socket
+int HTTPClient::writeToStreamDataBlock(Stream* stream, int size) {
+    uint8_t buff[1460];
+    int bytesWritten = 0;
+    unsigned long lastDataTime = millis();
+    while (connected() && (size < 0 || bytesWritten < size)) {
+        int want = (int)sizeof(buff);
+        if (size >= 0) want = std::min(want, size - bytesWritten);
+        int n = _client->read(buff, want);
+        if (n > 0) {
+            if (stream->write(buff, n) != (size_t)n) return HTTPC_ERROR_STREAM_WRITE;
+            bytesWritten += n;
+            lastDataTime = millis();
+        } else {
+            if (millis() - lastDataTime > (unsigned long)_tcpTimeout * 6) return HTTPC_ERROR_READ_TIMEOUT;
+            delay(1);
+        }
+    }
+    if (size >= 0 && bytesWritten < size) return HTTPC_ERROR_CONNECTION_LOST;
+    return bytesWritten;
+}
+
+int HTTPClient::writeToStream(Stream* stream) {
+    if (!stream) return returnError(HTTPC_ERROR_NO_STREAM);
+    if (!connected()) return returnError(HTTPC_ERROR_NOT_CONNECTED);
+
+    int ret = 0;
+    if (_transferEncoding == HTTPC_TE_IDENTITY) {
+        ret = writeToStreamDataBlock(stream, _size);
+        if (_size < 0) _canReuse = false;
+    } else {
+        int size = 0;
+        while (true) {
+            if (!connected()) return returnError(HTTPC_ERROR_CONNECTION_LOST);
+            String chunkHeader = _client->readStringUntil('\n');
+            if (chunkHeader.length() <= 0) return returnError(HTTPC_ERROR_READ_TIMEOUT);
+            chunkHeader.trim();
+            int len = (int)strtol(chunkHeader.c_str(), nullptr, 16);
+            if (len > 0) {
+                int r = writeToStreamDataBlock(stream, len);
+                if (r < 0) return returnError(r);
+                ret += r;
+            }
+            char buf[2];
+            if (_client->readBytes(buf, 2) != 2 || buf[0] != '\r' || buf[1] != '\n') {
+                return returnError(HTTPC_ERROR_READ_TIMEOUT);
+            }
+            if (len == 0) break;
+            size += len;
+        }
+    }
+    end();
+    return ret;
+}
+
+namespace {
+class StringStream : public Stream {
+public:
+    explicit StringStream(String& s) : _s(s) {}
+    size_t write(uint8_t c) override { _s += (char)c; return 1; }
+    size_t write(const uint8_t* buf, size_t size) override { _s.concat((const char*)buf, size); return size; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+private:
+    String& _s;
+};
+} // namespace
+
+String HTTPClient::getString(void) {
+    String payload;
+    if (_size > 0) payload.reserve(_size);
+    StringStream sstream(payload);
+    writeToStream(&sstream);
+    return payload;
+}
+
+String HTTPClient::errorToString(int error) {
+    switch (error) {
+    case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+    case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+    case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return "send payload failed";
+    case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+    case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+    case HTTPC_ERROR_NO_STREAM: return "no stream";
+    case HTTPC_ERROR_NO_HTTP_SERVER: return "no HTTP server";
+    case HTTPC_ERROR_TOO_LESS_RAM: return "too less ram";
+    case HTTPC_ERROR_ENCODING: return "Transfer-Encoding not supported";
+    case HTTPC_ERROR_STREAM_WRITE: return "Stream write error";
+    case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+    default: return String();
+    }
+}
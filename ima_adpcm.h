@@ -0,0 +1,179 @@
+// IMA-ADPCM encoder for WAV files (format 0x0011, as written by Windows and
+// read by ffmpeg), used to shrink recordings about 4:1 before they are sent
+// to the STT API.
+//
+// Each 16-bit sample becomes a 4-bit step against a predictor, so encoding
+// costs a few integer operations per sample, far below real time at 16 kHz.
+// Samples are grouped into blocks of ADPCM_BLOCK_BYTES. Each block starts
+// with the predictor state, so a decoder never carries an error from one
+// block into the next.
+//
+// Header-only so the host benchmark (bench/adpcm_bench.cpp) measures exactly
+// the code the firmware runs.
+#pragma once
+
+#include <Arduino.h>
+
+#define ADPCM_BLOCK_BYTES 256 // the usual block size for mono at 16 kHz or less
+#define ADPCM_BLOCK_SAMPLES ((ADPCM_BLOCK_BYTES - 4) * 2 + 1) // 505: the header holds one sample
+#define ADPCM_WAV_HEADER_SIZE 60 // RIFF, fmt (20 bytes), fact and data chunk headers
+
+static const int16_t adpcmStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t adpcmIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Encoded size of sampleCount samples, header excluded; a constant expression for buffer sizes
+#define ADPCM_ENCODED_SIZE(sampleCount) \
+    (((sampleCount) + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES)
+
+// Function to fill in the 60-byte WAV header for mono IMA-ADPCM data;
+// 0xFFFFFFFF leaves the sizes open for a streamed upload
+inline void buildAdpcmWavHeader(uint8_t* header, uint32_t sampleRate, uint32_t dataSize, uint32_t sampleCount) {
+    uint32_t riffSize = dataSize == 0xFFFFFFFF ? dataSize : dataSize + ADPCM_WAV_HEADER_SIZE - 8;
+    uint32_t byteRate = sampleRate * ADPCM_BLOCK_BYTES / ADPCM_BLOCK_SAMPLES;
+    const struct {
+        uint8_t offset;
+        uint8_t size;
+        uint32_t value;
+    } fields[] = {
+        {4, 4, riffSize},
+        {16, 4, 20},                  // fmt chunk size
+        {20, 2, 0x0011},              // IMA ADPCM
+        {22, 2, 1},                   // Mono channel
+        {24, 4, sampleRate},
+        {28, 4, byteRate},
+        {32, 2, ADPCM_BLOCK_BYTES},   // Block align
+        {34, 2, 4},                   // Bits per sample
+        {36, 2, 2},                   // Extra format bytes
+        {38, 2, ADPCM_BLOCK_SAMPLES}, // Samples per block
+        {44, 4, 4},                   // fact chunk size
+        {48, 4, sampleCount},
+        {56, 4, dataSize},
+    };
+
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 40, "fact", 4);
+    memcpy(header + 52, "data", 4);
+    for (const auto& field : fields) {
+        for (uint8_t i = 0; i < field.size; i++) {
+            header[field.offset + i] = (uint8_t)(field.value >> (8 * i));
+        }
+    }
+}
+
+// Encodes a stream of 16-bit mono samples into whole ADPCM blocks
+class ImaAdpcmEncoder {
+private:
+    int16_t pending[ADPCM_BLOCK_SAMPLES]; // samples of the block being filled
+    size_t pendingCount;
+    int32_t predictor;
+    int stepIndex;
+
+    // Function to encode one sample as a 4-bit code, updating the predictor
+    uint8_t encodeSample(int16_t sample) {
+        int step = adpcmStepTable[stepIndex];
+        int difference = sample - predictor;
+        uint8_t code = 0;
+        if (difference < 0) {
+            code = 8;
+            difference = -difference;
+        }
+
+        // Quantise the difference in steps of step/4, rebuilding it as the decoder will
+        int delta = step >> 3;
+        if (difference >= step) {
+            code |= 4;
+            difference -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (difference >= step) {
+            code |= 2;
+            difference -= step;
+            delta += step;
+        }
+        step >>= 1;
+        if (difference >= step) {
+            code |= 1;
+            delta += step;
+        }
+
+        predictor += (code & 8) ? -delta : delta;
+        if (predictor > 32767) {
+            predictor = 32767;
+        } else if (predictor < -32768) {
+            predictor = -32768;
+        }
+        stepIndex += adpcmIndexTable[code];
+        if (stepIndex < 0) {
+            stepIndex = 0;
+        } else if (stepIndex > 88) {
+            stepIndex = 88;
+        }
+        return code;
+    }
+
+    // Function to encode the pending samples as one block of ADPCM_BLOCK_BYTES
+    void encodeBlock(uint8_t* block) {
+        // The first sample goes into the header verbatim and restarts the predictor
+        predictor = pending[0];
+        block[0] = (uint8_t)(pending[0] & 0xFF);
+        block[1] = (uint8_t)((pending[0] >> 8) & 0xFF);
+        block[2] = (uint8_t)stepIndex;
+        block[3] = 0;
+        for (size_t i = 1, out = 4; i < ADPCM_BLOCK_SAMPLES; i += 2, out++) {
+            uint8_t low = encodeSample(pending[i]);
+            uint8_t high = encodeSample(pending[i + 1]);
+            block[out] = low | (high << 4);
+        }
+        pendingCount = 0;
+    }
+
+public:
+    ImaAdpcmEncoder() {
+        reset();
+    }
+
+    // Function to start a new recording
+    void reset() {
+        pendingCount = 0;
+        predictor = 0;
+        stepIndex = 0;
+    }
+
+    // Function to add samples; every block they complete is written to output,
+    // which needs room for ADPCM_ENCODED_SIZE(count) + ADPCM_BLOCK_BYTES bytes.
+    // Returns the number of bytes written
+    size_t encode(const int16_t* samples, size_t count, uint8_t* output) {
+        size_t written = 0;
+        for (size_t i = 0; i < count; i++) {
+            pending[pendingCount++] = samples[i];
+            if (pendingCount == ADPCM_BLOCK_SAMPLES) {
+                encodeBlock(output + written);
+                written += ADPCM_BLOCK_BYTES;
+            }
+        }
+        return written;
+    }
+
+    // Function to write out the last, partial block padded with silence; returns its size
+    size_t finish(uint8_t* output) {
+        if (pendingCount == 0) {
+            return 0;
+        }
+        memset(pending + pendingCount, 0, (ADPCM_BLOCK_SAMPLES - pendingCount) * sizeof(int16_t));
+        encodeBlock(output);
+        return ADPCM_BLOCK_BYTES;
+    }
+};
@@ -0,0 +1,331 @@
+// Streaming NMEA 0183 parser for the GPS receiver's GGA and RMC sentences.
+//
+// Bytes are fed one at a time as they come off the UART, and each field is
+// decoded as soon as its comma arrives, so a sentence is never buffered as a
+// whole and nothing is allocated: the parser's state is a few dozen bytes.
+// The fix is only updated once the sentence's checksum has been verified,
+// and only from sentences that report a fix (GGA quality above zero, RMC
+// status A) with a complete position. Sentences from any talker (GP, GN,
+// GL, ...) are accepted; all other sentence types are skipped unread.
+//
+// Header-only so the host microbenchmark and fuzzer (bench/nmea_bench.cpp)
+// can use exactly the code the firmware runs.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NMEA_MAX_SENTENCE 120 // the standard allows 82 bytes, but receivers in high-precision mode send more
+#define NMEA_MAX_FIELD 15    // longest field decoded, e.g. "15112.91800000"
+#define NMEA_MAX_DIGITS 9    // significant digits a coordinate is decoded to
+#define NMEA_MAX_DECIMALS 6  // digits after the point; a millionth of a minute is 2 mm
+
+// The receiver's position, as of its last sentence that reported a fix
+struct GpsFix {
+    float latitude;     // decimal degrees, south negative
+    float longitude;    // decimal degrees, west negative
+    float hdop;         // horizontal dilution of precision; 0 until a GGA reports it
+    uint8_t quality;    // GGA fix quality: 1 GPS, 2 DGPS, ...
+    uint8_t satellites; // satellites used, from GGA
+    bool valid;         // false until the first fix
+};
+
+class NmeaParser {
+private:
+    enum State {
+        WAIT_START,     // skipping bytes until the next '$'
+        FIELDS,         // reading comma-separated fields
+        CHECKSUM_HIGH,  // first hex digit after '*'
+        CHECKSUM_LOW    // second hex digit
+    };
+
+    enum Sentence {
+        UNKNOWN,
+        GGA,
+        RMC
+    };
+
+    State state;
+    Sentence sentence;
+    uint8_t checksum;   // XOR of the bytes between '$' and '*'
+    uint8_t expected;   // checksum the sentence carries
+    uint8_t length;     // bytes of the sentence so far
+    uint8_t fieldIndex;
+    uint8_t fieldLength;
+    char field[NMEA_MAX_FIELD + 1];
+
+    // What the sentence says so far; committed to fix once its checksum is checked
+    float latitude;
+    float longitude;
+    float hdop;
+    uint8_t quality;
+    uint8_t satellites;
+    uint8_t position; // bits for latitude, N/S, longitude and E/W seen
+    bool active;      // RMC status A, or GGA quality above zero
+    bool hasHdop;
+
+    GpsFix current;
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    // Function to decode a decimal field into mantissa / scale; false if it is empty or not a number
+    static bool decodeDecimal(const char* text, uint8_t count, uint32_t& mantissa, uint32_t& scale) {
+        mantissa = 0;
+        scale = 1;
+        uint8_t digits = 0;
+        uint8_t decimals = 0;
+        bool point = false;
+        for (uint8_t i = 0; i < count; i++) {
+            char c = text[i];
+            if (c == '.' && !point) {
+                point = true;
+            } else if (c >= '0' && c <= '9') {
+                if (digits == NMEA_MAX_DIGITS || decimals == NMEA_MAX_DECIMALS) {
+                    if (!point) {
+                        return false; // Too large to be a coordinate
+                    }
+                    continue; // Finer than a float can hold
+                }
+                mantissa = mantissa * 10 + (c - '0');
+                digits++;
+                if (point) {
+                    scale *= 10;
+                    decimals++;
+                }
+            } else {
+                return false;
+            }
+        }
+        return digits > 0;
+    }
+
+    // Function to decode "ddmm.mmmm" (or "dddmm.mmmm") into degrees; false if it is not a coordinate
+    static bool decodeCoordinate(const char* text, uint8_t count, float limit, float& degrees) {
+        uint32_t mantissa, scale;
+        if (!decodeDecimal(text, count, mantissa, scale)) {
+            return false;
+        }
+        uint32_t perDegree = 100 * scale;
+        uint32_t minutes = mantissa % perDegree;
+        if (minutes >= 60 * scale) {
+            return false;
+        }
+        degrees = (float)(mantissa / perDegree) + (float)minutes / (60.0f * scale);
+        return degrees <= limit;
+    }
+
+    // Function to decode a small whole number; -1 if the field is not one
+    static int decodeCount(const char* text, uint8_t count) {
+        if (count == 0 || count > 2) {
+            return -1;
+        }
+        int value = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            if (text[i] < '0' || text[i] > '9') {
+                return -1;
+            }
+            value = value * 10 + (text[i] - '0');
+        }
+        return value;
+    }
+
+    // Function to decode the field that just ended; false if the sentence should be dropped
+    bool endField() {
+        if (fieldIndex == 0) {
+            // Address: two-letter talker then the sentence type
+            if (fieldLength != 5) {
+                return false;
+            }
+            if (field[2] == 'G' && field[3] == 'G' && field[4] == 'A') {
+                sentence = GGA;
+            } else if (field[2] == 'R' && field[3] == 'M' && field[4] == 'C') {
+                sentence = RMC;
+            } else {
+                return false; // Not a sentence we use, so do not read on
+            }
+            return true;
+        }
+
+        // GGA: 2 lat, 3 N/S, 4 lon, 5 E/W, 6 quality, 7 satellites, 8 HDOP
+        // RMC: 2 status, 3 lat, 4 N/S, 5 lon, 6 E/W
+        int index = sentence == RMC ? fieldIndex - 1 : fieldIndex;
+        if (sentence == RMC && fieldIndex == 2) {
+            active = fieldLength == 1 && field[0] == 'A';
+            return true;
+        }
+        switch (index) {
+        case 2:
+            if (decodeCoordinate(field, fieldLength, 90, latitude)) position |= 1;
+            break;
+        case 3:
+            if (fieldLength == 1 && (field[0] == 'N' || field[0] == 'S')) {
+                position |= 2;
+                if (field[0] == 'S') latitude = -latitude;
+            }
+            break;
+        case 4:
+            if (decodeCoordinate(field, fieldLength, 180, longitude)) position |= 4;
+            break;
+        case 5:
+            if (fieldLength == 1 && (field[0] == 'E' || field[0] == 'W')) {
+                position |= 8;
+                if (field[0] == 'W') longitude = -longitude;
+            }
+            break;
+        default:
+            break;
+        }
+        if (sentence != GGA) {
+            return true;
+        }
+
+        if (fieldIndex == 6) {
+            int value = decodeCount(field, fieldLength);
+            quality = value > 0 ? value : 0;
+            active = quality > 0;
+        } else if (fieldIndex == 7) {
+            int value = decodeCount(field, fieldLength);
+            satellites = value > 0 ? value : 0;
+        } else if (fieldIndex == 8) {
+            uint32_t mantissa, scale;
+            hasHdop = decodeDecimal(field, fieldLength, mantissa, scale);
+            hdop = hasHdop ? (float)mantissa / scale : 0;
+        }
+        return true;
+    }
+
+    // Function to apply a sentence whose checksum matched; true if it updated the fix
+    bool commit() {
+        sentences++;
+        if (!active || position != 15) {
+            return false;
+        }
+        current.latitude = latitude;
+        current.longitude = longitude;
+        if (sentence == GGA) {
+            current.quality = quality;
+            current.satellites = satellites;
+            if (hasHdop) {
+                current.hdop = hdop;
+            }
+        } else if (current.quality == 0) {
+            current.quality = 1; // RMC only says there is a fix
+        }
+        current.valid = true;
+        fixes++;
+        return true;
+    }
+
+    void startSentence() {
+        state = FIELDS;
+        sentence = UNKNOWN;
+        checksum = 0;
+        length = 1;
+        fieldIndex = 0;
+        fieldLength = 0;
+        position = 0;
+        active = false;
+        hasHdop = false;
+        quality = 0;
+        satellites = 0;
+    }
+
+public:
+    uint32_t sentences;      // GGA and RMC sentences whose checksum matched
+    uint32_t fixes;          // of those, the ones that updated the fix
+    uint32_t checksumErrors; // sentences dropped for a wrong checksum
+    uint32_t malformed;      // sentences dropped for being too long or garbled
+
+    NmeaParser() : state(WAIT_START), sentence(UNKNOWN), checksum(0), expected(0), length(0),
+                   fieldIndex(0), fieldLength(0), latitude(0), longitude(0), hdop(0),
+                   quality(0), satellites(0), position(0), active(false), hasHdop(false),
+                   current(), sentences(0), fixes(0), checksumErrors(0), malformed(0) {}
+
+    // Function to forget the fix and any sentence in progress
+    void reset() {
+        *this = NmeaParser();
+    }
+
+    // Function to feed the next received byte; true when it completes a
+    // sentence that updated the fix
+    bool feed(char c) {
+        if (c == '$') {
+            if (state != WAIT_START) {
+                malformed++; // A sentence was cut short
+            }
+            startSentence();
+            return false;
+        }
+        if (state == WAIT_START) {
+            return false;
+        }
+        if (++length > NMEA_MAX_SENTENCE || c < ' ' || c > '~') {
+            malformed++;
+            state = WAIT_START;
+            return false;
+        }
+
+        switch (state) {
+        case FIELDS:
+            if (c == ',' || c == '*') {
+                if (!endField()) {
+                    state = WAIT_START; // Another sentence type, or a garbled address
+                    return false;
+                }
+                fieldIndex++;
+                fieldLength = 0;
+                if (c == '*') {
+                    state = CHECKSUM_HIGH;
+                    return false;
+                }
+            } else if (fieldLength < NMEA_MAX_FIELD) {
+                field[fieldLength++] = c;
+            } else {
+                malformed++;
+                state = WAIT_START;
+                return false;
+            }
+            checksum ^= (uint8_t)c;
+            return false;
+
+        case CHECKSUM_HIGH: {
+            int value = hexValue(c);
+            if (value < 0) {
+                malformed++;
+                state = WAIT_START;
+                return false;
+            }
+            expected = value << 4;
+            state = CHECKSUM_LOW;
+            return false;
+        }
+
+        case CHECKSUM_LOW: {
+            int value = hexValue(c);
+            state = WAIT_START;
+            if (value < 0) {
+                malformed++;
+                return false;
+            }
+            if ((expected | value) != checksum) {
+                checksumErrors++;
+                return false;
+            }
+            return commit();
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    // Function to get the last fix; fix().valid is false until there has been one
+    const GpsFix& fix() const {
+        return current;
+    }
+};
@@ -0,0 +1,133 @@
+// Conversion kernel from I2S microphone slots to the 16-bit samples the rest
+// of the firmware uses.
+//
+// The slot type, the number of data bits in each slot, and the channel
+// layout are template parameters. The shifts and strides are therefore
+// constants, and the compiler unrolls a loop specialised for each mic
+// format. Per sample:
+//  - The data bits are taken from the left-justified slot at full precision.
+//  - A one-pole fixed-point high-pass (a DC blocker) removes the mic's DC
+//    offset.
+//  - A Q8 gain is applied, rounded and saturated to 16 bits. Truncating
+//    instead (the old >> 16) adds a bias and throws away the low bits.
+// An optional AGC adjusts the gain once per block.
+//
+// Header-only so the host microbenchmark (bench/convert_bench.cpp) runs
+// exactly the kernel the capture task runs.
+#pragma once
+
+#include <Arduino.h>
+
+#define CONVERT_GAIN_BITS 8 // gain is fixed point with this many fractional bits
+#define CONVERT_DC_POLE_BITS 8 // high-pass pole at 1 - 2^-8: about 10 Hz at 16 kHz
+#define CONVERT_AGC_TARGET 16384 // AGC aims for block peaks at half of full scale
+#define CONVERT_AGC_FLOOR 64 // block peaks below this at unity gain (about -54 dBFS) are background; the AGC ignores them
+#define CONVERT_AGC_RELEASE_BITS 4 // the gain rises 1/16 of the way to its target per block
+
+template <typename Slot, int DataBits, int Channels = 1, int Channel = 0>
+class SampleConverter {
+    static_assert(DataBits >= 16 && DataBits <= (int)sizeof(Slot) * 8, "slot too small for the data bits");
+    static_assert(Channel < Channels, "channel out of range");
+
+    static const int SlotShift = sizeof(Slot) * 8 - DataBits; // data is left-justified in the slot
+    static const int OutputShift = DataBits - 16 + CONVERT_GAIN_BITS;
+
+private:
+    int32_t previousInput; // DC blocker state, at DataBits precision
+    int32_t previousOutput;
+    int32_t gain; // Q8
+    int32_t maxGain; // Q8; 0 disables the AGC
+
+    // Function to convert one slot: high-pass, gain, round and saturate
+    inline int16_t convertSample(Slot slot, int32_t& peak) {
+        int32_t input = (int32_t)slot >> SlotShift;
+        int32_t output = input - previousInput + previousOutput -
+                         ((previousOutput + (1 << (CONVERT_DC_POLE_BITS - 1))) >> CONVERT_DC_POLE_BITS);
+        previousInput = input;
+        previousOutput = output;
+
+        int32_t magnitude = output < 0 ? -output : output;
+        if (magnitude > peak) {
+            peak = magnitude;
+        }
+
+        int64_t scaled = ((int64_t)output * gain + ((int64_t)1 << (OutputShift - 1))) >> OutputShift;
+        if (scaled > 32767) {
+            return 32767;
+        }
+        if (scaled < -32768) {
+            return -32768;
+        }
+        return (int16_t)scaled;
+    }
+
+    // Function to move the gain towards CONVERT_AGC_TARGET given the block's peak before gain
+    void adjustGain(int32_t peak) {
+        int32_t unityPeak = peak >> (DataBits - 16); // the peak at 16 bits and unity gain
+        if (unityPeak < CONVERT_AGC_FLOOR) {
+            return; // Silence: keep the gain, so background noise is not pumped up
+        }
+        int32_t target = (int32_t)(((int64_t)CONVERT_AGC_TARGET << CONVERT_GAIN_BITS) / unityPeak);
+        if (target > maxGain) {
+            target = maxGain;
+        } else if (target < (1 << CONVERT_GAIN_BITS)) {
+            target = 1 << CONVERT_GAIN_BITS;
+        }
+        if (target < gain) {
+            gain = target; // Back off at once so the next block does not clip
+        } else {
+            gain += (target - gain) >> CONVERT_AGC_RELEASE_BITS;
+        }
+    }
+
+public:
+    SampleConverter() : gain(1 << CONVERT_GAIN_BITS), maxGain(0) {
+        reset();
+    }
+
+    // Function to start a new recording; the gain is kept
+    void reset() {
+        previousInput = 0;
+        previousOutput = 0;
+    }
+
+    // Function to set a fixed gain, or with maximum > 0, the AGC's starting gain and its limit
+    void setGain(float fixed, float maximum = 0) {
+        gain = (int32_t)(fixed * (1 << CONVERT_GAIN_BITS));
+        maxGain = (int32_t)(maximum * (1 << CONVERT_GAIN_BITS));
+    }
+
+    // Function to return the current gain
+    float currentGain() {
+        return (float)gain / (1 << CONVERT_GAIN_BITS);
+    }
+
+    // Function to convert a block of slots (count is in slots, all channels
+    // included) to 16-bit samples of the chosen channel; returns how many were written
+    size_t convert(const Slot* input, size_t count, int16_t* output) {
+        size_t frames = count / Channels;
+        const Slot* frame = input + Channel;
+        int16_t* sample = output;
+        int32_t peak = 0;
+        size_t remaining = frames;
+        for (; remaining >= 4; remaining -= 4) {
+            sample[0] = convertSample(frame[0], peak);
+            sample[1] = convertSample(frame[Channels], peak);
+            sample[2] = convertSample(frame[2 * Channels], peak);
+            sample[3] = convertSample(frame[3 * Channels], peak);
+            frame += 4 * Channels;
+            sample += 4;
+        }
+        for (; remaining > 0; remaining--) {
+            *sample++ = convertSample(*frame, peak);
+            frame += Channels;
+        }
+        if (maxGain > 0) {
+            adjustGain(peak);
+        }
+        return frames;
+    }
+};
+
+// The INMP441: 24 data bits, left-justified in 32-bit slots, one channel selected by the driver
+typedef SampleConverter<int32_t, 24> Inmp441Converter;
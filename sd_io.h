@@ -0,0 +1,215 @@
+// Block SD I/O: reading, writing and copying files a block at a time.
+//
+// Every File call goes through the VFS and FAT layers (and on the SD card,
+// an SPI transaction), so a loop that moves one byte per read() or write()
+// pays that cost per byte. These primitives move SD_IO_BLOCK bytes per call,
+// the FAT sector size, and size their buffers from file.size() up front, so
+// nothing is reallocated while a file is read. Appends are split so that
+// every write after the first ends on a sector boundary of the destination.
+//
+// Header-only so the host microbenchmark (bench/sd_io_bench.cpp) can use
+// exactly the code the firmware runs.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define SD_IO_BLOCK 512 // FAT sector size
+
+// Reads a file through a block buffer; read() and peek() are served from
+// RAM, so parsers that want one byte at a time do not go to the card per byte
+class SDBlockReader : public Stream {
+private:
+    File file;
+    uint8_t block[SD_IO_BLOCK];
+    size_t blockLength;
+    size_t blockPosition;
+
+    // Function to refill the block; false at end of file
+    bool fill() {
+        if (blockPosition < blockLength) {
+            return true;
+        }
+        blockLength = file ? file.read(block, sizeof(block)) : 0;
+        blockPosition = 0;
+        return blockLength > 0;
+    }
+
+public:
+    SDBlockReader(fs::FS& fs, const char* path) : blockLength(0), blockPosition(0) {
+        file = fs.open(path);
+        setTimeout(0); // A file has no more data coming, so never wait for it
+    }
+
+    ~SDBlockReader() {
+        if (file) {
+            file.close();
+        }
+    }
+
+    bool isOpen() {
+        return (bool)file;
+    }
+
+    size_t size() {
+        return file ? file.size() : 0;
+    }
+
+    int available() override {
+        return (blockLength - blockPosition) + (file ? file.available() : 0);
+    }
+
+    int read() override {
+        return fill() ? block[blockPosition++] : -1;
+    }
+
+    int peek() override {
+        return fill() ? block[blockPosition] : -1;
+    }
+
+    // Function to read up to length bytes; returns how many were read
+    size_t read(uint8_t* buffer, size_t length) {
+        size_t copied = 0;
+        while (copied < length && fill()) {
+            size_t count = blockLength - blockPosition;
+            if (count > length - copied) {
+                count = length - copied;
+            }
+            memcpy(buffer + copied, block + blockPosition, count);
+            blockPosition += count;
+            copied += count;
+        }
+        return copied;
+    }
+
+    size_t readBytes(char* buffer, size_t length) override {
+        return read((uint8_t*)buffer, length);
+    }
+
+    size_t write(uint8_t c) override { return 0; }
+    void flush() override {}
+};
+
+// Function to read a whole file into text, sized from file.size(); false if it cannot be opened
+inline bool sdReadText(fs::FS& fs, const char* path, String& text) {
+    File file = fs.open(path);
+    if (!file) {
+        return false;
+    }
+
+    size_t size = file.size();
+    text = "";
+    if (!text.reserve(size)) {
+        file.close();
+        return false;
+    }
+
+    char block[SD_IO_BLOCK + 1];
+    size_t length;
+    while ((length = file.read((uint8_t*)block, SD_IO_BLOCK)) > 0) {
+        block[length] = '\0';
+        text += block;
+    }
+    file.close();
+    return true;
+}
+
+// Function to read a file into buffer, NUL-terminated, truncating it to fit;
+// returns its length, or -1 if it cannot be opened
+inline int sdReadInto(fs::FS& fs, const char* path, char* buffer, size_t capacity) {
+    File file = fs.open(path);
+    if (!file || capacity == 0) {
+        return -1;
+    }
+    size_t length = 0;
+    size_t count;
+    while (length < capacity - 1 &&
+           (count = file.read((uint8_t*)buffer + length, capacity - 1 - length)) > 0) {
+        length += count;
+    }
+    buffer[length] = '\0';
+    file.close();
+    return length;
+}
+
+// Function to write data to an open file in sector-aligned blocks; returns bytes written
+inline size_t sdWriteBlocks(File& file, const uint8_t* data, size_t length) {
+    size_t written = 0;
+    // The first write tops up the destination's partial sector
+    size_t block = SD_IO_BLOCK - (file.position() % SD_IO_BLOCK);
+    while (written < length) {
+        if (block > length - written) {
+            block = length - written;
+        }
+        size_t count = file.write(data + written, block);
+        written += count;
+        if (count < block) {
+            break; // Card full or removed
+        }
+        block = SD_IO_BLOCK;
+    }
+    return written;
+}
+
+// Function to write (or append) length bytes to a file; false unless all of them were written
+inline bool sdWrite(fs::FS& fs, const char* path, const uint8_t* data, size_t length, bool append = false) {
+    File file = fs.open(path, append ? FILE_APPEND : FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    size_t written = sdWriteBlocks(file, data, length);
+    file.close();
+    return written == length;
+}
+
+inline bool sdWrite(fs::FS& fs, const char* path, const String& text, bool append = false) {
+    return sdWrite(fs, path, (const uint8_t*)text.c_str(), text.length(), append);
+}
+
+// Function to copy a file to output a block at a time, stopping early if
+// output stops accepting data; returns bytes copied, or -1 if the file cannot be opened
+inline long sdCopyToStream(fs::FS& fs, const char* path, Print& output) {
+    File file = fs.open(path);
+    if (!file) {
+        return -1;
+    }
+    uint8_t block[SD_IO_BLOCK];
+    long copied = 0;
+    size_t length;
+    while ((length = file.read(block, sizeof(block))) > 0) {
+        size_t count = output.write(block, length);
+        copied += count;
+        if (count < length) {
+            break;
+        }
+    }
+    file.close();
+    return copied;
+}
+
+// Function to copy (or append) one file to another in sector-aligned blocks;
+// false if either cannot be opened or the copy is cut short
+inline bool sdCopyFile(fs::FS& fs, const char* from, const char* to, bool append = false) {
+    File source = fs.open(from);
+    if (!source) {
+        return false;
+    }
+    File destination = fs.open(to, append ? FILE_APPEND : FILE_WRITE);
+    if (!destination) {
+        source.close();
+        return false;
+    }
+
+    uint8_t block[SD_IO_BLOCK];
+    bool complete = true;
+    size_t length;
+    while ((length = source.read(block, sizeof(block))) > 0) {
+        if (sdWriteBlocks(destination, block, length) != length) {
+            complete = false;
+            break;
+        }
+    }
+    source.close();
+    destination.close();
+    return complete;
+}
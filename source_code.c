@@ -8,19 +8,29 @@
 #include <SD_MMC.h>
 #include <FFat.h>
 #include <SPIFFS.h>
+#include <FSImpl.h>
 #include <Audio.h>
 #include <HardwareSerial.h>
+#include <freertos/ringbuf.h>
+#include "sd_io.h"
+#include "capture_ring.h"
+#include "ima_adpcm.h"
+#include "voice_activity.h"
+#include "sample_convert.h"
+#include "nmea_parser.h"
 
 // WiFi credentials
 const char* ssid = "SSID"; // To replicate our project, enter your WiFi SSID
 const char* password = "SSID_KEY"; // To replicate our project, enter the specific WiFi SSID's corresponding password
+const char* ntp_server = "pool.ntp.org"; // Sets the clock that dates cached place names
 
 // OpenAI Speech-to-Text API URL and key
 const char* stt_api_url = "https://api.openai.com/v1/audio/transcriptions"; //STT API URL
-const char* stt_api_key = "STT_API_KEY" // OpenAI STT API key
+const char* stt_api_key = "STT_API_KEY"; // OpenAI STT API key
 
 // Gemini API endpoint URL
 const char* gemini_url = "https://generativelanguage.googleapis.com/v1/models/gemini-pro:generateContent"; // Gemini API URL 
+const char* gemini_stream_url = "https://generativelanguage.googleapis.com/v1/models/gemini-pro:streamGenerateContent"; // Streamed replies
 const char* gemini_api_key = "GEMINI_API_KEY"; //Gemini API key
 
 // Text-to-Speech API URL and key
@@ -36,71 +46,38 @@ const char* fullstoryTTS = "/base_story_TTS.txt"; // base prompt for announcemen
 const char* base_story = "/base_story.txt"; // master base prompt
 const char* storySoFar = "/storySoFar.txt"; // story context
 
-// Files to store player ratings
-
-const char* p1_rating = "/p1_rating.txt";
-const char* p2_rating = "/p2_rating.txt";
-const char* p3_rating = "/p3_rating.txt";
-const char* p4_rating = "/p4_rating.txt";
-
-// Files to store player speech
-const char* p1_response1="/p1_response1.wav";
-const char* p1_response2="/p1_response2.wav";
-
-const char* p2_response1="/p2_response1.wav";
-const char* p2_response2="/p2_response2.wav";
-
-const char* p3_response1="/p3_response1.wav";
-const char* p3_response2="/p3_response2.wav";
-
-const char* p4_response1="/p4_response1.wav";
-const char* p4_response2="/p4_response2.wav";
-
-// Files to store player speech transcript
-const char* p1_trans1="/p1_trans1.txt";
-const char* p1_trans2="/p1_trans2.txt";
-
-const char* p2_trans1="/p2_trans1.txt";
-const char* p2_trans2="/p2_trans2.txt";
-
-const char* p3_trans1="/p3_trans1.txt";
-const char* p3_trans2="/p3_trans2.txt";
-
-const char* p4_trans1="/p4_trans1.txt";
-const char* p4_trans2="/p4_trans2.txt";
-
-// Files to store player's speech evaluation text
-const char* p1_eval1="/p1_eval1.txt";
-const char* p1_eval2="/p1_eval2.txt";
-
-const char* p2_eval1="/p2_eval1.txt";
-const char* p2_eval2="/p2_eval2.txt";
-
-const char* p3_eval1="/p3_eval1.txt";
-const char* p3_eval2="/p3_eval2.txt";
-
-const char* p4_eval1="/p4_eval1.txt";
-const char* p4_eval2="/p4_eval2.txt";
-
-// Files to store player feedback speech
-const char* p1_feed1="/p1_feed1.mp3";
-const char* p1_feed2="/p1_feed2.mp3";
-
-const char* p2_feed1="/p2_feed1.mp3";
-const char* p2_feed2="/p2_feed2.mp3";
+// Game size: each of PLAYER_COUNT players (2-8) speaks once per round
+#ifndef PLAYER_COUNT
+#define PLAYER_COUNT 4
+#endif
+#ifndef ROUND_COUNT
+#define ROUND_COUNT 2
+#endif
+#define MAX_PLAYERS 8
+#define MAX_ROUNDS 4
+static_assert(PLAYER_COUNT >= 2 && PLAYER_COUNT <= MAX_PLAYERS, "PLAYER_COUNT must be 2-8");
+static_assert(ROUND_COUNT >= 1 && ROUND_COUNT <= MAX_ROUNDS, "ROUND_COUNT must be 1-4");
+
+// Files kept for each turn, named after the player and round (e.g. /p3_trans2.txt)
+struct TurnFiles {
+    char response[20];   // player speech
+    char transcript[20]; // player speech transcript
+    char evaluation[20]; // player's speech evaluation text
+    char feedback[20];   // player feedback speech
+};
 
-const char* p3_feed1="/p3_feed1.mp3";
-const char* p3_feed2="/p3_feed2.mp3";
+TurnFiles turnFiles[MAX_PLAYERS][MAX_ROUNDS];
 
-const char* p4_feed1="/p4_feed1.mp3";
-const char* p4_feed2="/p4_feed2.mp3";
+// Files to store player ratings (e.g. /p3_rating.txt)
+char ratingFiles[MAX_PLAYERS][20];
 
 // Transcript and audio file announcing the winner
 const char *winner_feedback = "/winner_feedback.txt";
 const char *winner_feedback_speech = "/winner_feedback_speech.mp3";
 
-// Initialize the HTTP client to send requests to the Gemini API
-HTTPClient http_client;
+// Audio file of the story prompt announced at the start
+const char* first_prompt = "/first_prompt.mp3";
+
 WiFiServer wifi_server(80);
 
 // I2S Speaker Connections
@@ -114,6 +91,24 @@ WiFiServer wifi_server(80);
 // In-audio loop pause
 #define IN_AUDIO_PAUSE 2
 
+// Recorded speech format: 16 kHz, 16-bit mono PCM
+#define MIC_SAMPLE_RATE 16000
+#define MIC_BYTES_PER_SAMPLE 2
+// Gain applied to the microphone; with MIC_AGC it adapts between MIC_GAIN and MIC_MAX_GAIN
+#define MIC_GAIN 1.0
+#define MIC_AGC 0
+#define MIC_MAX_GAIN 8.0
+
+// Stream each recording to the STT API while the player is still speaking
+#define STREAM_STT_UPLOAD 1
+// Compress recordings about 4:1 as IMA-ADPCM WAV before they are uploaded
+#define STT_UPLOAD_ADPCM 1
+// Keep the SD copy of a recording once it has been streamed; the copy is always
+// written while recording, since a failed or overrun stream is retried from it
+#define KEEP_RECORDINGS_ON_SD 1
+// Summarise the oldest turns of the story in the background once it outgrows its budget
+#define STORY_SUMMARY 1
+
 // Define SD card pins
 const int SD_CS = 13;
 const int SPI_MOSI = 23;
@@ -142,6 +137,7 @@ bool connectToWiFi() {
     
     if (WiFi.status() == WL_CONNECTED) {
         Serial.println("\nConnected to WiFi!");
+        configTime(0, 0, ntp_server); // Set the clock in the background
         Serial.print("IP Address: ");
         Serial.println(WiFi.localIP());
         return true;
@@ -163,554 +159,2509 @@ bool initSDCard() {
     return true;
 }
 
-// Function to read the text file from SD card
-String readTextFromSD(const char* filename) {
-  File file = SD.open(filename);
-  if (!file) {
-    Serial.println("Error opening file from SD card.");
-    return "";
-  }
-  
-  String text = "";
-  while (file.available()) {
-    text += (char)file.read();
-  }
-  file.close();
-  return text;
-}
+//------------------------------------------------------------------------
 
-// Function to write response to SD card
-bool writeResponseToSD(const String& response, const char* filename) {
-  
-  File file = SD.open(filename, FILE_WRITE);
-  if (!file) {
-    Serial.println("Failed to open file for writing");
-    return false;
-  }
+// Latency tracing: every stage of a game records a span (task, start,
+// duration, bytes sent and received) into a fixed ring in RAM, cheap enough
+// to leave on in the field. At game end the ring is written to SD as Chrome
+// trace JSON (/trace_N.json), viewable in ui.perfetto.dev or chrome://tracing
+// with one track per task.
+
+#define TRACE_ENABLED 1
+#define TRACE_CAPACITY 256 // spans kept per game; the oldest are overwritten
+#define TRACE_TRACKS 8 // distinct tasks shown as separate tracks
+
+struct TraceEvent {
+    const char* name;   // stage, a string literal
+    const char* detail; // file or host the stage worked on (static), or NULL
+    uint32_t start;     // ms since boot
+    uint32_t duration;  // ms
+    uint32_t bytesOut;
+    uint32_t bytesIn;
+    uint8_t track;
+};
 
-  // Write the response
-  size_t bytesWritten = file.print(response);
-  file.close();
-  
-  if (bytesWritten == 0) {
-    Serial.println("Failed to write to file");
-    return false;
-  }
-  
-  Serial.println("Response successfully written to " + String(filename));
-  return true;
-  }
+TraceEvent traceRing[TRACE_CAPACITY];
+uint32_t traceCount = 0; // spans recorded this game, including overwritten ones
+char traceTracks[TRACE_TRACKS][16]; // task name of each track
+int traceTrackCount = 0;
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Function to record a finished span for the calling task
+void traceRecord(const char* name, const char* detail, uint32_t start, uint32_t bytesOut = 0, uint32_t bytesIn = 0) {
+#if TRACE_ENABLED
+    uint32_t end = millis();
+    const char* task = pcTaskGetTaskName(NULL);
+
+    portENTER_CRITICAL(&traceMux);
+    int track = 0;
+    while (track < traceTrackCount && strncmp(traceTracks[track], task, 15) != 0) {
+        track++;
+    }
+    if (track == traceTrackCount) {
+        if (traceTrackCount < TRACE_TRACKS) {
+            strncpy(traceTracks[track], task, 15);
+            traceTracks[track][15] = '\0';
+            traceTrackCount++;
+        } else {
+            track = TRACE_TRACKS - 1; // Out of tracks: share the last one
+        }
+    }
 
-// Function to store Gemini's response to text file
-void processResponse(String evaluation, const char *outputFile) {
-  Serial.println(evaluation);
-  
-  // Write the evaluation to a file on the SD card
-  if (writeResponseToSD(evaluation, outputFile)) {
-    Serial.println("Evaluation saved to SD card: " + String(outputFile));
-  } else {
-    Serial.println("Failed to save evaluation to SD card");
-  }
+    TraceEvent& event = traceRing[traceCount % TRACE_CAPACITY];
+    event.name = name;
+    event.detail = detail;
+    event.start = start;
+    event.duration = end - start;
+    event.bytesOut = bytesOut;
+    event.bytesIn = bytesIn;
+    event.track = track;
+    traceCount++;
+    portEXIT_CRITICAL(&traceMux);
+#endif
 }
 
-// Invokes Gemini API to evaluate the first contribution
-String evaluateFContribution(const char* base_prompt, const char* player_contribution, const char* evaluation) {
+// Records a span covering its own lifetime, for stages with several exits
+class TraceScope {
+private:
+    const char* name;
+    const char* detail;
+    uint32_t start;
+    uint32_t bytesOut;
+    uint32_t bytesIn;
 
-  // Read the base prompt generated by Gemini
-  String baseprompt = readTextFromSD(base_prompt);
-  
-  // Read the story started by the first player
-  String playerStory = readTextFromSD(player_contribution);
+public:
+    TraceScope(const char* _name, const char* _detail = NULL)
+        : name(_name), detail(_detail), start(millis()), bytesOut(0), bytesIn(0) {}
 
-  // Construct the complete URL with API key
-  String url = String(gemini_url) + "?key=" + String(gemini_api_key);
-  
-  Serial.println("Connecting to Gemini API...");
-  Serial.println("URL: " + url);
-  
-  if (!http_client.begin(url)) {
-    Serial.println("Connection to API failed!");
-    http_client.end();
-    return "";
-  }
+    ~TraceScope() {
+        traceRecord(name, detail, start, bytesOut, bytesIn);
+    }
+
+    void addBytes(uint32_t sent, uint32_t received) {
+        bytesOut += sent;
+        bytesIn += received;
+    }
+};
 
-  // Set the request headers
-  http_client.addHeader("Content-Type", "application/json");
+// Function to wait between stages, so the pauses show up in the trace
+void pauseBetweenStages(uint32_t ms) {
+    uint32_t start = millis();
+    delay(ms);
+    traceRecord("pause", NULL, start);
+}
 
-  // Create a JSON document for the request
-  JsonDocument requestDoc;
-  
-    // Build the JSON structure
-requestDoc["contents"][0]["parts"][0]["text"] = 
-    String("We are hosting a collaborative storytelling contest for children. It consists of four players. A base story prompt is given. ") +
-    "Players take turns to speak for thirty seconds each. For the sake of fairness, each player has to ensure that they leave sufficient room for others to continue the story from where they stop. " +
-    "You have to assess the players on the basis of how well they speak, their articulation, contribution to the plot, usage of filler words, creativity, imagination, the story snippet they contributed, and whether they left sufficient room for others to continue the story from where they stopped. " +
-    "This is the base prompt we gave to the players (generated by the host): \"" + baseprompt + "\"; " +
-    "This is the first contribution to the base story by the first player of the game (we transcribed his/her speech): \"" + playerStory + "\"; Assess the player's contribution to the story on the basis " +
-    "of the aforesaid factors (along with the fact whether he/she did a decent start to the story or not) and provide a short constructive feedback in text that can be spoken in approximately thirty seconds. " +
-    "At the end of your feedback, provide a rating out of ten (say specifically \"I rate your contribution <rating> out of 10\"). Write everything in a single paragraph. No special characters. "+
-    "If the player's contribution to the story, which I provided in the form of the transcription of his/her speech, does not seem sufficient to utilise thirty seconds of speaking time (indicating he/she spoke less), then penalise them for that. ";
-
-
-  // Serialize the request
-  String requestBody;
-  serializeJson(requestDoc, requestBody);
-
-  // Debug print the request body
-  Serial.println("Sending request with body:");
-  Serial.println(requestBody);
-
-  // Send the request
-  int httpCode = http_client.POST(requestBody);
-
-  // Debug print the response code
-  Serial.print("HTTP Response code: ");
-  Serial.println(httpCode);
-
-  if (httpCode != 200) {
-    String error = http_client.getString();
-    Serial.println("Error response:");
-    Serial.println(error);
-    http_client.end();
-    return "Error: HTTP " + String(httpCode) + " - " + error;
-  }
+// Function to write this game's spans to SD as Chrome trace JSON and start afresh
+bool writeTraceToSD() {
+#if TRACE_ENABLED
+    // Keep the traces of earlier games
+    char path[24];
+    int traceNumber = 1;
+    do {
+        snprintf(path, sizeof(path), "/trace_%d.json", traceNumber++);
+    } while (SD.exists(path));
+
+    File file = SD.open(path, FILE_WRITE);
+    if (!file) {
+        Serial.println("Failed to create trace file!");
+        return false;
+    }
 
-  // Get the response
-  String response = http_client.getString();
-  Serial.println("Raw response:");
-  Serial.println(response);
-  
-  // Parse the response
-  JsonDocument responseDoc;
-  DeserializationError error = deserializeJson(responseDoc, response);
-  
-  if (error) {
-    Serial.print("JSON parsing failed: ");
-    Serial.println(error.c_str());
-    http_client.end();
-    return "Error: JSON parsing failed - " + String(error.c_str());
-  }
+    // The game is over, so nothing else is recording while the ring is read
+    uint32_t count = traceCount;
+    uint32_t first = count > TRACE_CAPACITY ? count - TRACE_CAPACITY : 0;
 
-  // Extract the feedback text
-  String feedback;
-  if (responseDoc["candidates"][0]["content"]["parts"][0]["text"].is<const char*>()) {
-    feedback = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
-  } else {
-    Serial.println("Unexpected response format");
-    Serial.println(response);
-    feedback = "Error: Unable to parse response - unexpected format";
-  }
+    char line[256];
+    file.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int track = 0; track < traceTrackCount; track++) {
+        snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                 track, traceTracks[track]);
+        file.print(line);
+    }
+    for (uint32_t i = first; i < count; i++) {
+        const TraceEvent& event = traceRing[i % TRACE_CAPACITY];
+        // Timestamps are in microseconds; appending "000" to the ms value
+        // avoids 64-bit printf, but a bare 0 must stay 0 to be valid JSON
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lu%s,\"dur\":%lu%s,"
+                 "\"args\":{\"detail\":\"%s\",\"bytes_out\":%lu,\"bytes_in\":%lu}}%s\n",
+                 event.name, event.track,
+                 (unsigned long)event.start, event.start ? "000" : "",
+                 (unsigned long)event.duration, event.duration ? "000" : "",
+                 event.detail ? event.detail : "", (unsigned long)event.bytesOut, (unsigned long)event.bytesIn,
+                 i + 1 < count ? "," : "");
+        file.print(line);
+    }
+    file.print("]}\n");
+    file.close();
 
-  Serial.println("Feedback: " + feedback);
-  
-  // Write the feedback to a file on the SD card
-  if (writeResponseToSD(feedback, evaluation)) {
-    Serial.println("Evaluation saved to SD card: " + String(evaluation));
-  } else {
-    Serial.println("Failed to save evaluation to SD card");
-  }
+    Serial.printf("Trace of %lu spans written to %s (%lu overwritten)\n",
+                  (unsigned long)(count - first), path, (unsigned long)first);
 
-  http_client.end();
-  return evaluation;
+    portENTER_CRITICAL(&traceMux);
+    traceCount = 0;
+    portEXIT_CRITICAL(&traceMux);
+#endif
+    return true;
 }
 
-// Invokes Gemini API to evaluate intermediary contributions
-String evaluateContribution(const char* base_prompt, const char* story_path, const char* player_contribution, const char* evaluation) {
+//------------------------------------------------------------------------
 
-  // Read the base prompt generated by Gemini
-  String baseprompt = readTextFromSD(base_prompt);
+// Connection pool: each API host keeps its TLS connection open between
+// requests (HTTP keep-alive), so only the first request to a host pays for
+// the DNS lookup and the 1-3 s handshake. A connection is lent to one task at
+// a time; a task asking for a host whose connections are all busy waits until
+// one is released.
+
+// API hosts the game talks to
+enum ApiHost {
+    OPENAI_API,
+    GEMINI_API,
+    MAPS_API,
+    API_HOST_COUNT
+};
 
-  // Read the story that has been contributed so far
-  String storySoFar = readTextFromSD(story_path);
-  
-  // Read the story continued by the player
-  String playerStory = readTextFromSD(player_contribution);
+const char* api_hosts[API_HOST_COUNT] = {
+    "api.openai.com",
+    "generativelanguage.googleapis.com",
+    "maps.googleapis.com"
+};
 
-  // Construct the complete URL with API key
-  String url = String(gemini_url) + "?key=" + String(gemini_api_key);
-  
-  Serial.println("Connecting to Gemini API...");
-  Serial.println("URL: " + url);
-  
-  if (!http_client.begin(url)) {
-    Serial.println("Connection to API failed!");
-    http_client.end(); // Frees resources before returning
-    return "";
-  }
+#define POOL_IDLE_TIMEOUT 120000 // ms; reconnect rather than trust a connection idle this long
+#define TTS_PARALLEL_REQUESTS 2 // speech chunks synthesised at once; each holds a TLS connection (~40 KB)
 
-  // Set the request headers
-  http_client.addHeader("Content-Type", "application/json");
+#if STORY_SUMMARY
+#define GEMINI_CONNECTIONS 2 // the story summary must not hold up an evaluation
+#else
+#define GEMINI_CONNECTIONS 1
+#endif
 
-  // Create a JSON document for the request
-  JsonDocument requestDoc;
-  
-    // Build the JSON structure
-requestDoc["contents"][0]["parts"][0]["text"] = 
-    String("We are hosting a collaborative storytelling contest for children. It consists of four players. A base story prompt is given. ") +
-    "Players take turns to speak for thirty seconds. For the sake of fairness, each player has to ensure that they leave sufficient room for others to continue the story from where they stop. " +
-    "You have to assess the players on the basis of how well they speak, their articulation, contribution to the plot, usage of filler words, creativity, imagination, the story snippet they contributed, and whether they left sufficient room for others to continue the story from where they stopped. " +
-    "This is the base prompt we gave to the players (generated by the host): \"" + baseprompt + "\"; This is the collaborative story that has been stitched so far: \"" + storySoFar + "\"; " +
-    "And this is the current player's contribution to the story: \"" + playerStory + "\"; Assess the current player's contribution to the story on the basis " +
-    "of the aforesaid factors and provide a short constructive feedback in text that can be spoken in approximately thirty seconds. " +
-    "At the end of your feedback, provide a rating out of ten (say specifically \"I rate your contribution <rating> out of 10\"). Write everything in a single paragraph. "+
-    "If the player's contribution to the story, which I provided in the form of the transcription of his/her speech, does not seem sufficient to utilise thirty seconds of speaking time (indicating he/she spoke less), then penalise them for that. ";
-;
-
-
-  // Serialize the request
-  String requestBody;
-  serializeJson(requestDoc, requestBody);
-
-  // Debug print the request body
-  Serial.println("Sending request with body:");
-  Serial.println(requestBody);
-
-  // Send the request
-  int httpCode = http_client.POST(requestBody);
-
-  // Debug print the response code
-  Serial.print("HTTP Response code: ");
-  Serial.println(httpCode);
-
-  if (httpCode != 200) {
-    String error = http_client.getString();
-    Serial.println("Error response:");
-    Serial.println(error);
-    http_client.end();
-    return "Error: HTTP " + String(httpCode) + " - " + error;
-  }
+// Connections kept open per host: speech synthesis runs requests in
+// parallel, everything else talks to its host one request at a time
+const int api_host_connections[API_HOST_COUNT] = {TTS_PARALLEL_REQUESTS, GEMINI_CONNECTIONS, 1};
+#define POOL_SIZE (TTS_PARALLEL_REQUESTS + GEMINI_CONNECTIONS + 1)
 
-  // Get the response
-  String response = http_client.getString();
-  Serial.println("Raw response:");
-  Serial.println(response);
-  
-  // Parse the response
-  JsonDocument responseDoc;
-  DeserializationError error = deserializeJson(responseDoc, response);
-  
-  if (error) {
-    Serial.print("JSON parsing failed: ");
-    Serial.println(error.c_str());
-    http_client.end();
-    return "Error: JSON parsing failed - " + String(error.c_str());
-  }
+// A kept-alive connection; the HTTPClient lives alongside it because
+// destroying an HTTPClient closes the socket it was using
+struct PooledConnection {
+    WiFiClientSecure client;
+    HTTPClient http;
+    ApiHost host;
+    bool inUse;
+    uint32_t lastUsed;
+};
 
-  // Extract the feedback text
-  String feedback;
-  if (responseDoc["candidates"][0]["content"]["parts"][0]["text"].is<const char*>()) {
-    feedback = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
-  } else {
-    Serial.println("Unexpected response format");
-    Serial.println(response);
-    feedback = "Error: Unable to parse response - unexpected format";
-  }
+PooledConnection connectionPool[POOL_SIZE];
+SemaphoreHandle_t poolSlots[API_HOST_COUNT]; // counts a host's free connections
+SemaphoreHandle_t poolLock = NULL; // guards lending and closing connections
+uint32_t tlsHandshakes = 0;
+uint32_t tlsReuses = 0;
+
+// Function to set up the pool and resolve every API host ahead of time
+bool initConnectionPool() {
+    poolLock = xSemaphoreCreateMutex();
+    if (poolLock == NULL) {
+        Serial.println("Failed to create connection pool!");
+        return false;
+    }
 
-  Serial.println("Feedback: " + feedback);
-  
-  // Write the feedback to a file on the SD card
-  if (writeResponseToSD(feedback, evaluation)) {
-    Serial.println("Evaluation saved to SD card: " + String(evaluation));
-  } else {
-    Serial.println("Failed to save evaluation to SD card");
-  }
+    int slot = 0;
+    for (int i = 0; i < API_HOST_COUNT; i++) {
+        for (int j = 0; j < api_host_connections[i]; j++, slot++) {
+            connectionPool[slot].host = (ApiHost)i;
+            connectionPool[slot].inUse = false;
+            connectionPool[slot].lastUsed = 0;
+            connectionPool[slot].http.setReuse(true);
+        }
+        poolSlots[i] = xSemaphoreCreateCounting(api_host_connections[i], api_host_connections[i]);
+        if (poolSlots[i] == NULL) {
+            Serial.println("Failed to create connection pool!");
+            return false;
+        }
 
-  http_client.end();
-  return evaluation;
+        // Warm the DNS cache so the first request skips the lookup
+        IPAddress address;
+        if (WiFi.hostByName(api_hosts[i], address)) {
+            Serial.printf("Resolved %s to %s\n", api_hosts[i], address.toString().c_str());
+        } else {
+            Serial.printf("Failed to resolve %s\n", api_hosts[i]);
+        }
+    }
+    return true;
 }
 
-// Invokes Gemini API to evaluate intermediary contributions
-String evaluateLContribution(const char* base_prompt, const char* story_path, const char* player_contribution, const char* evaluation) {
+// Function to close connections that have sat idle long enough for the server to drop them
+void closeIdleConnections() {
+    xSemaphoreTake(poolLock, portMAX_DELAY);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        PooledConnection& connection = connectionPool[i];
+        if (!connection.inUse && connection.client.connected() &&
+            millis() - connection.lastUsed > POOL_IDLE_TIMEOUT) {
+            connection.client.stop(); // Also frees the TLS buffers
+        }
+    }
+    xSemaphoreGive(poolLock);
+}
 
-  // Read the base prompt generated by Gemini
-  String baseprompt = readTextFromSD(base_prompt);
+// Function to make sure a client is connected to host, keeping the open
+// connection if it has not been idle long enough to have been dropped
+bool connectKeepAlive(WiFiClientSecure* client, const char* host, uint32_t lastUsed) {
+    if (client->connected()) {
+        if (millis() - lastUsed <= POOL_IDLE_TIMEOUT) {
+            tlsReuses++;
+            return true;
+        }
+        client->stop();
+    }
 
-  // Read the story that has been contributed so far
-  String storySoFar = readTextFromSD(story_path);
-  
-  // Read the story continued by the player
-  String playerStory = readTextFromSD(player_contribution);
+    TraceScope trace("tls connect", host);
+    uint32_t startTime = millis();
+    client->setInsecure(); // Skip certificate verification
+    client->setTimeout(30);  // Timeout specified in seconds
+    if (!client->connect(host, 443)) {
+        Serial.printf("Connection to %s failed!\n", host);
+        return false;
+    }
+    tlsHandshakes++;
+    Serial.printf("Connected to %s in %lu ms\n", host, (unsigned long)(millis() - startTime));
+    return true;
+}
 
-  // Construct the complete URL with API key
-  String url = String(gemini_url) + "?key=" + String(gemini_api_key);
-  
-  Serial.println("Connecting to Gemini API...");
-  Serial.println("URL: " + url);
-  
-  if (!http_client.begin(url)) {
-    Serial.println("Connection to API failed!");
-    http_client.end(); // Frees resources before returning
-    return "";
-  }
+// Function to borrow a connection to a host, preferring the most recently
+// used open one and connecting only if none is open
+PooledConnection* acquireConnection(ApiHost host) {
+    xSemaphoreTake(poolSlots[host], portMAX_DELAY);
+    closeIdleConnections();
+
+    PooledConnection* connection = NULL;
+    xSemaphoreTake(poolLock, portMAX_DELAY);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        PooledConnection* candidate = &connectionPool[i];
+        if (candidate->host != host || candidate->inUse) continue;
+        if (connection == NULL) {
+            connection = candidate;
+            continue;
+        }
+        bool candidateOpen = candidate->client.connected();
+        bool connectionOpen = connection->client.connected();
+        if ((candidateOpen && !connectionOpen) ||
+            (candidateOpen == connectionOpen && candidate->lastUsed > connection->lastUsed)) {
+            connection = candidate;
+        }
+    }
+    connection->inUse = true; // The slot count guarantees a free connection
+    xSemaphoreGive(poolLock);
 
-  // Set the request headers
-  http_client.addHeader("Content-Type", "application/json");
+    // On failure the caller's request reports the error
+    connectKeepAlive(&connection->client, api_hosts[host], connection->lastUsed);
+    return connection;
+}
 
-  // Create a JSON document for the request
-  JsonDocument requestDoc;
-  
-    // Build the JSON structure
-requestDoc["contents"][0]["parts"][0]["text"] = 
-    String("We are hosting a collaborative storytelling contest for children. It consists of four players. A base story prompt is given. ") +
-    "Players take turns to speak for thirty seconds. For the sake of fairness, each player has to ensure that they leave sufficient room for others to continue the story from where they stop. " +
-    "You have to assess the players on the basis of how well they speak, their articulation, contribution to the plot, usage of filler words, creativity, imagination, the story snippet they contributed, and whether they left sufficient room for others to continue the story from where they stopped. " +
-    "This is the base prompt we gave to the players (generated by the host): \"" + baseprompt + "\"; This is the collaborative story that has been stitched so far: \"" + storySoFar + "\"; " +
-    "The final player has spoken. This was his contribution to the story: \"" + playerStory + "\"; Assess the final player's contribution to the story on the basis " +
-    "of the aforesaid factors and whether he provided an appropriate ending to the story or not; provide a short constructive feedback in text that can be spoken in approximately thirty seconds. " +
-    "At the end of your feedback, provide a rating out of ten (say specifically \"I rate your contribution <rating> out of 10\"). Write everything in a single paragraph. "+
-    "If the player's contribution to the story, which I provided in the form of the transcription of his/her speech, does not seem sufficient to utilise thirty seconds of speaking time (indicating he/she spoke less), then penalise them for that. ";
-;
-
-
-  // Serialize the request
-  String requestBody;
-  serializeJson(requestDoc, requestBody);
-
-  // Debug print the request body
-  Serial.println("Sending request with body:");
-  Serial.println(requestBody);
-
-  // Send the request
-  int httpCode = http_client.POST(requestBody);
-
-  // Debug print the response code
-  Serial.print("HTTP Response code: ");
-  Serial.println(httpCode);
-
-  if (httpCode != 200) {
-    String error = http_client.getString();
-    Serial.println("Error response:");
-    Serial.println(error);
-    http_client.end();
-    return "Error: HTTP " + String(httpCode) + " - " + error;
-  }
+// Function to hand a connection back to the pool, leaving it open for the next request
+void releaseConnection(PooledConnection* connection) {
+    xSemaphoreTake(poolLock, portMAX_DELAY);
+    connection->inUse = false;
+    connection->lastUsed = millis();
+    xSemaphoreGive(poolLock);
+    xSemaphoreGive(poolSlots[connection->host]);
+}
 
-  // Get the response
-  String response = http_client.getString();
-  Serial.println("Raw response:");
-  Serial.println(response);
-  
-  // Parse the response
-  JsonDocument responseDoc;
-  DeserializationError error = deserializeJson(responseDoc, response);
-  
-  if (error) {
-    Serial.print("JSON parsing failed: ");
-    Serial.println(error.c_str());
-    http_client.end();
-    return "Error: JSON parsing failed - " + String(error.c_str());
-  }
+// Function to report how many handshakes keep-alive saved
+void printConnectionStats() {
+    Serial.printf("TLS connections: %lu handshakes, %lu reused\n",
+                  (unsigned long)tlsHandshakes, (unsigned long)tlsReuses);
+}
 
-  // Extract the feedback text
-  String feedback;
-  if (responseDoc["candidates"][0]["content"]["parts"][0]["text"].is<const char*>()) {
-    feedback = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
-  } else {
-    Serial.println("Unexpected response format");
-    Serial.println(response);
-    http_client.end(); // Frees resources before returning
-    feedback = "Error: Unable to parse response - unexpected format";
+// Function to read the text file from SD card
+String readTextFromSD(const char* filename) {
+  String text;
+  if (!sdReadText(SD, filename, text)) {
+    Serial.println("Error opening file from SD card.");
+    return "";
   }
+  return text;
+}
 
-  Serial.println("Feedback: " + feedback);
+// Function to write response to SD card
+bool writeResponseToSD(const String& response, const char* filename) {
+  if (!sdWrite(SD, filename, response)) {
+    Serial.println("Failed to write to file");
+    return false;
+  }
   
-  // Write the feedback to a file on the SD card
-  if (writeResponseToSD(feedback, evaluation)) {
-    Serial.println("Evaluation saved to SD card: " + String(evaluation));
-  } else {
-    Serial.println("Failed to save evaluation to SD card");
+  Serial.println("Response successfully written to " + String(filename));
+  return true;
   }
 
-  http_client.end();
-  return evaluation;
-}
+//------------------------------------------------------------------------
 
-// Buffer size for chunked upload (4KB)
-const size_t CHUNK_SIZE = 4096;
+// Game context: the texts of a game (base prompt, transcripts, evaluations,
+// the running story and the ratings) are kept in RAM, in an arena allocated
+// once, so each is read from where it was written instead of being read back
+// from SD. The SD card is only a write-behind copy: a background task saves
+// whatever has changed. A text that does not fit in the arena is written
+// straight to SD and read from there.
 
-WiFiClientSecure client;
+#define CONTEXT_ARENA_SIZE 24576 // bytes of text; a 4 player, 2 round game needs about 10 KB
+#define CONTEXT_MAX_ENTRIES (MAX_PLAYERS * MAX_ROUNDS * 2 + 8)
+#define CONTEXT_TASK_CORE 0
+#define CONTEXT_TASK_PRIORITY 1
+#define CONTEXT_TASK_STACK_SIZE 4096
 
-class ChunkedUploader {
+class GameContext {
 private:
-    WiFiClientSecure* client;
-    String boundary;
-    size_t contentLength;
-    File audioFile;
-    
-public:
-    ChunkedUploader(WiFiClientSecure* _client, const String& _boundary) 
-        : client(_client), boundary(_boundary) {}
-        
-    bool begin(const char* filename, size_t fileSize) {
-        audioFile = SD.open(filename);
-        if (!audioFile) {
-            Serial.println("Failed to open audio file!");
-            return false;
+    struct Entry {
+        const char* path; // the file the text belongs to, which outlives the game
+        uint16_t offset;  // into the arena
+        uint16_t length;
+        bool dirty;       // not yet saved to SD
+    };
+
+    char arena[CONTEXT_ARENA_SIZE];
+    size_t used;
+    Entry entries[CONTEXT_MAX_ENTRIES];
+    int entryCount;
+
+    const char* story[MAX_PLAYERS * MAX_ROUNDS]; // transcripts in the order they joined the story
+    int storyTurns;
+    int storySaved; // turns already appended to the story file
+
+    int ratings[MAX_PLAYERS];
+    bool ratingDirty[MAX_PLAYERS];
+
+    // What flush() is saving, copied out under the lock so the SD writes happen without it
+    Entry pending[CONTEXT_MAX_ENTRIES];
+    int pendingCount;
+    Entry pendingStory[MAX_PLAYERS * MAX_ROUNDS]; // dirty marks a transcript that is only on SD
+    int pendingStoryCount;
+    int pendingRatings[MAX_PLAYERS];
+    bool pendingRatingDirty[MAX_PLAYERS];
+
+    SemaphoreHandle_t lock;    // guards everything but the arena text, which never changes once written
+    SemaphoreHandle_t saving;  // held while writing to SD, so reset() cannot reuse text being saved
+    SemaphoreHandle_t changed; // wakes the write-behind task
+
+    // Function to find the latest text stored for a path; NULL if none. Call with the lock held.
+    Entry* find(const char* path) {
+        for (int i = entryCount - 1; i >= 0; i--) {
+            if (strcmp(entries[i].path, path) == 0) {
+                return &entries[i];
+            }
         }
-        
-        String head = "--" + boundary + "\r\n"
-                     "Content-Disposition: form-data; name=\"model\"\r\n\r\n"
-                     "whisper-1\r\n"
-                     "--" + boundary + "\r\n"
-                     "Content-Disposition: form-data; name=\"file\"; filename=\"audio.mp3\"\r\n"
-                     "Content-Type: audio/mp3\r\n\r\n";
-        String tail = "\r\n--" + boundary + "--\r\n";
-        
-        contentLength = head.length() + fileSize + tail.length();
-        
-        String headers = "POST " + String(stt_api_url) + " HTTP/1.1\r\n";
-        headers += "Host: api.openai.com\r\n";
-        headers += "Authorization: Bearer " + String(stt_api_key) + "\r\n";
-        headers += "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n";
-        headers += "Content-Length: " + String(contentLength) + "\r\n";
-        headers += "Connection: keep-alive\r\n\r\n";
-        
-        if (client->write((uint8_t*)headers.c_str(), headers.length()) != headers.length()) {
-            Serial.println("Failed to send headers!");
-            http_client.end(); // Frees resources before returning WRONG
-            return false;
+        return NULL;
+    }
+
+    // Function to copy text into the arena under path; false if it does not fit
+    bool store(const char* path, const char* text, size_t length, bool dirty) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        Entry* entry = find(path);
+        bool created = entry == NULL && entryCount < CONTEXT_MAX_ENTRIES;
+        if (created) {
+            entry = &entries[entryCount++];
+            entry->path = path;
         }
-        
-        if (client->write((uint8_t*)head.c_str(), head.length()) != head.length()) {
-            Serial.println("Failed to send multipart head!");
-            http_client.end(); // Frees resources before returning
-            return false;
+        bool stored = entry != NULL && used + length + 1 <= sizeof(arena);
+        if (stored) {
+            // A rewrite takes fresh space, so text handed out earlier stays valid
+            memcpy(arena + used, text, length);
+            arena[used + length] = '\0';
+            entry->offset = used;
+            entry->length = length;
+            entry->dirty = dirty;
+            used += length + 1;
+        } else if (created) {
+            entryCount--; // Drop the slot taken above
+        } else if (entry != NULL) {
+            entry->path = ""; // The text on SD is newer from now on
+            entry->dirty = false;
         }
-        
-        return true;
+        xSemaphoreGive(lock);
+        return stored;
     }
-    
-    bool uploadChunk() {
-    uint8_t buffer[CHUNK_SIZE];
-    size_t bytesRead = audioFile.read(buffer, CHUNK_SIZE);
-    
-    if (bytesRead > 0) {
-        size_t written = client->write(buffer, bytesRead);
-        if (written != bytesRead) {
-            Serial.printf("Write failed! Expected %d bytes, wrote %d bytes\n", bytesRead, written);
-            client->stop();  // Ensures client connection stops
+
+    // Function to save one text to SD
+    static bool saveText(const char* path, const char* text, size_t length, bool append = false) {
+        if (!sdWrite(SD, path, (const uint8_t*)text, length, append)) {
+            Serial.printf("Failed to save %s\n", path);
             return false;
         }
         return true;
     }
-    return false;
-}
 
-    
-    void finish() {
-        String tail = "\r\n--" + boundary + "--\r\n";
-        client->write((uint8_t*)tail.c_str(), tail.length());
-        audioFile.close();
-    }
-    
-    String readResponse() {
-        String response = "";
-        uint32_t timeout = millis() + 30000;  // 30 second timeout
-        
-        while (millis() < timeout) {
-            while (client->available()) {
-                char c = client->read();
-                response += c;
-                timeout = millis() + 5000;  // Reset timeout on data received
+    // Function to save what has changed; call with saving held. Only the copy
+    // of what changed is taken under the lock, so the game is never kept
+    // waiting on the SD card.
+    void flushLocked() {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        pendingCount = 0;
+        for (int i = 0; i < entryCount; i++) {
+            if (entries[i].dirty) {
+                entries[i].dirty = false;
+                pending[pendingCount++] = entries[i];
             }
-            
-            if (response.indexOf("\r\n\r\n") > 0 && response.indexOf("}") > 0) {
-                break;  // We have the complete response
-            }
-            
-            delay(IN_AUDIO_PAUSE);  // Small delay to prevent tight loop
         }
-        return response;
-    }
-};
 
-// Function to convert Text to Speech (TTS)
-void convertTextToSpeech(const char* textPath, const char* filePath) {
-    Serial.println("Commencing conversion of text to speech.");
+        pendingStoryCount = 0;
+        for (; storySaved < storyTurns; storySaved++) {
+            Entry* entry = find(story[storySaved]);
+            Entry& turn = pendingStory[pendingStoryCount++];
+            turn.path = story[storySaved];
+            turn.offset = entry != NULL ? entry->offset : 0;
+            turn.length = entry != NULL ? entry->length : 0;
+            turn.dirty = entry == NULL;
+        }
 
-    // Read the text file
-    String textContent;
-    File textFile = SD.open(textPath);
-    if (!textFile) {
-        Serial.println("Failed to open the file");
-        return;
-    }
-    while (textFile.available()) {
-        textContent += (char)textFile.read();
-    }
-    textFile.close();
+        for (int player = 0; player < PLAYER_COUNT; player++) {
+            pendingRatings[player] = ratings[player];
+            pendingRatingDirty[player] = ratingDirty[player];
+            ratingDirty[player] = false;
+        }
+        xSemaphoreGive(lock);
 
-    // Create a secure client
-    WiFiClientSecure client;
-    client.setInsecure(); // Skip certificate verification
-    client.setTimeout(30);  // Timeout specified in seconds
+        for (int i = 0; i < pendingCount; i++) {
+            saveText(pending[i].path, arena + pending[i].offset, pending[i].length);
+        }
 
-    HTTPClient https;
+        for (int i = 0; i < pendingStoryCount; i++) {
+            if (!pendingStory[i].dirty) {
+                saveText(storySoFar, arena + pendingStory[i].offset, pendingStory[i].length, true);
+                continue;
+            }
+            // The transcript did not fit in the arena, so it was written straight to SD
+            Serial.printf("Game context overflowed, adding %s to the story from SD\n", pendingStory[i].path);
+            String transcript = readTextFromSD(pendingStory[i].path);
+            if (transcript.length() == 0) {
+                Serial.printf("Could not add %s to the story!\n", pendingStory[i].path);
+                continue;
+            }
+            saveText(storySoFar, transcript.c_str(), transcript.length(), true);
+        }
 
-    if (https.begin(client, tts_api_url)) {
+        for (int player = 0; player < PLAYER_COUNT; player++) {
+            if (pendingRatingDirty[player]) {
+                String total = String(pendingRatings[player]);
+                saveText(ratingFiles[player], total.c_str(), total.length());
+            }
+        }
+    }
+
+    static void writeBehindTask(void* parameter) {
+        GameContext* context = (GameContext*)parameter;
+        for (;;) {
+            xSemaphoreTake(context->changed, portMAX_DELAY);
+            context->flush();
+        }
+    }
+
+public:
+    GameContext() : used(0), entryCount(0), storyTurns(0), storySaved(0), pendingCount(0), pendingStoryCount(0),
+                    lock(NULL), saving(NULL), changed(NULL) {}
+
+    // Function to start the write-behind task
+    bool begin() {
+        lock = xSemaphoreCreateMutex();
+        saving = xSemaphoreCreateMutex();
+        changed = xSemaphoreCreateBinary();
+        if (lock == NULL || saving == NULL || changed == NULL) {
+            Serial.println("Failed to create game context!");
+            return false;
+        }
+        if (xTaskCreatePinnedToCore(writeBehindTask, "contextWriter", CONTEXT_TASK_STACK_SIZE, this,
+                                    CONTEXT_TASK_PRIORITY, NULL, CONTEXT_TASK_CORE) != pdPASS) {
+            Serial.println("Failed to start game context writer, saving only at game end.");
+        }
+        return true;
+    }
+
+    // Function to forget the previous game; ratings carry on from their files, as they always have
+    void reset() {
+        xSemaphoreTake(saving, portMAX_DELAY);
+        flushLocked();
+        xSemaphoreTake(lock, portMAX_DELAY);
+        used = 0;
+        entryCount = 0;
+        storyTurns = 0;
+        storySaved = 0;
+        xSemaphoreGive(lock);
+        xSemaphoreGive(saving);
+
+        for (int player = 0; player < PLAYER_COUNT; player++) {
+            ratings[player] = 0;
+            ratingDirty[player] = true;
+            SDBlockReader file(SD, ratingFiles[player]);
+            if (file.isOpen()) {
+                ratings[player] = file.readStringUntil('\n').toInt();
+                ratingDirty[player] = false;
+            }
+        }
+        xSemaphoreGive(changed);
+    }
+
+    // Function to store a text for path, saving it to SD in the background
+    bool put(const char* path, const String& text) {
+        if (!store(path, text.c_str(), text.length(), true)) {
+            Serial.printf("Game context is full, writing %s straight to SD\n", path);
+            xSemaphoreTake(saving, portMAX_DELAY); // After any older copy flush() is saving
+            bool written = writeResponseToSD(text, path);
+            xSemaphoreGive(saving);
+            return written;
+        }
+        xSemaphoreGive(changed);
+        return true;
+    }
+
+    // Function to get the text stored for path, falling back to the SD card; "" if there is none
+    String get(const char* path) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        Entry* entry = find(path);
+        const char* text = entry != NULL ? arena + entry->offset : NULL;
+        xSemaphoreGive(lock);
+        if (text != NULL) {
+            return String(text);
+        }
+
+        String fromSD = readTextFromSD(path);
+        if (fromSD.length() > 0) {
+            store(path, fromSD.c_str(), fromSD.length(), false); // Read it from RAM next time
+        }
+        return fromSD;
+    }
+
+    // Function to add a player's transcript to the end of the running story
+    void appendToStory(const char* transcriptPath) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (storyTurns < MAX_PLAYERS * MAX_ROUNDS) {
+            story[storyTurns++] = transcriptPath;
+        }
+        xSemaphoreGive(lock);
+        xSemaphoreGive(changed);
+    }
+
+    // Function to add a turn's rating to a player's total (player is 1-based)
+    void addRating(int player, int rating) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        ratings[player - 1] += rating;
+        ratingDirty[player - 1] = true;
+        int total = ratings[player - 1];
+        xSemaphoreGive(lock);
+        xSemaphoreGive(changed);
+        Serial.printf("New total for player %d: %d\n", player, total);
+    }
+
+    int rating(int player) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int total = ratings[player - 1];
+        xSemaphoreGive(lock);
+        return total;
+    }
+
+    // Function to save everything that has changed to SD; run by the write-behind
+    // task, and directly before the files are needed on SD
+    void flush() {
+        xSemaphoreTake(saving, portMAX_DELAY);
+        flushLocked();
+        xSemaphoreGive(saving);
+    }
+};
+
+GameContext gameContext;
+
+//------------------------------------------------------------------------
+
+// Gemini client: every prompt goes through GeminiClient::generate, which
+// sends it over the pooled Gemini connection with the request's generation
+// settings and timeout, and returns the text of the first candidate. Callers
+// that pass a SentenceListener get the reply streamed (streamGenerateContent
+// as server-sent events) and hear about each sentence as soon as it is complete.
+
+#define GEMINI_TIMEOUT 30000 // ms to wait for a reply
+#define STORY_MAX_TOKENS 128
+#define STORY_TEMPERATURE 0.9
+#define FEEDBACK_MAX_TOKENS 256 // about thirty seconds of speech
+#define FEEDBACK_TEMPERATURE 0.4 // keeps ratings consistent between players
+#define WINNER_MAX_TOKENS 640 // up to two minutes of speech
+#define WINNER_TEMPERATURE 0.7
+#define SUMMARY_MAX_TOKENS 320
+#define SUMMARY_TEMPERATURE 0.2 // a faithful summary, not a retelling
+
+// Reads an HTTP response body straight from the socket, undoing chunked
+// transfer encoding, so a parser can consume it without buffering it first
+class HttpBodyStream : public Stream {
+private:
+    WiFiClient* client;
+    bool chunked;
+    int32_t remaining;  // bytes left in the body or current chunk; -1 until the connection closes
+    bool finished;      // nothing more will be read
+    bool complete;      // the body ended where its framing said it would
+    uint32_t timeoutMs; // longest wait for the next byte
+    uint32_t received;  // body bytes handed out
+    uint8_t buffer[128];
+    size_t bufferLength;
+    size_t bufferPos;
+
+    // Function to get the next raw byte from the socket, waiting up to the timeout; -1 on timeout or close
+    int nextRaw() {
+        if (bufferPos < bufferLength) {
+            return buffer[bufferPos++];
+        }
+        uint32_t lastData = millis();
+        for (;;) {
+            int available = client->available();
+            if (available > 0) {
+                int count = client->read(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+                if (count > 0) {
+                    bufferLength = count;
+                    bufferPos = 1;
+                    return buffer[0];
+                }
+            }
+            if (!client->connected() || millis() - lastData > timeoutMs) {
+                return -1;
+            }
+            delay(1);
+        }
+    }
+
+    // Function to read a chunk-size line; false on a malformed line or a timeout
+    bool readChunkSize() {
+        int32_t size = 0;
+        bool digits = false;
+        bool extension = false;
+        for (;;) {
+            int c = nextRaw();
+            if (c < 0) {
+                return false;
+            }
+            if (c == '\n') {
+                break;
+            }
+            if (c == ';') {
+                extension = true; // Chunk extensions are ignored
+            } else if (!extension && isHexadecimalDigit(c)) {
+                size = size * 16 + (isDigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+                digits = true;
+            }
+        }
+        if (!digits) {
+            return false;
+        }
+        if (size == 0) {
+            // Skip any trailers up to the blank line that ends the body
+            int lineLength = 0;
+            for (;;) {
+                int c = nextRaw();
+                if (c < 0) {
+                    return false;
+                }
+                if (c == '\n') {
+                    if (lineLength == 0) break;
+                    lineLength = 0;
+                } else if (c != '\r') {
+                    lineLength++;
+                }
+            }
+            finished = true;
+            complete = true;
+        }
+        remaining = size;
+        return true;
+    }
+
+public:
+    HttpBodyStream(WiFiClient* _client, bool _chunked, int size, uint32_t _timeoutMs)
+        : client(_client), chunked(_chunked), remaining(_chunked ? 0 : size), finished(!_chunked && size == 0),
+          complete(!_chunked && size == 0), timeoutMs(_timeoutMs), received(0), bufferLength(0), bufferPos(0) {
+        setTimeout(_timeoutMs);
+    }
+
+    int available() override {
+        if (finished) {
+            return 0;
+        }
+        int buffered = bufferLength - bufferPos + client->available();
+        return remaining >= 0 && remaining < buffered ? remaining : buffered;
+    }
+
+    int read() override {
+        if (finished) {
+            return -1;
+        }
+        if (chunked && remaining == 0) {
+            if (!readChunkSize() || finished) {
+                finished = true;
+                return -1;
+            }
+        }
+
+        int c = nextRaw();
+        if (c < 0) {
+            finished = true; // Timed out, or the connection closed
+            return -1;
+        }
+        received++;
+        if (remaining > 0 && --remaining == 0) {
+            if (chunked) {
+                // Consume the CRLF after the chunk data
+                if (nextRaw() != '\r' || nextRaw() != '\n') {
+                    finished = true;
+                }
+            } else {
+                finished = true;
+                complete = true;
+            }
+        }
+        return c;
+    }
+
+    int peek() override {
+        return -1; // Not needed by the JSON parser
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+    void flush() override {}
+
+    // Function to skip the rest of the body, so the connection can carry the
+    // next request; false if the body was cut short or malformed
+    bool drain() {
+        while (read() >= 0) {
+        }
+        return complete;
+    }
+
+    uint32_t bytesRead() {
+        return received;
+    }
+};
+
+// Receives a streamed reply one sentence at a time
+class SentenceListener {
+public:
+    virtual void onSentence(const String& sentence) = 0;
+};
+
+#define SENTENCE_MIN_CHARS 24 // shorter sentences are merged with the next, e.g. "Hmmm..."
+
+// Function to find where the first complete sentence of text ends: the index of the
+// whitespace after its closing punctuation, or -1 if no sentence is complete yet
+int findSentenceEnd(const String& text) {
+    for (int i = SENTENCE_MIN_CHARS; i < (int)text.length(); i++) {
+        char c = text.charAt(i);
+        if (c != ' ' && c != '\n') {
+            continue;
+        }
+        int end = i - 1;
+        while (end > 0 && (text.charAt(end) == '"' || text.charAt(end) == '\'' || text.charAt(end) == ')')) {
+            end--;
+        }
+        char punctuation = text.charAt(end);
+        if (punctuation == '.' || punctuation == '!' || punctuation == '?') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Gemini session: a game is one conversation with the model. The rubric and
+// the base prompt are set once as the system instruction, and each turn adds
+// only the player's contribution and the model's rating to the history,
+// instead of every prompt restating the rubric and the whole story re-read
+// from SD. The API keeps no state, so the history is still sent with every
+// request, but it only ever grows at the end, which lets the server reuse its
+// work on the unchanged start of the conversation.
+//
+// With STORY_SUMMARY, once the verbatim contributions outgrow STORY_BUDGET
+// bytes, all but the last STORY_VERBATIM_TURNS are folded into a rolling
+// summary by a background task between turns. The history then opens with
+// the summary, so requests stop growing with the length of the game.
+
+#define SESSION_MAX_TURNS (MAX_PLAYERS * MAX_ROUNDS)
+#define STORY_BUDGET 2048        // bytes of verbatim contributions before summarising
+#define STORY_VERBATIM_TURNS 3   // latest contributions always kept word for word
+
+class GeminiSession {
+private:
+    String systemInstruction;
+    String contributions[SESSION_MAX_TURNS]; // each turn's contribution, as the model saw it
+    String replies[SESSION_MAX_TURNS];       // the model's answers, shrunk to their rating
+    int turns;
+    int firstTurn;      // turns before this are folded into the summary
+    String summary;     // the story told in the folded turns
+    uint32_t generation; // tells a summary of a previous game from this one
+    SemaphoreHandle_t lock; // the worker and the summary task share the history
+
+    // Function to count the bytes of verbatim contributions
+    size_t verbatimBytes() const {
+        size_t bytes = 0;
+        for (int i = firstTurn; i < turns; i++) {
+            bytes += contributions[i].length();
+        }
+        return bytes;
+    }
+
+    // Function to shrink a reply to its rating sentence, or failing that its first sentence
+    static String compactReply(const String& reply) {
+        int rating = reply.lastIndexOf("I rate");
+        if (rating >= 0) {
+            return reply.substring(rating);
+        }
+        int end = findSentenceEnd(reply);
+        return end >= 0 ? reply.substring(0, end) : reply;
+    }
+
+public:
+    GeminiSession() : turns(0), firstTurn(0), generation(0), lock(NULL) {}
+
+    // Function to start a new conversation, dropping the previous game's history
+    void begin(const String& instruction) {
+        if (lock == NULL) {
+            lock = xSemaphoreCreateMutex();
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        systemInstruction = instruction;
+        for (int i = 0; i < turns; i++) {
+            contributions[i] = String();
+            replies[i] = String();
+        }
+        turns = 0;
+        firstTurn = 0;
+        summary = String();
+        generation++;
+        xSemaphoreGive(lock);
+    }
+
+    bool active() const {
+        return systemInstruction.length() > 0;
+    }
+
+    // Function to record a turn once the model has answered it; reply is "" if it did not
+    void addTurn(const String& contribution, const String& reply) {
+        String compacted = reply.length() > 0 ? compactReply(reply) : String("No feedback was given.");
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool full = turns >= SESSION_MAX_TURNS;
+        if (!full) {
+            contributions[turns] = contribution;
+            replies[turns] = compacted;
+            turns++;
+        }
+        xSemaphoreGive(lock);
+        if (full) {
+            Serial.println("Gemini session is full!");
+        }
+    }
+
+    // Function to tell whether the verbatim turns have outgrown the budget
+    bool needsSummary() {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool needed = turns - firstTurn > STORY_VERBATIM_TURNS && verbatimBytes() > STORY_BUDGET;
+        xSemaphoreGive(lock);
+        return needed;
+    }
+
+    // Function to copy out what the next summary should cover: the current summary
+    // and the turns to fold into it; returns how many turns that is
+    int prepareSummary(String& previousSummary, String& foldedTurns, uint32_t& forGeneration) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int count = turns - firstTurn - STORY_VERBATIM_TURNS;
+        previousSummary = summary;
+        foldedTurns = "";
+        for (int i = firstTurn; i < firstTurn + count; i++) {
+            foldedTurns += contributions[i] + " (" + replies[i] + ")\n";
+        }
+        forGeneration = generation;
+        xSemaphoreGive(lock);
+        return count;
+    }
+
+    // Function to replace the oldest count turns with their summary, unless a new game has begun
+    void applySummary(const String& newSummary, int count, uint32_t forGeneration) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (forGeneration == generation) {
+            for (int i = firstTurn; i < firstTurn + count; i++) {
+                contributions[i] = String();
+                replies[i] = String();
+            }
+            firstTurn += count;
+            summary = newSummary;
+        }
+        xSemaphoreGive(lock);
+    }
+
+    // Function to write the system instruction, the history and the new message into a request.
+    // gemini-pro on the v1 API takes no systemInstruction field, so the rubric
+    // opens the conversation as the first user turn instead
+    void writeContents(JsonDocument& requestDoc, const String& message) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        requestDoc["contents"][0]["role"] = "user";
+        requestDoc["contents"][0]["parts"][0]["text"] = systemInstruction;
+        requestDoc["contents"][1]["role"] = "model";
+        requestDoc["contents"][1]["parts"][0]["text"] = "Understood.";
+        int index = 2;
+        if (summary.length() > 0) {
+            requestDoc["contents"][index]["role"] = "user";
+            requestDoc["contents"][index]["parts"][0]["text"] = "Summary of the story told by the earlier turns: " + summary;
+            requestDoc["contents"][index + 1]["role"] = "model";
+            requestDoc["contents"][index + 1]["parts"][0]["text"] = "Understood.";
+            index += 2;
+        }
+        for (int i = firstTurn; i < turns; i++, index += 2) {
+            requestDoc["contents"][index]["role"] = "user";
+            requestDoc["contents"][index]["parts"][0]["text"] = contributions[i];
+            requestDoc["contents"][index + 1]["role"] = "model";
+            requestDoc["contents"][index + 1]["parts"][0]["text"] = replies[i];
+        }
+        requestDoc["contents"][index]["role"] = "user";
+        requestDoc["contents"][index]["parts"][0]["text"] = message;
+        xSemaphoreGive(lock);
+    }
+};
+
+// A prompt and how the model should answer it
+class GeminiRequest {
+public:
+    String prompt;
+    const char* label;   // file the answer is for, used in logs and traces
+    int maxOutputTokens; // 0 leaves it to the model
+    float temperature;   // negative leaves it to the model
+    uint32_t timeout;    // ms
+    GeminiSession* session; // conversation the prompt continues, or NULL
+
+    GeminiRequest(const String& _prompt, const char* _label)
+        : prompt(_prompt), label(_label), maxOutputTokens(0), temperature(-1), timeout(GEMINI_TIMEOUT),
+          session(NULL) {}
+
+    GeminiRequest& setMaxOutputTokens(int tokens) {
+        maxOutputTokens = tokens;
+        return *this;
+    }
+
+    GeminiRequest& setTemperature(float value) {
+        temperature = value;
+        return *this;
+    }
+
+    GeminiRequest& setTimeout(uint32_t ms) {
+        timeout = ms;
+        return *this;
+    }
+
+    GeminiRequest& setSession(GeminiSession* conversation) {
+        session = conversation;
+        return *this;
+    }
+};
+
+class GeminiClient {
+private:
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t totalLatency; // ms across successful requests
+    portMUX_TYPE statsMux;
+
+    // Function to count a finished request
+    void recordResult(bool success, uint32_t latency) {
+        portENTER_CRITICAL(&statsMux);
+        requests++;
+        if (success) {
+            totalLatency += latency;
+        } else {
+            failures++;
+        }
+        portEXIT_CRITICAL(&statsMux);
+    }
+
+    // Function to parse a reply, keeping only the fields used below
+    template <typename TInput>
+    DeserializationError parseReply(TInput& input, JsonDocument& responseDoc) {
+        JsonDocument filter;
+        filter["candidates"][0]["content"]["parts"][0]["text"] = true;
+        filter["candidates"][0]["finishReason"] = true;
+        filter["usageMetadata"]["promptTokenCount"] = true;
+        filter["usageMetadata"]["candidatesTokenCount"] = true;
+        return deserializeJson(responseDoc, input, DeserializationOption::Filter(filter));
+    }
+
+    // Function to append the text of a parsed reply; false if it holds none
+    bool appendReplyText(JsonDocument& responseDoc, const GeminiRequest& request, String& text) {
+        JsonVariant candidate = responseDoc["candidates"][0];
+        if (!candidate["content"]["parts"][0]["text"].is<const char*>()) {
+            Serial.printf("Unexpected Gemini response format for %s\n", request.label);
+            return false;
+        }
+        text += candidate["content"]["parts"][0]["text"].as<const char*>();
+
+        // Only the last reply of a stream says why generation stopped
+        const char* finishReason = candidate["finishReason"] | "";
+        if (finishReason[0] != '\0') {
+            if (strcmp(finishReason, "STOP") != 0) {
+                Serial.printf("Gemini reply for %s ended early: %s\n", request.label, finishReason);
+            }
+            Serial.printf("Gemini used %d prompt and %d reply tokens for %s\n",
+                          responseDoc["usageMetadata"]["promptTokenCount"] | 0,
+                          responseDoc["usageMetadata"]["candidatesTokenCount"] | 0, request.label);
+        }
+        return true;
+    }
+
+    // Function to read a single JSON reply
+    bool readReply(HttpBodyStream& body, const GeminiRequest& request, String& text) {
+        JsonDocument responseDoc;
+        DeserializationError error = parseReply(body, responseDoc);
+        if (error) {
+            Serial.printf("Gemini JSON parsing failed for %s: %s\n", request.label, error.c_str());
+            return false;
+        }
+        return appendReplyText(responseDoc, request, text);
+    }
+
+    // Function to read server-sent events, handing each sentence to the listener as soon as it is complete
+    bool readEventStream(HttpBodyStream& body, const GeminiRequest& request, String& text,
+                         SentenceListener* listener, uint32_t startTime) {
+        String line = "";
+        String event = ""; // data lines of the event being read
+        int spoken = 0;    // characters of text already handed to the listener
+        bool received = false;
+        int c;
+        do {
+            c = body.read();
+            if (c >= 0 && c != '\n') {
+                if (c != '\r') {
+                    line += (char)c;
+                }
+                continue;
+            }
+
+            if (line.startsWith("data:")) {
+                event += line.substring(line.charAt(5) == ' ' ? 6 : 5);
+            } else if (line.length() == 0 && event.length() > 0) {
+                // A blank line ends the event
+                JsonDocument responseDoc;
+                DeserializationError error = parseReply(event, responseDoc);
+                event = "";
+                if (error) {
+                    Serial.printf("Gemini event parsing failed for %s: %s\n", request.label, error.c_str());
+                } else if (appendReplyText(responseDoc, request, text) && !received) {
+                    received = true;
+                    traceRecord("gemini first text", request.label, startTime);
+                }
+
+                int end;
+                while ((end = findSentenceEnd(text.substring(spoken))) >= 0) {
+                    String sentence = text.substring(spoken, spoken + end);
+                    sentence.trim();
+                    listener->onSentence(sentence);
+                    spoken += end + 1;
+                }
+            }
+            line = "";
+        } while (c >= 0);
+
+        // Whatever follows the last full stop is a sentence too
+        String rest = text.substring(spoken);
+        rest.trim();
+        if (rest.length() > 0) {
+            listener->onSentence(rest);
+        }
+        return received;
+    }
+
+public:
+    GeminiClient() : requests(0), failures(0), totalLatency(0) {
+        statsMux = portMUX_INITIALIZER_UNLOCKED;
+    }
+
+    // Function to send a request and extract the reply text; false on any failure. With a
+    // listener the reply is streamed and each sentence is handed over as soon as it is complete.
+    bool generate(const GeminiRequest& request, String& text, SentenceListener* listener = NULL) {
+        TraceScope trace("gemini", request.label);
+        uint32_t startTime = millis();
+
+        JsonDocument requestDoc;
+        if (request.session != NULL) {
+            request.session->writeContents(requestDoc, request.prompt);
+        } else {
+            requestDoc["contents"][0]["parts"][0]["text"] = request.prompt;
+        }
+        if (request.maxOutputTokens > 0) {
+            requestDoc["generationConfig"]["maxOutputTokens"] = request.maxOutputTokens;
+        }
+        if (request.temperature >= 0) {
+            requestDoc["generationConfig"]["temperature"] = request.temperature;
+        }
+        String requestBody;
+        serializeJson(requestDoc, requestBody);
+        requestDoc.clear(); // The prompt is no longer needed twice over
+
+        String url = listener != NULL ? String(gemini_stream_url) + "?alt=sse&key=" + String(gemini_api_key)
+                                      : String(gemini_url) + "?key=" + String(gemini_api_key);
+
+        PooledConnection* connection = acquireConnection(GEMINI_API);
+        HTTPClient& http_client = connection->http;
+        if (!http_client.begin(connection->client, url)) {
+            Serial.println("Connection to Gemini API failed!");
+            http_client.end();
+            releaseConnection(connection);
+            recordResult(false, 0);
+            return false;
+        }
+        http_client.setTimeout(request.timeout > 65535 ? 65535 : request.timeout);
+        http_client.addHeader("Content-Type", "application/json");
+        const char* headerKeys[] = {"Transfer-Encoding"};
+        http_client.collectHeaders(headerKeys, 1);
+
+        int httpCode = http_client.POST(requestBody);
+        trace.addBytes(requestBody.length(), 0);
+        requestBody = String(); // Free the request before the reply arrives
+        if (httpCode <= 0) {
+            Serial.printf("Gemini request for %s failed: %s\n", request.label, HTTPClient::errorToString(httpCode).c_str());
+            http_client.end();
+            releaseConnection(connection);
+            recordResult(false, 0);
+            return false;
+        }
+
+        // Parse the reply as it arrives
+        text = "";
+        HttpBodyStream body(http_client.getStreamPtr(), http_client.header("Transfer-Encoding").equalsIgnoreCase("chunked"),
+                            http_client.getSize(), request.timeout);
+        bool success = false;
+        if (httpCode != 200) {
+            String error = "";
+            int c;
+            while (error.length() < 512 && (c = body.read()) >= 0) {
+                error += (char)c;
+            }
+            Serial.printf("Gemini HTTP error %d for %s: %s\n", httpCode, request.label, error.c_str());
+        } else if (listener != NULL) {
+            success = readEventStream(body, request, text, listener, startTime);
+        } else {
+            success = readReply(body, request, text);
+        }
+
+        // A body left half-read would corrupt the next response on this connection
+        if (!body.drain()) {
+            connection->client.stop();
+        }
+        trace.addBytes(0, body.bytesRead());
+        http_client.end(); // The connection stays open for the next request
+        releaseConnection(connection);
+
+        if (!success) {
+            recordResult(false, 0);
+            return false;
+        }
+
+        uint32_t latency = millis() - startTime;
+        recordResult(true, latency);
+        Serial.printf("Gemini replied for %s in %lu ms\n", request.label, (unsigned long)latency);
+        return true;
+    }
+
+    // Function to report request counts and mean latency
+    void printStats() {
+        uint32_t succeeded = requests - failures;
+        Serial.printf("Gemini: %lu requests, %lu failed, %lu ms mean latency\n",
+                      (unsigned long)requests, (unsigned long)failures,
+                      (unsigned long)(succeeded > 0 ? totalLatency / succeeded : 0));
+    }
+};
+
+GeminiClient gemini;
+
+// Function to store Gemini's response to text file
+void processResponse(String evaluation, const char *outputFile) {
+  Serial.println(evaluation);
+  
+  // Keep the evaluation in the game context, which saves it to the SD card
+  if (gameContext.put(outputFile, evaluation)) {
+    Serial.println("Evaluation saved: " + String(outputFile));
+  } else {
+    Serial.println("Failed to save evaluation");
+  }
+}
+
+// The game's conversation with Gemini, started once the base prompt is known
+GeminiSession gameSession;
+
+// Function to start the game's Gemini session with the rubric and the base prompt
+void startGameSession(const char* base_prompt) {
+  // Read the base prompt generated by Gemini
+  String baseprompt = gameContext.get(base_prompt);
+
+  String instruction =
+    String("We are hosting a collaborative storytelling contest for children. It consists of ") + PLAYER_COUNT + " players. A base story prompt is given. " +
+    "Players take turns to speak for thirty seconds each. For the sake of fairness, each player has to ensure that they leave sufficient room for others to continue the story from where they stop. " +
+    "You have to assess the players on the basis of how well they speak, their articulation, contribution to the plot, usage of filler words, creativity, imagination, the story snippet they contributed, and whether they left sufficient room for others to continue the story from where they stopped. " +
+    "This is the base prompt we gave to the players (generated by the host): \"" + baseprompt + "\". " +
+    "Each message gives you the next player's contribution to the story (we transcribed his/her speech), in the order they spoke, so together they are the collaborative story stitched so far. " +
+    "Your earlier feedback in this conversation is shortened to its rating. " +
+    "Assess each contribution on the basis of the aforesaid factors and provide a short constructive feedback in text that can be spoken in approximately thirty seconds. " +
+    "At the end of your feedback, provide a rating out of ten (say specifically \"I rate your contribution <rating> out of 10\"). Write everything in a single paragraph. No special characters. " +
+    "Each contribution says for how many of their thirty seconds the player actually spoke. If the player's contribution to the story, which I provided in the form of the transcription of his/her speech, does not seem sufficient to utilise thirty seconds of speaking time (indicating he/she spoke less), then penalise them for that. ";
+
+  gameSession.begin(instruction);
+}
+
+#if STORY_SUMMARY
+#define SUMMARY_TASK_CORE 0
+#define SUMMARY_TASK_PRIORITY 1
+#define SUMMARY_TASK_STACK_SIZE 16384 // TLS handshake plus HTTPClient
+
+SemaphoreHandle_t summaryWanted = NULL; // given when the story may have outgrown its budget
+
+// Function to fold the oldest turns of the story into the rolling summary
+void summariseStory() {
+  String previousSummary;
+  String foldedTurns;
+  uint32_t generation;
+  int count = gameSession.prepareSummary(previousSummary, foldedTurns, generation);
+  if (count <= 0) {
+    return;
+  }
+
+  String prompt =
+    String("These are turns of a collaborative story told by the players of a children's storytelling contest, each with the rating the player was given: \n") + foldedTurns;
+  if (previousSummary.length() > 0) {
+    prompt += "They continue the story summarised here: \"" + previousSummary + "\". ";
+  }
+  prompt += "Write a single summary of the whole story so far in less than 150 words, saying which player contributed each part and the rating they were given. "
+            "Write everything in a single paragraph. No special characters.";
+
+  GeminiRequest request(prompt, "story summary");
+  request.setMaxOutputTokens(SUMMARY_MAX_TOKENS).setTemperature(SUMMARY_TEMPERATURE);
+
+  String summary;
+  if (!gemini.generate(request, summary)) {
+    return; // The turns stay verbatim; the next turn tries again
+  }
+  gameSession.applySummary(summary, count, generation);
+  Serial.printf("Story summary now covers %d more turns in %u bytes\n", count, (unsigned int)summary.length());
+}
+
+// Task that summarises the story between turns, off the turn worker's path
+void storySummaryTask(void* parameter) {
+  for (;;) {
+    xSemaphoreTake(summaryWanted, portMAX_DELAY);
+    if (gameSession.needsSummary()) {
+      summariseStory();
+    }
+  }
+}
+
+// Function to start the summary task
+bool startStorySummary() {
+  summaryWanted = xSemaphoreCreateBinary();
+  if (summaryWanted == NULL ||
+      xTaskCreatePinnedToCore(storySummaryTask, "storySummary", SUMMARY_TASK_STACK_SIZE, NULL,
+                              SUMMARY_TASK_PRIORITY, NULL, SUMMARY_TASK_CORE) != pdPASS) {
+    Serial.println("Failed to start story summary task!");
+    return false;
+  }
+  return true;
+}
+
+// Function to wake the summary task if the story has outgrown its budget
+void requestStorySummary() {
+  if (summaryWanted != NULL && gameSession.needsSummary()) {
+    xSemaphoreGive(summaryWanted);
+  }
+}
+#endif
+
+// Function to send a player's contribution to the game session and save the feedback;
+// request_text says what to assess and is not kept in the history
+String evaluateTurn(int playerNumber, float voicedSeconds, const char* player_contribution, const String& request_text,
+                    const char* evaluation, SentenceListener* listener) {
+  // Read the story told by the player, with how long they actually spoke for
+  String contribution = String("Player ") + playerNumber + " (spoke for " + (int)(voicedSeconds + 0.5) +
+                        " of 30 seconds): \"" + gameContext.get(player_contribution) + "\"";
+
+  GeminiRequest request(contribution + " " + request_text, evaluation);
+  request.setMaxOutputTokens(FEEDBACK_MAX_TOKENS).setTemperature(FEEDBACK_TEMPERATURE).setSession(&gameSession);
+
+  String feedback;
+  bool replied = gemini.generate(request, feedback, listener);
+
+  // The contribution is part of the story even if the model did not answer
+  gameSession.addTurn(contribution, replied ? feedback : String());
+#if STORY_SUMMARY
+  requestStorySummary(); // Ready before the next turn is evaluated
+#endif
+  if (!replied) {
+    return "";
+  }
+
+  // Write the feedback to a file on the SD card
+  processResponse(feedback, evaluation);
+  return evaluation;
+}
+
+// Invokes Gemini API to evaluate the first contribution
+String evaluateFContribution(int playerNumber, float voicedSeconds, const char* player_contribution, const char* evaluation, SentenceListener* listener = NULL) {
+  return evaluateTurn(playerNumber, voicedSeconds, player_contribution,
+                      "This player started the story. Assess the contribution, along with the fact whether he/she did a decent start to the story or not.",
+                      evaluation, listener);
+}
+
+// Invokes Gemini API to evaluate intermediary contributions
+String evaluateContribution(int playerNumber, float voicedSeconds, const char* player_contribution, const char* evaluation, SentenceListener* listener = NULL) {
+  return evaluateTurn(playerNumber, voicedSeconds, player_contribution, "Assess this contribution.", evaluation, listener);
+}
+
+// Invokes Gemini API to evaluate the final contribution
+String evaluateLContribution(int playerNumber, float voicedSeconds, const char* player_contribution, const char* evaluation, SentenceListener* listener = NULL) {
+  return evaluateTurn(playerNumber, voicedSeconds, player_contribution,
+                      "This was the final player. Assess the contribution, along with whether he/she provided an appropriate ending to the story or not.",
+                      evaluation, listener);
+}
+
+// Function to read exactly length bytes of a response body into body
+bool readHttpBytes(WiFiClient* client, String& body, size_t length, uint32_t deadline) {
+    uint8_t buffer[512];
+    while (length > 0) {
+        if (!client->available()) {
+            if (!client->connected() || millis() > deadline) {
+                return false;
+            }
+            delay(IN_AUDIO_PAUSE);
+            continue;
+        }
+        int n = client->read(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        if (n <= 0) {
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            body += (char)buffer[i];
+        }
+        length -= n;
+    }
+    return true;
+}
+
+// Function to read the rest of a response body, until the server closes the connection
+void readHttpUntilClose(WiFiClient* client, String& body, uint32_t deadline) {
+    uint8_t buffer[512];
+    while (client->connected() || client->available()) {
+        int available = client->available();
+        if (available <= 0) {
+            if (millis() > deadline) {
+                return;
+            }
+            delay(IN_AUDIO_PAUSE);
+            continue;
+        }
+        int n = client->read(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+        for (int i = 0; i < n; i++) {
+            body += (char)buffer[i];
+        }
+    }
+}
+
+// Function to read an HTTP/1.1 response (fixed length, chunked, or until close)
+// Returns the status code and stores the body, or -1 if no response arrived
+int readHttpResponse(WiFiClient* client, String& body, uint32_t timeoutMs) {
+    uint32_t deadline = millis() + timeoutMs;
+    body = "";
+
+    while (!client->available()) {
+        if (!client->connected() || millis() > deadline) {
+            Serial.println("No response from server!");
+            return -1;
+        }
+        delay(IN_AUDIO_PAUSE);
+    }
+
+    String statusLine = client->readStringUntil('\n');
+    int statusCode = statusLine.substring(9, 12).toInt();
+
+    long contentLength = -1;
+    bool chunked = false;
+    while (true) {
+        String line = client->readStringUntil('\n');
+        line.trim();
+        if (line.length() == 0) {
+            break; // End of headers
+        }
+        line.toLowerCase();
+        if (line.startsWith("content-length:")) {
+            contentLength = line.substring(15).toInt();
+        } else if (line.startsWith("transfer-encoding:") && line.indexOf("chunked") > 0) {
+            chunked = true;
+        }
+    }
+
+    if (chunked) {
+        while (true) {
+            String sizeLine = client->readStringUntil('\n');
+            long chunkSize = strtol(sizeLine.c_str(), NULL, 16);
+            if (chunkSize <= 0) {
+                client->readStringUntil('\n'); // Blank line after the last chunk
+                break;
+            }
+            if (!readHttpBytes(client, body, chunkSize, deadline)) {
+                break;
+            }
+            client->readStringUntil('\n'); // CRLF after each chunk
+        }
+    } else if (contentLength >= 0) {
+        readHttpBytes(client, body, contentLength, deadline);
+    } else {
+        // No length given: the body ends when the server closes the connection
+        readHttpUntilClose(client, body, deadline);
+    }
+    return statusCode;
+}
+
+// Buffer size for chunked upload (4KB)
+const size_t CHUNK_SIZE = 4096;
+
+class ChunkedUploader {
+private:
+    WiFiClientSecure* client;
+    String boundary;
+    size_t contentLength;
+    File audioFile;
+    size_t remaining; // bytes of the file still to send
+    ImaAdpcmEncoder encoder;
+    bool encoderFinished;
+    
+public:
+    ChunkedUploader(WiFiClientSecure* _client, const String& _boundary) 
+        : client(_client), boundary(_boundary), encoderFinished(false) {}
+        
+    bool begin(const char* filename, size_t fileSize) {
+        audioFile = SD.open(filename);
+        if (!audioFile) {
+            Serial.println("Failed to open audio file!");
+            return false;
+        }
+        
+        String head = "--" + boundary + "\r\n"
+                     "Content-Disposition: form-data; name=\"model\"\r\n\r\n"
+                     "whisper-1\r\n"
+                     "--" + boundary + "\r\n"
+                     "Content-Disposition: form-data; name=\"file\"; filename=\"audio.wav\"\r\n"
+                     "Content-Type: audio/wav\r\n\r\n";
+        String tail = "\r\n--" + boundary + "--\r\n";
+        remaining = fileSize;
+
+        // The SD copy is PCM; it is re-encoded as it is read, so the WAV header is replaced
+        uint8_t adpcm_header[ADPCM_WAV_HEADER_SIZE];
+        if (STT_UPLOAD_ADPCM) {
+            uint32_t sampleCount = fileSize > 44 ? (fileSize - 44) / MIC_BYTES_PER_SAMPLE : 0;
+            uint32_t dataSize = ADPCM_ENCODED_SIZE(sampleCount);
+            buildAdpcmWavHeader(adpcm_header, MIC_SAMPLE_RATE, dataSize, sampleCount);
+            audioFile.seek(44);
+            remaining = sampleCount * MIC_BYTES_PER_SAMPLE;
+            encoder.reset();
+            encoderFinished = false;
+            fileSize = sizeof(adpcm_header) + dataSize;
+        }
+        
+        contentLength = head.length() + fileSize + tail.length();
+        
+        String headers = "POST " + String(stt_api_url) + " HTTP/1.1\r\n";
+        headers += "Host: api.openai.com\r\n";
+        headers += "Authorization: Bearer " + String(stt_api_key) + "\r\n";
+        headers += "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n";
+        headers += "Content-Length: " + String(contentLength) + "\r\n";
+        headers += "Connection: keep-alive\r\n\r\n";
+        
+        if (client->write((uint8_t*)headers.c_str(), headers.length()) != headers.length()) {
+            Serial.println("Failed to send headers!");
+            client->stop(); // Frees resources before returning
+            return false;
+        }
+        
+        if (client->write((uint8_t*)head.c_str(), head.length()) != head.length()) {
+            Serial.println("Failed to send multipart head!");
+            client->stop(); // Frees resources before returning
+            return false;
+        }
+
+        if (STT_UPLOAD_ADPCM && client->write(adpcm_header, sizeof(adpcm_header)) != sizeof(adpcm_header)) {
+            Serial.println("Failed to send WAV header!");
+            client->stop();
+            return false;
+        }
+        
+        return true;
+    }
+
+    // Function to encode the next chunk of the SD copy and send it
+    bool uploadEncodedChunk() {
+        int16_t samples[CHUNK_SIZE / 2];
+        uint8_t encoded[ADPCM_ENCODED_SIZE(CHUNK_SIZE / 2) + ADPCM_BLOCK_BYTES];
+        size_t bytesRead = audioFile.read((uint8_t*)samples, remaining < sizeof(samples) ? remaining : sizeof(samples));
+        remaining -= bytesRead;
+        size_t length;
+        if (bytesRead > 0) {
+            length = encoder.encode(samples, bytesRead / MIC_BYTES_PER_SAMPLE, encoded);
+        } else if (!encoderFinished) {
+            length = encoder.finish(encoded);
+            encoderFinished = true;
+        } else {
+            return false;
+        }
+
+        if (length > 0 && client->write(encoded, length) != length) {
+            Serial.println("Write failed!");
+            client->stop();
+            return false;
+        }
+        return true;
+    }
+    
+    bool uploadChunk() {
+    if (STT_UPLOAD_ADPCM) {
+        return uploadEncodedChunk();
+    }
+
+    uint8_t buffer[CHUNK_SIZE];
+    size_t bytesRead = audioFile.read(buffer, remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE);
+    remaining -= bytesRead;
+    
+    if (bytesRead > 0) {
+        size_t written = client->write(buffer, bytesRead);
+        if (written != bytesRead) {
+            Serial.printf("Write failed! Expected %d bytes, wrote %d bytes\n", bytesRead, written);
+            client->stop();  // Ensures client connection stops
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+    
+    void finish() {
+        String tail = "\r\n--" + boundary + "--\r\n";
+        client->write((uint8_t*)tail.c_str(), tail.length());
+        audioFile.close();
+    }
+    
+    // Reads the reply in full, so the connection can carry the next request
+    String readResponse() {
+        String body;
+        int statusCode = readHttpResponse(client, body, 30000);
+        if (statusCode != 200) {
+            Serial.printf("Received unexpected HTTP response code: %d\n", statusCode);
+            client->stop();
+            return "";
+        }
+        return body;
+    }
+};
+
+// Function to fill in a 44-byte header for 16-bit mono PCM WAV data
+void buildWavHeader(byte* wav_header, uint32_t waveDataSize) {
+    // RIFF chunk descriptor
+    wav_header[0] = 'R'; wav_header[1] = 'I'; wav_header[2] = 'F'; wav_header[3] = 'F';
+    // A streamed header leaves both sizes at 0xFFFFFFFF ("until end of stream")
+    uint32_t totalDataSize = waveDataSize == 0xFFFFFFFF ? waveDataSize : waveDataSize + 36;
+    wav_header[4] = (byte)(totalDataSize & 0xFF);
+    wav_header[5] = (byte)((totalDataSize >> 8) & 0xFF);
+    wav_header[6] = (byte)((totalDataSize >> 16) & 0xFF);
+    wav_header[7] = (byte)((totalDataSize >> 24) & 0xFF);
+    wav_header[8] = 'W'; wav_header[9] = 'A'; wav_header[10] = 'V'; wav_header[11] = 'E';
+    wav_header[12] = 'f'; wav_header[13] = 'm'; wav_header[14] = 't'; wav_header[15] = ' ';
+    wav_header[16] = 16; wav_header[17] = 0; wav_header[18] = 0; wav_header[19] = 0;
+    wav_header[20] = 1; wav_header[21] = 0; // Audio format (PCM)
+    wav_header[22] = 1; wav_header[23] = 0; // Mono channel
+    wav_header[24] = (byte)(MIC_SAMPLE_RATE & 0xFF);
+    wav_header[25] = (byte)((MIC_SAMPLE_RATE >> 8) & 0xFF);
+    wav_header[26] = (byte)((MIC_SAMPLE_RATE >> 16) & 0xFF);
+    wav_header[27] = (byte)((MIC_SAMPLE_RATE >> 24) & 0xFF);
+    int byteRate = MIC_SAMPLE_RATE * 1 * MIC_BYTES_PER_SAMPLE;
+    wav_header[28] = (byte)(byteRate & 0xFF);
+    wav_header[29] = (byte)((byteRate >> 8) & 0xFF);
+    wav_header[30] = (byte)((byteRate >> 16) & 0xFF);
+    wav_header[31] = (byte)((byteRate >> 24) & 0xFF);
+    wav_header[32] = 1 * MIC_BYTES_PER_SAMPLE; // Block align
+    wav_header[33] = 0;
+    wav_header[34] = MIC_BYTES_PER_SAMPLE * 8; // Bits per sample
+    wav_header[35] = 0;
+    wav_header[36] = 'd'; wav_header[37] = 'a'; wav_header[38] = 't'; wav_header[39] = 'a';
+    wav_header[40] = (byte)(waveDataSize & 0xFF);
+    wav_header[41] = (byte)((waveDataSize >> 8) & 0xFF);
+    wav_header[42] = (byte)((waveDataSize >> 16) & 0xFF);
+    wav_header[43] = (byte)((waveDataSize >> 24) & 0xFF);
+}
+
+// Streams a recording to the Whisper API as it is captured. The request body
+// is sent with chunked transfer encoding, so the upload can start before the
+// recording's length is known and the transcript is ready moments after the
+// player stops speaking.
+class StreamingUploader {
+private:
+    WiFiClientSecure* client;
+    String boundary;
+    bool streaming;
+    size_t bytesSent;
+    uint32_t lastUsed;
+    ImaAdpcmEncoder encoder;
+    uint8_t encoded[ADPCM_ENCODED_SIZE(CAPTURE_RING_MAX_WRITE / 2) + ADPCM_BLOCK_BYTES];
+
+    // Function to send one HTTP chunk
+    bool writeChunk(const uint8_t* data, size_t length) {
+        char sizeLine[12];
+        int n = snprintf(sizeLine, sizeof(sizeLine), "%X\r\n", (unsigned int)length);
+        if (client->write((const uint8_t*)sizeLine, n) != (size_t)n ||
+            client->write(data, length) != length ||
+            client->write((const uint8_t*)"\r\n", 2) != 2) {
+            Serial.println("Streaming upload failed!");
+            streaming = false;
+            client->stop();
+            return false;
+        }
+        bytesSent += length;
+        return true;
+    }
+
+public:
+    StreamingUploader(WiFiClientSecure* _client)
+        : client(_client), streaming(false), bytesSent(0), lastUsed(0) {}
+
+    // Function to connect and send everything that precedes the audio samples
+    bool begin() {
+        // The connection is kept alive from this uploader's previous turn
+        if (!connectKeepAlive(client, "api.openai.com", lastUsed)) {
+            Serial.println("Streaming upload connection failed!");
+            return false;
+        }
+
+        boundary = "Boundary" + String(random(0xFFFF), HEX);
+        bytesSent = 0;
+
+        String headers = "POST " + String(stt_api_url) + " HTTP/1.1\r\n";
+        headers += "Host: api.openai.com\r\n";
+        headers += "Authorization: Bearer " + String(stt_api_key) + "\r\n";
+        headers += "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n";
+        headers += "Transfer-Encoding: chunked\r\n";
+        headers += "Connection: keep-alive\r\n\r\n";
+
+        if (client->write((uint8_t*)headers.c_str(), headers.length()) != headers.length()) {
+            Serial.println("Failed to send headers!");
+            client->stop();
+            return false;
+        }
+        streaming = true;
+
+        String head = "--" + boundary + "\r\n"
+                     "Content-Disposition: form-data; name=\"model\"\r\n\r\n"
+                     "whisper-1\r\n"
+                     "--" + boundary + "\r\n"
+                     "Content-Disposition: form-data; name=\"file\"; filename=\"audio.wav\"\r\n"
+                     "Content-Type: audio/wav\r\n\r\n";
+        if (!writeChunk((const uint8_t*)head.c_str(), head.length())) {
+            return false;
+        }
+
+        // The real length is unknown until the player stops talking
+        if (STT_UPLOAD_ADPCM) {
+            uint8_t adpcm_header[ADPCM_WAV_HEADER_SIZE];
+            buildAdpcmWavHeader(adpcm_header, MIC_SAMPLE_RATE, 0xFFFFFFFF, 0xFFFFFFFF);
+            encoder.reset();
+            return writeChunk(adpcm_header, sizeof(adpcm_header));
+        }
+        byte wav_header[44];
+        buildWavHeader(wav_header, 0xFFFFFFFF);
+        return writeChunk(wav_header, sizeof(wav_header));
+    }
+
+    bool isStreaming() {
+        return streaming;
+    }
+
+    // Function to give up on the upload part way, so finish() fails and the
+    // recording is sent from its SD copy instead
+    void abort() {
+        if (!streaming) {
+            return;
+        }
+        Serial.println("Streaming upload abandoned.");
+        streaming = false;
+        client->stop();
+    }
+
+    // Function to send a block of samples as soon as it has been captured;
+    // compressed, they go out a whole ADPCM block at a time
+    bool write(const uint8_t* data, size_t length) {
+        if (!streaming) {
+            return false;
+        }
+        if (STT_UPLOAD_ADPCM) {
+            if (length > CAPTURE_RING_MAX_WRITE) {
+                return write(data, CAPTURE_RING_MAX_WRITE) &&
+                       write(data + CAPTURE_RING_MAX_WRITE, length - CAPTURE_RING_MAX_WRITE);
+            }
+            size_t count = encoder.encode((const int16_t*)data, length / MIC_BYTES_PER_SAMPLE, encoded);
+            return count == 0 || writeChunk(encoded, count);
+        }
+        return writeChunk(data, length);
+    }
+
+    // Function to close the multipart body once the recording has stopped
+    bool finish() {
+        if (!streaming) {
+            return false;
+        }
+
+        if (STT_UPLOAD_ADPCM) {
+            size_t count = encoder.finish(encoded);
+            if (count > 0 && !writeChunk(encoded, count)) {
+                return false;
+            }
+        }
+
+        String tail = "\r\n--" + boundary + "--\r\n";
+        if (!writeChunk((const uint8_t*)tail.c_str(), tail.length())) {
+            return false;
+        }
+        if (client->write((const uint8_t*)"0\r\n\r\n", 5) != 5) {
+            Serial.println("Streaming upload failed!");
+            streaming = false;
+            client->stop();
+            return false;
+        }
+        Serial.printf("Streamed %u bytes to the STT API\n", (unsigned int)bytesSent);
+        return true;
+    }
+
+    // Function to wait for the API's reply; returns the JSON body or "" on failure
+    String readResponse() {
+        if (!streaming) {
+            return "";
+        }
+
+        String body;
+        int statusCode = readHttpResponse(client, body, 30000);
+        streaming = false;
+        lastUsed = millis();
+
+        if (statusCode != 200) {
+            Serial.printf("Received unexpected HTTP response code: %d\n", statusCode);
+            client->stop();
+            return "";
+        }
+        return body;
+    }
+};
+
+#define TTS_MODEL "tts-1"
+#define TTS_VOICE "nova"
+
+// Function to request speech for text and write the MP3 to output; label names it in traces
+bool downloadSpeechText(const String& textContent, Stream* output, const char* label) {
+    TraceScope trace("tts", label);
+
+    // Borrow a kept-alive connection to the API
+    PooledConnection* connection = acquireConnection(OPENAI_API);
+    HTTPClient& https = connection->http;
+    bool saved = false;
+
+    if (https.begin(connection->client, tts_api_url)) {
         https.addHeader("Authorization", String("Bearer ") + tts_api_key);
         https.addHeader("Content-Type", "application/json");
 
-        String payload = "{\"model\":\"tts-1\",\"voice\":\"nova\",\"input\":\"" + textContent + "\"}";
+        JsonDocument payloadDoc;
+        payloadDoc["model"] = TTS_MODEL;
+        payloadDoc["voice"] = TTS_VOICE;
+        payloadDoc["input"] = textContent; // Escapes any quotes in the text
+        String payload;
+        serializeJson(payloadDoc, payload);
+
+        int httpResponseCode = https.POST(payload);
+
+        if (httpResponseCode > 0) {
+            if (httpResponseCode == HTTP_CODE_OK) {
+                int received = https.writeToStream(output);
+                trace.addBytes(payload.length(), received > 0 ? received : 0);
+                if (received > 0) {
+                    saved = true;
+                } else {
+                    Serial.println("Error writing to audio file.");
+                }
+            } else {
+                Serial.printf("Received unexpected HTTP response code: %d\n", httpResponseCode);
+            }
+        } else {
+            Serial.printf("Error on HTTP request: %s\n", https.errorToString(httpResponseCode).c_str());
+        }
+        https.end(); // Ensures cleanup after handling the response
+    } else {
+        Serial.println("Failed to begin HTTPS connection");
+        https.end(); // Cleanup if connection initiation fails
+    }
+    releaseConnection(connection);
+    return saved;
+}
+
+// Speech cache: synthesised phrases are kept on the SD card, keyed by a hash
+// of the model, the voice and the text, so a phrase spoken before plays
+// straight from the card without a request. Only phrases the caller marks as
+// recurring are cached (such as the fixed lead-in of every story prompt at a
+// venue), up to TTS_CACHE_MAX_TEXT long; one-off text such as feedback would
+// only push those out. The least recently played are evicted to keep the
+// cache under its caps. The index is saved after every
+// TTS_CACHE_SAVE_EVERY new phrases and at the end of each game.
+#define TTS_CACHE_DIR "/ttscache"
+#define TTS_CACHE_INDEX "/ttscache/index.bin"
+#define TTS_CACHE_MAX_TEXT 160 // characters
+#define TTS_CACHE_MAX_ENTRIES 64
+#define TTS_CACHE_MAX_BYTES (4UL * 1024 * 1024)
+#define TTS_CACHE_SAVE_EVERY 8 // new phrases between index saves
+
+// Writes everything to an output and a copy on the SD card
+class SpeechTee : public Stream {
+private:
+    Stream* output;
+    File& copy;
+
+public:
+    SpeechTee(Stream* _output, File& _copy) : output(_output), copy(_copy) {}
+
+    size_t write(const uint8_t* data, size_t length) override {
+        size_t written = output->write(data, length);
+        copy.write(data, written);
+        return written;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override { output->flush(); }
+};
+
+class SpeechCache {
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t size;     // bytes of MP3
+        uint32_t lastUsed; // value of clock when last played
+    };
+
+    Entry entries[TTS_CACHE_MAX_ENTRIES];
+    int count;
+    uint32_t totalBytes;
+    uint32_t clock;
+    uint32_t hits;
+    uint32_t misses;
+    bool dirty; // the index on SD is out of date
+    int unsaved; // phrases added since the index was last saved
+    uint32_t downloads; // names each download's temporary file
+    SemaphoreHandle_t lock;
+
+    // Function to hash the request: model, voice and the text with its spacing normalised (FNV-1a)
+    static uint64_t keyFor(const String& text) {
+        uint64_t hash = 14695981039346656037ULL;
+        const char* parts[] = {TTS_MODEL, TTS_VOICE};
+        for (const char* part : parts) {
+            for (const char* c = part; *c; c++) {
+                hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+            }
+            hash = (hash ^ 0) * 1099511628211ULL;
+        }
+        bool space = false;
+        bool started = false;
+        for (unsigned int i = 0; i < text.length(); i++) {
+            char c = text[i];
+            if (isspace((unsigned char)c)) {
+                space = started;
+                continue;
+            }
+            if (space) {
+                hash = (hash ^ ' ') * 1099511628211ULL;
+                space = false;
+            }
+            hash = (hash ^ (uint8_t)c) * 1099511628211ULL;
+            started = true;
+        }
+        return hash;
+    }
+
+    static void entryPath(uint64_t key, const char* extension, char* path, size_t size) {
+        snprintf(path, size, TTS_CACHE_DIR "/%08lx%08lx.%s",
+                 (unsigned long)(key >> 32), (unsigned long)(key & 0xFFFFFFFF), extension);
+    }
+
+    // Function to find a key's entry; -1 if it is not cached (call with lock held)
+    int find(uint64_t key) {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].key == key) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Function to drop an entry and its file (call with lock held)
+    void remove(int index) {
+        char path[40];
+        entryPath(entries[index].key, "mp3", path, sizeof(path));
+        SD.remove(path);
+        totalBytes -= entries[index].size;
+        entries[index] = entries[--count];
+        dirty = true;
+    }
+
+    // Function to make room for size more bytes by evicting the least recently played (call with lock held)
+    void makeRoom(uint32_t size) {
+        while (count > 0 && (count >= TTS_CACHE_MAX_ENTRIES || totalBytes + size > TTS_CACHE_MAX_BYTES)) {
+            int oldest = 0;
+            for (int i = 1; i < count; i++) {
+                if (entries[i].lastUsed < entries[oldest].lastUsed) {
+                    oldest = i;
+                }
+            }
+            remove(oldest);
+        }
+    }
+
+public:
+    SpeechCache() : count(0), totalBytes(0), clock(0), hits(0), misses(0), dirty(false), unsaved(0), downloads(0), lock(NULL) {}
+
+    // Function to load the index; entries whose file has gone are dropped
+    void begin() {
+        lock = xSemaphoreCreateMutex();
+        if (!SD.exists(TTS_CACHE_DIR)) {
+            SD.mkdir(TTS_CACHE_DIR);
+        }
+
+        uint8_t buffer[sizeof(entries) + sizeof(count) + 1]; // sdReadInto adds a NUL
+        int length = sdReadInto(SD, TTS_CACHE_INDEX, (char*)buffer, sizeof(buffer));
+        if (length < (int)sizeof(count)) {
+            return;
+        }
+        int stored;
+        memcpy(&stored, buffer, sizeof(stored));
+        if (stored < 0 || stored > TTS_CACHE_MAX_ENTRIES || length != (int)(sizeof(count) + stored * sizeof(Entry))) {
+            Serial.println("Speech cache index is damaged, starting afresh.");
+            return;
+        }
+        for (int i = 0; i < stored; i++) {
+            Entry entry;
+            memcpy(&entry, buffer + sizeof(count) + i * sizeof(Entry), sizeof(Entry));
+            char path[40];
+            entryPath(entry.key, "mp3", path, sizeof(path));
+            if (!SD.exists(path)) {
+                dirty = true;
+                continue;
+            }
+            entries[count++] = entry;
+            totalBytes += entry.size;
+            if (entry.lastUsed > clock) {
+                clock = entry.lastUsed;
+            }
+        }
+        Serial.printf("Speech cache: %d phrases, %lu KB\n", count, (unsigned long)(totalBytes / 1024));
+    }
+
+    // Function to tell whether speech for text is worth caching
+    bool cacheable(const String& text) {
+        return lock != NULL && text.length() <= TTS_CACHE_MAX_TEXT;
+    }
+
+    // Function to play cached speech for text to output; false if it is not cached
+    bool play(const String& text, Stream* output) {
+        if (!cacheable(text)) {
+            return false;
+        }
+        uint64_t key = keyFor(text);
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int index = find(key);
+        if (index < 0) {
+            misses++;
+            xSemaphoreGive(lock);
+            return false;
+        }
+        entries[index].lastUsed = ++clock; // The most recently played is the last to be evicted
+        hits++;
+        dirty = true;
+        xSemaphoreGive(lock);
+
+        // Copied outside the lock, so other phrases can be looked up meanwhile
+        char path[40];
+        entryPath(key, "mp3", path, sizeof(path));
+        TraceScope trace("tts cache", TTS_CACHE_DIR);
+        long copied = sdCopyToStream(SD, path, *output);
+        if (copied < 0) {
+            Serial.println("Cached speech has gone missing.");
+            xSemaphoreTake(lock, portMAX_DELAY);
+            index = find(key);
+            if (index >= 0) {
+                remove(index);
+            }
+            hits--;
+            misses++;
+            xSemaphoreGive(lock);
+            return false;
+        }
+        trace.addBytes(0, copied);
+        return true;
+    }
+
+    // Function to synthesise text to output, keeping a copy in the cache if it is cacheable
+    bool synthesise(const String& text, Stream* output, const char* label) {
+        if (!cacheable(text)) {
+            return downloadSpeechText(text, output, label);
+        }
+
+        uint64_t key = keyFor(text);
+        // Named per download, as the same phrase may be synthesised by two tasks at once
+        xSemaphoreTake(lock, portMAX_DELAY);
+        uint32_t download = downloads++;
+        xSemaphoreGive(lock);
+        char temporary[40];
+        snprintf(temporary, sizeof(temporary), TTS_CACHE_DIR "/%lu.tmp", (unsigned long)download);
+        File copy = SD.open(temporary, FILE_WRITE);
+        if (!copy) {
+            return downloadSpeechText(text, output, label);
+        }
+        SpeechTee tee(output, copy);
+        bool saved = downloadSpeechText(text, &tee, label);
+        uint32_t size = copy.size();
+        copy.close();
+        if (!saved || size == 0) {
+            SD.remove(temporary);
+            return saved;
+        }
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int index = find(key);
+        if (index >= 0) {
+            remove(index); // Synthesised twice at once; keep the newer copy
+        }
+        makeRoom(size);
+        char path[40];
+        entryPath(key, "mp3", path, sizeof(path));
+        if (SD.exists(path)) {
+            SD.remove(path); // Left by a power cut before the index was saved
+        }
+        if (SD.rename(temporary, path)) {
+            entries[count].key = key;
+            entries[count].size = size;
+            entries[count].lastUsed = ++clock;
+            count++;
+            totalBytes += size;
+            dirty = true;
+            unsaved++;
+        } else {
+            SD.remove(temporary);
+        }
+        bool saveNow = unsaved >= TTS_CACHE_SAVE_EVERY;
+        xSemaphoreGive(lock);
+        if (saveNow) {
+            save();
+        }
+        return true;
+    }
+
+    // Function to write the index to the SD card if it has changed
+    void save() {
+        if (lock == NULL) {
+            return;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (dirty) {
+            uint8_t buffer[sizeof(entries) + sizeof(count)];
+            memcpy(buffer, &count, sizeof(count));
+            memcpy(buffer + sizeof(count), entries, count * sizeof(Entry));
+            if (sdWrite(SD, TTS_CACHE_INDEX, buffer, sizeof(count) + count * sizeof(Entry))) {
+                dirty = false;
+                unsaved = 0;
+            }
+        }
+        xSemaphoreGive(lock);
+    }
+
+    // Function to report hits and misses since start-up
+    void printStats() {
+        Serial.printf("Speech cache: %lu hits, %lu misses, %d phrases, %lu KB\n", (unsigned long)hits,
+                      (unsigned long)misses, count, (unsigned long)(totalBytes / 1024));
+    }
+};
+
+SpeechCache speechCache;
+
+// Function to get speech for text from the API; a recurring phrase is played
+// from the cache if it is there, and cached if not. label names it in traces
+bool fetchSpeechText(const String& text, Stream* output, const char* label, bool recurring = false) {
+    if (!recurring) {
+        return downloadSpeechText(text, output, label);
+    }
+    if (speechCache.play(text, output)) {
+        return true;
+    }
+    return speechCache.synthesise(text, output, label);
+}
+
+// Chunked speech: a text is split at sentence boundaries and the chunks are
+// synthesised by TTS_PARALLEL_REQUESTS tasks at once, each over its own pooled
+// connection. The first chunk is a single sentence so the first audio arrives
+// quickly. A chunk that is next in line when its request starts is written
+// straight to the output; the others are saved to SD as they finish and copied
+// to the output strictly in order, so the MP3 frames arrive back to back and
+// the decoder plays the chunks as one gapless stream.
+
+#define TTS_CHUNK_CHARS 240 // sentences after the first are grouped up to this length
+#define TTS_MAX_CHUNKS 8    // chunks synthesised ahead of the output
+#define TTS_TASK_CORE 0
+#define TTS_TASK_PRIORITY 1
+#define TTS_TASK_STACK_SIZE 16384 // TLS handshake plus HTTPClient
+
+class ChunkedSpeech {
+private:
+    Stream* output;
+    const char* label;
+    void (*onFinished)(Stream* output); // called once all audio is written, NULL for none
+    uint32_t id; // names the chunk files
+
+    String chunkText[TTS_MAX_CHUNKS];
+    volatile bool chunkDone[TTS_MAX_CHUNKS];
+    bool chunkSaved[TTS_MAX_CHUNKS]; // synthesised into the chunk file
+    bool chunkRecurring[TTS_MAX_CHUNKS]; // worth keeping in the speech cache
+
+    volatile int chunkCount; // chunks added
+    int nextChunk;           // next chunk to synthesise
+    volatile int nextEmit;   // next chunk to write to the output
+    bool closed;             // no more text is coming
+    bool detached;           // the last task deletes the object
+    bool failed;
+    int workers;             // tasks still running
+
+    SemaphoreHandle_t lock;        // guards the counters
+    SemaphoreHandle_t emitLock;    // held by the task writing to the output
+    SemaphoreHandle_t workAvailable;
+    SemaphoreHandle_t finished;
+
+    ChunkedSpeech(Stream* _output, const char* _label, void (*_onFinished)(Stream*), uint32_t _id)
+        : output(_output), label(_label), onFinished(_onFinished), id(_id), chunkCount(0),
+          nextChunk(0), nextEmit(0), closed(false), detached(false), failed(false), workers(0) {
+        lock = xSemaphoreCreateMutex();
+        emitLock = xSemaphoreCreateMutex();
+        workAvailable = xSemaphoreCreateCounting(TTS_MAX_CHUNKS + TTS_PARALLEL_REQUESTS, 0);
+        finished = xSemaphoreCreateBinary();
+    }
+
+    ~ChunkedSpeech() {
+        vSemaphoreDelete(lock);
+        vSemaphoreDelete(emitLock);
+        vSemaphoreDelete(workAvailable);
+        vSemaphoreDelete(finished);
+    }
+
+    // Function to name the SD file a chunk is saved to
+    void chunkPath(int index, char* path, size_t size) {
+        snprintf(path, size, "/tts_%lu_%d.mp3", (unsigned long)id, index % TTS_MAX_CHUNKS);
+    }
+
+    // Function to copy a saved chunk to the output and delete it
+    void copyChunk(int index) {
+        char path[24];
+        chunkPath(index, path, sizeof(path));
+        if (sdCopyToStream(SD, path, *output) < 0) { // Stops early if playback was abandoned
+            Serial.println("Failed to open speech chunk.");
+            return;
+        }
+        SD.remove(path);
+    }
+
+    // Function to write every finished chunk that is next in line to the output;
+    // if another task is writing it will pick them up instead
+    void emitReady(bool holdingEmitLock) {
+        do {
+            if (!holdingEmitLock && xSemaphoreTake(emitLock, 0) != pdTRUE) {
+                return;
+            }
+            holdingEmitLock = false;
+            while (nextEmit < chunkCount && chunkDone[nextEmit % TTS_MAX_CHUNKS]) {
+                if (chunkSaved[nextEmit % TTS_MAX_CHUNKS]) {
+                    copyChunk(nextEmit);
+                }
+                nextEmit = nextEmit + 1;
+            }
+            xSemaphoreGive(emitLock);
+            // Check again in case a chunk finished just before the lock was released
+        } while (nextEmit < chunkCount && chunkDone[nextEmit % TTS_MAX_CHUNKS]);
+    }
+
+    // Function to synthesise one chunk, straight to the output if it is next in line
+    void synthesise(int index) {
+        int slot = index % TTS_MAX_CHUNKS;
+        bool direct = index == nextEmit && xSemaphoreTake(emitLock, 0) == pdTRUE;
+        bool saved = false;
+
+        if (direct) {
+            saved = fetchSpeechText(chunkText[slot], output, label, chunkRecurring[slot]);
+        } else {
+            char path[24];
+            chunkPath(index, path, sizeof(path));
+            File file = SD.open(path, FILE_WRITE);
+            if (file) {
+                saved = fetchSpeechText(chunkText[slot], &file, label, chunkRecurring[slot]);
+                file.close();
+            } else {
+                Serial.println("Failed to create speech chunk.");
+            }
+            chunkSaved[slot] = saved;
+        }
+        if (!saved) {
+            failed = true;
+        }
+
+        chunkText[slot] = "";
+        chunkDone[slot] = true;
+        if (direct) {
+            nextEmit = nextEmit + 1;
+        }
+        emitReady(direct);
+    }
 
-        int httpResponseCode = https.POST(payload);
+    // Function run by each task: synthesise chunks until the text is closed and none are left
+    void work() {
+        while (true) {
+            xSemaphoreTake(lock, portMAX_DELAY);
+            if (nextChunk < chunkCount) {
+                int index = nextChunk++;
+                xSemaphoreGive(lock);
+                synthesise(index);
+                continue;
+            }
+            bool done = closed;
+            xSemaphoreGive(lock);
+            if (done) {
+                break;
+            }
+            xSemaphoreTake(workAvailable, portMAX_DELAY);
+        }
 
-        if (httpResponseCode > 0) {
-            if (httpResponseCode == HTTP_CODE_OK) {
-                File audioFile = SD.open(filePath, FILE_WRITE);
-                if (audioFile) {
-                    if (https.writeToStream(&audioFile) > 0) {
-                        audioFile.close();
-                        Serial.println("Audio saved to " + String(filePath));
-                    } else {
-                        Serial.println("Error writing to audio file.");
-                    }
-                } else {
-                    Serial.println("Failed to create audio file.");
-                }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool last = --workers == 0;
+        bool cleanUp = last && detached;
+        xSemaphoreGive(lock);
+        if (last) {
+            if (onFinished != NULL) {
+                onFinished(output);
+            }
+            if (cleanUp) {
+                delete this;
             } else {
-                Serial.printf("Received unexpected HTTP response code: %d\n", httpResponseCode);
+                xSemaphoreGive(finished);
+            }
+        }
+    }
+
+    static void workerTask(void* parameter) {
+        ((ChunkedSpeech*)parameter)->work();
+        vTaskDelete(NULL);
+    }
+
+    // Function to mark the end of the text and wake every task to notice it
+    void close(bool detach) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        closed = true;
+        detached = detach;
+        xSemaphoreGive(lock);
+        for (int i = 0; i < TTS_PARALLEL_REQUESTS; i++) {
+            xSemaphoreGive(workAvailable);
+        }
+    }
+
+public:
+    // Function to start the synthesis tasks for speech written to output;
+    // returns NULL if none could be started
+    static ChunkedSpeech* start(Stream* output, const char* label, void (*onFinished)(Stream*) = NULL) {
+        static uint32_t runs = 0;
+        ChunkedSpeech* speech = new ChunkedSpeech(output, label, onFinished, runs++);
+        if (speech->lock == NULL || speech->emitLock == NULL ||
+            speech->workAvailable == NULL || speech->finished == NULL) {
+            Serial.println("Failed to set up speech synthesis!");
+            delete speech;
+            return NULL;
+        }
+
+        // Count the tasks before any can finish
+        speech->workers = TTS_PARALLEL_REQUESTS;
+        for (int i = 0; i < TTS_PARALLEL_REQUESTS; i++) {
+            if (xTaskCreatePinnedToCore(workerTask, "tts", TTS_TASK_STACK_SIZE, speech,
+                                        TTS_TASK_PRIORITY, NULL, TTS_TASK_CORE) != pdPASS) {
+                Serial.println("Failed to start speech synthesis task!");
+                speech->workers -= TTS_PARALLEL_REQUESTS - i;
+                break;
             }
+        }
+        if (speech->workers == 0) {
+            delete speech;
+            return NULL;
+        }
+        return speech;
+    }
+
+    // Function to queue one chunk of text, waiting while too many are ahead of the output;
+    // a recurring chunk is served from and kept in the speech cache
+    void add(const String& text, bool recurring = false) {
+        while (chunkCount - nextEmit >= TTS_MAX_CHUNKS) {
+            delay(20);
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int slot = chunkCount % TTS_MAX_CHUNKS;
+        chunkText[slot] = text;
+        chunkSaved[slot] = false;
+        chunkRecurring[slot] = recurring;
+        chunkDone[slot] = false;
+        chunkCount = chunkCount + 1;
+        xSemaphoreGive(lock);
+        xSemaphoreGive(workAvailable);
+    }
+
+    // Function to split text into chunks: the first sentence on its own, then
+    // sentences grouped up to TTS_CHUNK_CHARS. A run-on sentence longer than
+    // that is broken at the last space that fits. If fixedLeadIn, the text up
+    // to its first colon is a lead-in that recurs, and is chunked on its own
+    void addText(const String& text, bool fixedLeadIn = false) {
+        int colon = fixedLeadIn ? text.indexOf(':') : -1;
+        if (colon > 0) {
+            addSentences(text.substring(0, colon + 1), true);
+            addSentences(text.substring(colon + 1), false);
         } else {
-            Serial.printf("Error on HTTP request: %s\n", https.errorToString(httpResponseCode).c_str());
+            addSentences(text, false);
         }
-        https.end(); // Ensures cleanup after handling the response
-    } else {
-        Serial.println("Failed to begin HTTPS connection");
-        https.end(); // Cleanup if connection initiation fails
     }
+
+    // Function to chunk text as addText describes
+    void addSentences(const String& text, bool recurring) {
+        String chunk;
+        int start = 0;
+        while (start < (int)text.length()) {
+            int end = findSentenceEnd(text.substring(start));
+            if (end < 0) {
+                end = text.length() - start;
+            }
+            if (end > TTS_CHUNK_CHARS) {
+                int space = text.lastIndexOf(' ', start + TTS_CHUNK_CHARS);
+                if (space > start) {
+                    end = space - start;
+                }
+            }
+            String sentence = text.substring(start, start + end);
+            sentence.trim();
+            start += end;
+            if (sentence.length() == 0) {
+                continue;
+            }
+
+            if (chunk.length() > 0 && chunk.length() + sentence.length() >= TTS_CHUNK_CHARS) {
+                add(chunk, recurring);
+                chunk = "";
+            }
+            if (chunk.length() > 0) {
+                chunk += " ";
+            }
+            chunk += sentence;
+            if (chunkCount == 0) {
+                add(chunk, recurring);
+                chunk = "";
+            }
+        }
+        if (chunk.length() > 0) {
+            add(chunk, recurring);
+        }
+    }
+
+    // Function to end the text and wait until all of it is written to the output;
+    // deletes the object and returns false if any chunk failed
+    bool finish() {
+        close(false);
+        xSemaphoreTake(finished, portMAX_DELAY);
+        bool saved = !failed && chunkCount > 0;
+        delete this;
+        return saved;
+    }
+
+    // Function to end the text without waiting; the object deletes itself once
+    // all of it is written, so it must not be used after this
+    void detach() {
+        close(true);
+    }
+};
+
+// Function to synthesise text to output, sentences in parallel; label names it in traces
+bool synthesiseSpeech(const String& text, Stream* output, const char* label, bool fixedLeadIn = false) {
+    ChunkedSpeech* speech = ChunkedSpeech::start(output, label);
+    if (speech == NULL) {
+        return fetchSpeechText(text, output, label); // One request from this task
+    }
+    speech->addText(text, fixedLeadIn);
+    return speech->finish();
 }
 
+// Function to convert Text to Speech (TTS); false if no speech was saved.
+// fixedLeadIn marks text that opens with a recurring lead-in (see ChunkedSpeech::addText)
+bool convertTextToSpeech(const char* textPath, const char* filePath, bool fixedLeadIn = false) {
+    Serial.println("Commencing conversion of text to speech.");
+
+    String textContent = gameContext.get(textPath);
+    if (textContent.length() == 0) {
+        return false;
+    }
+    File audioFile = SD.open(filePath, FILE_WRITE);
+    if (!audioFile) {
+        Serial.println("Failed to create audio file.");
+        return false;
+    }
+    bool saved = synthesiseSpeech(textContent, &audioFile, filePath, fixedLeadIn);
+    audioFile.close();
+    if (saved) {
+        Serial.println("Audio saved to " + String(filePath));
+    }
+    return saved;
+}
 
 // Internal function to upload audio file for the Speech to Text (STT) feature
 String uploadAudioFile(const char* filename) {
+    TraceScope trace("stt upload", filename);
     File file = SD.open(filename);
     if (!file) {
         Serial.println("Failed to open audio file!");
         return "";
     }
     
+    // The header's length leaves out silence that was trimmed after it was written
     size_t fileSize = file.size();
+    uint8_t wav_header[44];
+    if (file.read(wav_header, sizeof(wav_header)) == sizeof(wav_header)) {
+        uint32_t dataSize = wav_header[40] | (wav_header[41] << 8) | (wav_header[42] << 16) | ((uint32_t)wav_header[43] << 24);
+        if (dataSize + sizeof(wav_header) < fileSize) {
+            fileSize = dataSize + sizeof(wav_header);
+        }
+    }
     file.close();
     
     Serial.printf("Audio file size: %d bytes\n", fileSize);
     
-    // Skip certificate verification
-    client.setInsecure();
-    client.setTimeout(30);  // Timeout specified in seconds
-    
     Serial.println("Connecting to OpenAI API...");
-    if (!client.connect("api.openai.com", 443)) {
+    PooledConnection* connection = acquireConnection(OPENAI_API);
+    WiFiClientSecure* client = &connection->client;
+    if (!client->connected()) {
         Serial.println("Connection failed!");
+        releaseConnection(connection);
         return "";
     }
     Serial.println("Connected to API endpoint");
     
     String boundary = "Boundary" + String(random(0xFFFF), HEX);
-    ChunkedUploader uploader(&client, boundary);
+    ChunkedUploader uploader(client, boundary);
     
     if (!uploader.begin(filename, fileSize)) {
-        client.stop();
+        client->stop();
+        releaseConnection(connection);
         return "";
     }
     
@@ -728,22 +2679,13 @@ String uploadAudioFile(const char* filename) {
     Serial.println("Upload complete, waiting for response...");
     
     String response = uploader.readResponse();
-    client.stop();
-    
-    int jsonStart = response.indexOf("\r\n\r\n") + 4;
-    return response.substring(jsonStart);
+    releaseConnection(connection);
+    trace.addBytes(fileSize, response.length());
+    return response;
 }
 
-// Function to store converted Speech to Text
-void convertSpeechToText(const char *inputFile, const char *outputFile) {  
-    Serial.println("Starting speech to text conversion.");
-    
-    String response = uploadAudioFile(inputFile);
-    if (response.length() == 0) {
-        Serial.println("Failed to get response from OpenAI STT API.");
-        return;
-    }
-    
+// Function to store the transcript from a Whisper API response
+bool saveTranscription(const String& response, const char *outputFile) {
     DynamicJsonDocument doc(2048);
     DeserializationError error = deserializeJson(doc, response);
     
@@ -752,140 +2694,310 @@ void convertSpeechToText(const char *inputFile, const char *outputFile) {
         Serial.println(error.c_str());
         Serial.println("Raw response:");
         Serial.println(response);
-        return;
+        return false;
     }
     
     const char* transcription = doc["text"];
     if (transcription) {
-        File file = SD.open(outputFile, FILE_WRITE);
-        if (!file) {
-            Serial.println("Failed to open output file!");
-            return;
+        if (!gameContext.put(outputFile, transcription)) {
+            Serial.println("Failed to save transcription!");
+            return false;
         }
-        
-        file.print(transcription);
-        file.close();
         Serial.println("Transcription saved successfully!");
         Serial.println("Transcribed text:");
         Serial.println(transcription);
+        return true;
     } else {
         Serial.println("No transcription in response!");
         Serial.println("Raw response:");
         Serial.println(response);
+        return false;
     }
 }
 
-String generateStory(const char* fullStoryPath, const char* storyOnlyPath, String location) {
-    // Use "university" as default location if empty
+// Function to store converted Speech to Text
+void convertSpeechToText(const char *inputFile, const char *outputFile) {  
+    Serial.println("Starting speech to text conversion.");
+    
+    String response = uploadAudioFile(inputFile);
+    if (response.length() == 0) {
+        Serial.println("Failed to get response from OpenAI STT API.");
+        return;
+    }
+    
+    saveTranscription(response, outputFile);
+}
+
+// Function to name the place a story is set: "university" stands in when the location is not known
+String storyLocation(String location) {
     if (location.isEmpty() || location.equals("Unknown Location")) {
-        location = "university";
-        Serial.println("Using default location: university");
+        return "university";
     }
+    return location;
+}
 
-    // Create the complete URL
-    String url = String(gemini_url) + "?key=" + String(gemini_api_key);
-    
-    Serial.println("Connecting to Gemini API...");
-    
-    if (!http_client.begin(url)) {
-        Serial.println("Connection to API failed!");
-        http_client.end(); // Frees resources before returning
-        return "Error: Failed to connect to API";
+// Function to ask Gemini for a base story prompt set at location; label names it in logs and traces
+bool requestStory(const String& location, const char* label, String& fullStory) {
+    // Create the prompt with proper escaping
+    String prompt = "I want you to generate a very short story prompt (in less than thirty words) "
+                   "that can be used as the base of a story that children can build on. "
+                   "I will provide a location/address, so the story has to be built around that. "
+                   "You have to start like this: \"Hmmm... Seems that we are at " + location + 
+                   ". Let me create a plot around this: \", and continue with a short story prompt. "
+                   "We are in Australia, so it has to be Australia-centric.";
+
+    GeminiRequest request(prompt, label);
+    request.setMaxOutputTokens(STORY_MAX_TOKENS).setTemperature(STORY_TEMPERATURE);
+    return gemini.generate(request, fullStory);
+}
+
+// Function to save a base story prompt to the game context, with and without its introduction
+void saveStory(const char* fullStoryPath, const char* storyOnlyPath, const String& fullStory) {
+    // Process the story text
+    int colonPos = fullStory.indexOf(':');
+    String storyOnly = "";
+    if (colonPos != -1) {
+        storyOnly = fullStory.substring(colonPos + 1);
+        storyOnly.trim();
+    } else {
+        storyOnly = fullStory; // Fallback if no colon found
     }
 
-    try {
-        // Set headers
-        http_client.addHeader("Content-Type", "application/json");
+    // Save to the game context with error handling
+    if (!gameContext.put(fullStoryPath, fullStory)) {
+        Serial.println("Warning: Failed to save full story");
+    }
 
-        // Create the prompt with proper escaping
-        String prompt = "I want you to generate a very short story prompt (in less than thirty words) "
-                       "that can be used as the base of a story that children can build on. "
-                       "I will provide a location/address, so the story has to be built around that. "
-                       "You have to start like this: \"Hmmm... Seems that we are at " + location + 
-                       ". Let me create a plot around this: \", and continue with a short story prompt. "
-                       "We are in Australia, so it has to be Australia-centric.";
-
-        // Build request JSON
-        StaticJsonDocument<2048> requestDoc;
-        JsonArray contents = requestDoc.createNestedArray("contents");
-        JsonObject content = contents.createNestedObject();
-        JsonArray parts = content.createNestedArray("parts");
-        JsonObject part = parts.createNestedObject();
-        part["text"] = prompt;
-
-        // Serialize with proper buffer
-        String requestBody;
-        serializeJson(requestDoc, requestBody);
+    if (!gameContext.put(storyOnlyPath, storyOnly)) {
+        Serial.println("Warning: Failed to save story-only version");
+    }
+}
 
-        Serial.println("Sending request...");
+// Function to generate the base story prompt around the device's location
+String generateStory(const char* fullStoryPath, const char* storyOnlyPath, String location) {
+    if (!location.equals(storyLocation(location))) {
+        location = storyLocation(location);
+        Serial.println("Using default location: " + location);
+    }
 
-        // Make the request
-        int httpCode = http_client.POST(requestBody);
+    String fullStory;
+    if (!requestStory(location, fullStoryPath, fullStory)) {
+        return "";
+    }
+    saveStory(fullStoryPath, storyOnlyPath, fullStory);
+    return fullStory;
+}
 
-        if (httpCode != 200) {
-            String error = http_client.getString();
-            Serial.printf("HTTP error %d: %s\n", httpCode, error.c_str());
-            http_client.end(); // Frees resources before returning
-            return "Error: HTTP " + String(httpCode) + " - " + error;
-        }
+// Prompt pool: base story prompts are generated and synthesised ahead of time
+// by a background task and kept on the SD card, so a game can announce its
+// prompt as soon as it knows where it is. Each slot is a text file, holding
+// the location on its first line and the prompt after it, and the prompt's
+// MP3; a slot is ready once its text file exists, which is written last. The
+// pool is refilled during the winner announcement and the idle time between
+// games, and the task stops refilling once a game's turns begin. A game whose
+// location has no ready prompt generates one live, as before.
+#define PROMPT_POOL_DIR "/prompts"
+#define PROMPT_POOL_SIZE 3
+#define PROMPT_POOL_TASK_CORE 0
+#define PROMPT_POOL_TASK_PRIORITY 1
+#define PROMPT_POOL_TASK_STACK_SIZE 16384 // TLS handshake plus HTTPClient
+
+class PromptPool {
+private:
+    bool ready[PROMPT_POOL_SIZE];
+    String locations[PROMPT_POOL_SIZE];
+    String location; // where the prompts being generated are set
+    volatile bool paused;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t refillWanted;
+
+    static void slotPath(int slot, const char* extension, char* path, size_t size) {
+        snprintf(path, size, PROMPT_POOL_DIR "/slot%d.%s", slot, extension);
+    }
 
-        // Get and parse response
-        String response = http_client.getString();
-        
-        StaticJsonDocument<4096> responseDoc;
-        DeserializationError error = deserializeJson(responseDoc, response);
-        
-        if (error) {
-            Serial.printf("JSON parsing failed: %s\n", error.c_str());
-            http_client.end(); // Frees resources before returning
-            return "Error: JSON parsing failed - " + String(error.c_str());
+    // Function to choose the next slot to fill: an empty one, then one set
+    // elsewhere; -1 if every slot is ready for the current location
+    int nextSlot(String& target) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        target = location;
+        int slot = -1;
+        if (!target.isEmpty()) {
+            for (int i = 0; i < PROMPT_POOL_SIZE && slot < 0; i++) {
+                if (!ready[i]) {
+                    slot = i;
+                }
+            }
+            for (int i = 0; i < PROMPT_POOL_SIZE && slot < 0; i++) {
+                if (!locations[i].equals(target)) {
+                    slot = i;
+                }
+            }
+            if (slot >= 0) {
+                ready[slot] = false; // Not to be taken while it is rewritten
+            }
         }
+        xSemaphoreGive(lock);
+        return slot;
+    }
+
+    // Function to generate and synthesise one prompt into a slot
+    bool fill(int slot, const String& target) {
+        char textPath[32];
+        char audioPath[32];
+        slotPath(slot, "txt", textPath, sizeof(textPath));
+        slotPath(slot, "mp3", audioPath, sizeof(audioPath));
+        SD.remove(textPath);
 
-        // Extract story with better error handling
         String fullStory;
-        if (responseDoc.containsKey("candidates") && 
-            responseDoc["candidates"][0].containsKey("content") &&
-            responseDoc["candidates"][0]["content"].containsKey("parts") &&
-            responseDoc["candidates"][0]["content"]["parts"][0].containsKey("text")) {
-            
-            fullStory = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
-        } else {
-            Serial.println("Invalid response structure");
-            http_client.end(); // Frees resources before returning
-            return "Error: Invalid API response structure";
+        if (!requestStory(target, "prompt pool", fullStory) || fullStory.length() == 0) {
+            return false;
+        }
+        File audioFile = SD.open(audioPath, FILE_WRITE);
+        if (!audioFile) {
+            return false;
+        }
+        bool saved = synthesiseSpeech(fullStory, &audioFile, "prompt pool", true); // The lead-in is cached
+        audioFile.close();
+        if (!saved || !sdWrite(SD, textPath, target + "\n" + fullStory)) {
+            SD.remove(audioPath);
+            return false;
         }
 
-        // Process the story text
-        int colonPos = fullStory.indexOf(':');
-        String storyOnly = "";
-        if (colonPos != -1) {
-            storyOnly = fullStory.substring(colonPos + 1);
-            storyOnly.trim();
-        } else {
-            storyOnly = fullStory; // Fallback if no colon found
+        xSemaphoreTake(lock, portMAX_DELAY);
+        ready[slot] = true;
+        locations[slot] = target;
+        xSemaphoreGive(lock);
+        Serial.printf("Prompt pool: slot %d ready for %s\n", slot, target.c_str());
+        return true;
+    }
+
+    // Task that fills the pool whenever a refill is asked for
+    static void refillTask(void* parameter) {
+        PromptPool* pool = (PromptPool*)parameter;
+        for (;;) {
+            xSemaphoreTake(pool->refillWanted, portMAX_DELAY);
+            String target;
+            int slot;
+            while (!pool->paused && (slot = pool->nextSlot(target)) >= 0) {
+                if (!pool->fill(slot, target)) {
+                    Serial.println("Prompt pool: refill failed, trying again later.");
+                    break;
+                }
+            }
         }
+    }
 
-        // Save to SD card with error handling
-        if (!writeResponseToSD(fullStory, fullStoryPath)) {
-            Serial.println("Warning: Failed to save full story to SD");
+public:
+    PromptPool() : paused(false), lock(NULL), refillWanted(NULL) {
+        for (int i = 0; i < PROMPT_POOL_SIZE; i++) {
+            ready[i] = false;
         }
+    }
 
-        if (!writeResponseToSD(storyOnly, storyOnlyPath)) {
-            Serial.println("Warning: Failed to save story-only version to SD");
+    // Function to find the prompts left from earlier games and start the refill task
+    void begin() {
+        if (!SD.exists(PROMPT_POOL_DIR)) {
+            SD.mkdir(PROMPT_POOL_DIR);
         }
+        int readyCount = 0;
+        for (int i = 0; i < PROMPT_POOL_SIZE; i++) {
+            char textPath[32];
+            char audioPath[32];
+            slotPath(i, "txt", textPath, sizeof(textPath));
+            slotPath(i, "mp3", audioPath, sizeof(audioPath));
+            String text;
+            if (!SD.exists(audioPath) || !sdReadText(SD, textPath, text)) {
+                continue;
+            }
+            int newline = text.indexOf('\n');
+            if (newline <= 0) {
+                continue;
+            }
+            ready[i] = true;
+            locations[i] = text.substring(0, newline);
+            location = locations[i]; // The unit has most likely not moved
+            readyCount++;
+        }
+        Serial.printf("Prompt pool: %d ready\n", readyCount);
+
+        lock = xSemaphoreCreateMutex();
+        refillWanted = xSemaphoreCreateBinary();
+        if (lock == NULL || refillWanted == NULL ||
+            xTaskCreatePinnedToCore(refillTask, "promptPool", PROMPT_POOL_TASK_STACK_SIZE, this,
+                                    PROMPT_POOL_TASK_PRIORITY, NULL, PROMPT_POOL_TASK_CORE) != pdPASS) {
+            Serial.println("Failed to start prompt pool task!");
+            lock = NULL;
+            return;
+        }
+        refill(); // Use the idle time before the first game
+    }
 
-        return fullStory;
-        
-    } catch (const std::exception& e) {
-        Serial.printf("Exception caught: %s\n", e.what());
-        return "Error: Exception occurred - " + String(e.what());
+    // Function to set where the prompts generated from now on are set
+    void setLocation(const String& where) {
+        if (lock == NULL) {
+            return;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        location = where;
+        xSemaphoreGive(lock);
     }
-    
-    // Ensure cleanup
-    http_client.end();
-}
 
-HTTPClient http;
+    // Function to start refilling the pool in the background
+    void refill() {
+        if (lock == NULL) {
+            return;
+        }
+        paused = false;
+        xSemaphoreGive(refillWanted);
+    }
+
+    // Function to stop refilling once the prompt being generated is done, leaving the network to the game
+    void pause() {
+        paused = true;
+    }
+
+    // Function to take a ready prompt set at where, moving its speech to audioPath;
+    // false if there is none
+    bool take(const String& where, String& fullStory, const char* audioPath) {
+        if (lock == NULL) {
+            return false;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int slot = -1;
+        for (int i = 0; i < PROMPT_POOL_SIZE && slot < 0; i++) {
+            if (ready[i] && locations[i].equals(where)) {
+                slot = i;
+            }
+        }
+        if (slot >= 0) {
+            ready[slot] = false;
+        }
+        xSemaphoreGive(lock);
+        if (slot < 0) {
+            return false;
+        }
+
+        char textPath[32];
+        char slotAudioPath[32];
+        slotPath(slot, "txt", textPath, sizeof(textPath));
+        slotPath(slot, "mp3", slotAudioPath, sizeof(slotAudioPath));
+        String text;
+        bool taken = sdReadText(SD, textPath, text);
+        SD.remove(textPath);
+        if (taken) {
+            fullStory = text.substring(text.indexOf('\n') + 1);
+            SD.remove(audioPath);
+            taken = SD.rename(slotAudioPath, audioPath);
+        }
+        if (!taken) {
+            Serial.println("Prompt pool: slot could not be read, generating live.");
+        }
+        return taken;
+    }
+};
+
+PromptPool promptPool;
+
 StaticJsonDocument<4096> doc;
 
 String createReverseGeocodeUrl(float latitude, float longitude) {
@@ -895,21 +3007,27 @@ String createReverseGeocodeUrl(float latitude, float longitude) {
 }
 
 bool makeHttpRequest(const String& url) {
+    TraceScope trace("geocode");
     if(!WiFi.isConnected()) {
         Serial.println("Error: WiFi not connected");
         return false;
     }
 
-    http.begin(url);
+    PooledConnection* connection = acquireConnection(MAPS_API);
+    HTTPClient& http = connection->http;
+    http.begin(connection->client, url);
     int httpCode = http.GET();
     
     if (httpCode != HTTP_CODE_OK) {
         http.end();
+        releaseConnection(connection);
         return false;
     }
     
     String payload = http.getString();
     http.end();
+    releaseConnection(connection);
+    trace.addBytes(url.length(), payload.length());
     
     doc.clear();
     DeserializationError error = deserializeJson(doc, payload);
@@ -925,114 +3043,346 @@ bool makeHttpRequest(const String& url) {
     return true;
 }
 
-float convertToDecimalDegrees(String coord, String direction) {
-  // Extract degrees and minutes from the coordinate string
-  double rawCoord = coord.toDouble();
-  int degrees = (int)(rawCoord / 100);
-  double minutes = rawCoord - (degrees * 100);
+// GPS: a task drains the receiver's UART as the bytes arrive and feeds them
+// to NmeaParser, publishing every fix it reports. Finding the device's
+// position is then a copy of the latest fix rather than a scrape of whatever
+// happens to be in the serial buffer.
+#define GPS_TASK_CORE 0
+#define GPS_TASK_PRIORITY 2 // above the network tasks, so the UART buffer never overflows
+#define GPS_TASK_STACK_SIZE 2048
+#define GPS_POLL_MS 20 // about 20 bytes arrive in this time at 9600 baud
+#define GPS_FIX_WAIT_MS 15000 // how long the prompt preparation waits for a first fix
+
+NmeaParser gpsParser; // touched only by the GPS task
+GpsFix gpsFix = {};   // latest fix, guarded by gpsMux
+uint32_t gpsFixTime = 0; // millis() when gpsFix was reported
+portMUX_TYPE gpsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Task that parses the GPS receiver's sentences as they arrive
+void gpsTask(void* parameter) {
+    for (;;) {
+        if (GPS.available() <= 0) {
+            vTaskDelay(pdMS_TO_TICKS(GPS_POLL_MS));
+            continue;
+        }
+        while (GPS.available() > 0) {
+            if (gpsParser.feed(GPS.read())) {
+                portENTER_CRITICAL(&gpsMux);
+                gpsFix = gpsParser.fix();
+                gpsFixTime = millis();
+                portEXIT_CRITICAL(&gpsMux);
+            }
+        }
+    }
+}
+
+// Function to start the GPS task
+bool startGpsTask() {
+    if (xTaskCreatePinnedToCore(gpsTask, "gps", GPS_TASK_STACK_SIZE, NULL,
+                                GPS_TASK_PRIORITY, NULL, GPS_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start GPS task!");
+        return false;
+    }
+    return true;
+}
+
+// Function to get the latest GPS fix, waiting up to waitMs for the first one;
+// false (and 0, 0) if the receiver has not reported a fix
+bool getGPSFix(float& latitude, float& longitude, uint32_t waitMs) {
+    uint32_t waitStart = millis();
+    for (;;) {
+        portENTER_CRITICAL(&gpsMux);
+        GpsFix fix = gpsFix;
+        uint32_t fixTime = gpsFixTime;
+        portEXIT_CRITICAL(&gpsMux);
+
+        if (fix.valid) {
+            latitude = fix.latitude;
+            longitude = fix.longitude;
+            Serial.printf("GPS fix %.6f, %.6f (HDOP %.1f, %d satellites, %lu ms old)\n", latitude, longitude,
+                          fix.hdop, fix.satellites, (unsigned long)(millis() - fixTime));
+            return true;
+        }
+        if (millis() - waitStart >= waitMs) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-  // Convert to decimal degrees
-  float decimalDegrees = degrees + (minutes / 60);
+    latitude = 0;
+    longitude = 0;
+    Serial.println("No GPS fix yet.");
+    return false;
+}
 
-  // Adjust sign based on direction (S/W should be negative)
-  if (direction == "S" || direction == "W") {
-    decimalDegrees = -decimalDegrees;
-  }
-  
-  return decimalDegrees;
+// Function to ask the Google Maps API for the name/address of a location. Returns
+// false if the request failed; name is left empty if Google knows no place there
+bool fetchPlaceName(float latitude, float longitude, String& name) {
+    String reverseGeocodeUrl = createReverseGeocodeUrl(latitude, longitude);
+    name = "";
+
+    if (!makeHttpRequest(reverseGeocodeUrl)) {
+        return false;
+    }
+
+    JsonArray results = doc["results"];
+    if (!results.isNull() && results.size() > 0) {
+        // Try to get the name from the first result
+        const char* placeName = results[0]["name"];
+        if (placeName) {
+            name = String(placeName);
+            return true;
+        }
+        
+        // If no name, try to get the first line of the formatted address
+        const char* address = results[0]["formatted_address"];
+        if (address) {
+            String fullAddress = String(address);
+            int commaPos = fullAddress.indexOf(',');
+            name = commaPos > 0 ? fullAddress.substring(0, commaPos) : fullAddress;
+        }
+    }
+    return true;
 }
 
-float getGPSData(String dataType) {
-  String nmeaData = "";
-  String lat, latDir, lon, lonDir;
+// Geocode cache. A unit spends the day at one venue, so the place name for its
+// position is kept on the SD card, keyed by a cell of the lat/lon grid about
+// 200 m across. A fresh entry saves the TLS handshake and JSON parse of the
+// geocode request; a stale one is still used, and refreshed in the background
+#define GEOCODE_CACHE_FILE "/geocache.txt" // one "latCell,lonCell,fetchedAt,name" line per entry
+#define GEOCODE_CACHE_MAX_ENTRIES 8
+#define GEOCODE_CELL_DEGREES 0.002
+#define GEOCODE_CACHE_TTL_S (24UL * 60 * 60)
+#define GEOCODE_CLOCK_VALID 1600000000UL // earlier times mean SNTP has not set the clock yet
+#define GEOCODE_TASK_CORE 0
+#define GEOCODE_TASK_PRIORITY 1
+#define GEOCODE_TASK_STACK_SIZE 16384 // TLS handshake plus HTTPClient
+
+class GeocodeCache {
+private:
+    struct Entry {
+        int32_t latCell;
+        int32_t lonCell;
+        uint32_t fetchedAt; // seconds since 1970; 0 if the clock was not set
+        String name;
+    };
+
+    Entry entries[GEOCODE_CACHE_MAX_ENTRIES];
+    int count;
+    SemaphoreHandle_t lock;      // guards the entries and the file
+    SemaphoreHandle_t fetchLock; // makeHttpRequest parses into the shared doc
+    volatile bool refreshing;
+    float refreshLatitude;
+    float refreshLongitude;
+
+    static int32_t cellOf(float degrees) {
+        return (int32_t)floor(degrees / GEOCODE_CELL_DEGREES);
+    }
+
+    static uint32_t now() {
+        time_t seconds = time(NULL);
+        return (uint32_t)seconds >= GEOCODE_CLOCK_VALID ? (uint32_t)seconds : 0;
+    }
+
+    // Function to find a cell's entry; -1 if it is not cached (call with lock held)
+    int find(int32_t latCell, int32_t lonCell) {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].latCell == latCell && entries[i].lonCell == lonCell) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Function to write every entry back to the SD card (call with lock held)
+    void save() {
+        String text;
+        for (int i = 0; i < count; i++) {
+            text += String(entries[i].latCell) + "," + String(entries[i].lonCell) + "," +
+                    String((unsigned long)entries[i].fetchedAt) + "," + entries[i].name + "\n";
+        }
+        if (!sdWrite(SD, GEOCODE_CACHE_FILE, text)) {
+            Serial.println("Warning: Failed to save geocode cache");
+        }
+    }
+
+    // Function to fetch a place name, one request at a time
+    bool fetch(float latitude, float longitude, String& name) {
+        if (fetchLock != NULL) {
+            xSemaphoreTake(fetchLock, portMAX_DELAY);
+        }
+        bool fetched = fetchPlaceName(latitude, longitude, name);
+        if (fetchLock != NULL) {
+            xSemaphoreGive(fetchLock);
+        }
+        return fetched;
+    }
 
-  // Read one line of NMEA data
-  while (GPS.available() > 0) {
-    char c = GPS.read();
-    if (c == '\n') {
-      break;  // End of line
+    // Task that refetches a stale entry while the game carries on
+    static void refreshTask(void* parameter) {
+        GeocodeCache* cache = (GeocodeCache*)parameter;
+        String name;
+        if (cache->fetch(cache->refreshLatitude, cache->refreshLongitude, name) && name.length() > 0) {
+            cache->store(cache->refreshLatitude, cache->refreshLongitude, name);
+            Serial.println("Geocode cache refreshed: " + name);
+        }
+        cache->refreshing = false;
+        vTaskDelete(NULL);
+    }
+
+    // Function to start refreshing a location in the background, unless a refresh is under way
+    void refresh(float latitude, float longitude) {
+        if (refreshing) {
+            return;
+        }
+        refreshing = true;
+        refreshLatitude = latitude;
+        refreshLongitude = longitude;
+        if (xTaskCreatePinnedToCore(refreshTask, "geocode", GEOCODE_TASK_STACK_SIZE, this,
+                                    GEOCODE_TASK_PRIORITY, NULL, GEOCODE_TASK_CORE) != pdPASS) {
+            Serial.println("Failed to start geocode refresh task!");
+            refreshing = false;
+        }
+    }
+
+public:
+    GeocodeCache() : count(0), lock(NULL), fetchLock(NULL), refreshing(false),
+                     refreshLatitude(0), refreshLongitude(0) {}
+
+    // Function to load the cached place names from the SD card
+    void begin() {
+        lock = xSemaphoreCreateMutex();
+        fetchLock = xSemaphoreCreateMutex();
+
+        String text;
+        if (!sdReadText(SD, GEOCODE_CACHE_FILE, text)) {
+            return;
+        }
+        int lineStart = 0;
+        while (lineStart < (int)text.length() && count < GEOCODE_CACHE_MAX_ENTRIES) {
+            int lineEnd = text.indexOf('\n', lineStart);
+            if (lineEnd < 0) {
+                lineEnd = text.length();
+            }
+            String line = text.substring(lineStart, lineEnd);
+            lineStart = lineEnd + 1;
+
+            int first = line.indexOf(',');
+            int second = first < 0 ? -1 : line.indexOf(',', first + 1);
+            int third = second < 0 ? -1 : line.indexOf(',', second + 1);
+            if (third < 0 || third + 1 >= (int)line.length()) {
+                continue; // Damaged line
+            }
+            Entry& entry = entries[count++];
+            entry.latCell = line.substring(0, first).toInt();
+            entry.lonCell = line.substring(first + 1, second).toInt();
+            entry.fetchedAt = strtoul(line.substring(second + 1, third).c_str(), NULL, 10);
+            entry.name = line.substring(third + 1);
+        }
+        Serial.printf("Geocode cache: %d places\n", count);
     }
-    nmeaData += c;
-  }
 
-  // Check if the line contains GPGGA or GPRMC sentence
-  if (nmeaData.startsWith("$GPGGA") || nmeaData.startsWith("$GPRMC")) {
-    // Split NMEA sentence by commas
-    int commaIndex = 0;
-    String nmeaFields[15];  // Array to store fields of NMEA sentence
-    int fieldIndex = 0;
+    // Function to find the place name for a location. A cached name is returned
+    // straight away, and refreshed in the background once it is older than the
+    // TTL (or its age is unknown because the clock has not been set); otherwise
+    // it is fetched now. Returns false if the request failed; name is left
+    // empty if Google knows no place there
+    bool lookup(float latitude, float longitude, String& name) {
+        int32_t latCell = cellOf(latitude);
+        int32_t lonCell = cellOf(longitude);
+        bool found = false;
+        bool stale = false;
+
+        if (lock != NULL) {
+            xSemaphoreTake(lock, portMAX_DELAY);
+            int index = find(latCell, lonCell);
+            if (index >= 0) {
+                uint32_t current = now();
+                name = entries[index].name;
+                found = true;
+                stale = current == 0 || entries[index].fetchedAt == 0 ||
+                        current - entries[index].fetchedAt > GEOCODE_CACHE_TTL_S;
+            }
+            xSemaphoreGive(lock);
+        }
 
-    while (fieldIndex < 15) {
-      commaIndex = nmeaData.indexOf(',', commaIndex + 1);
-      if (commaIndex == -1) break;
-      nmeaFields[fieldIndex++] = nmeaData.substring(commaIndex + 1, nmeaData.indexOf(',', commaIndex + 1));
-    }
+        if (found) {
+            Serial.println(stale ? "Geocode cache hit (stale, refreshing)." : "Geocode cache hit.");
+            if (stale) {
+                refresh(latitude, longitude);
+            }
+            return true;
+        }
 
-    // Extract latitude and longitude fields
-    lat = nmeaFields[1];
-    latDir = nmeaFields[2];
-    lon = nmeaFields[3];
-    lonDir = nmeaFields[4];
-  }
+        if (!fetch(latitude, longitude, name)) {
+            return false;
+        }
+        if (name.length() > 0) {
+            store(latitude, longitude, name); // Never cache a place Google does not know
+        }
+        return true;
+    }
 
-  // Return latitude or longitude as a float
-  if (dataType == "latitude") {
-    return convertToDecimalDegrees(lat, latDir);
-  } else if (dataType == "longitude") {
-    return convertToDecimalDegrees(lon, lonDir);
-  }
+    // Function to cache a location's place name, replacing the oldest entry when full
+    void store(float latitude, float longitude, const String& name) {
+        if (lock == NULL) {
+            return;
+        }
+        // The name ends its line in the file
+        String cleanName = name;
+        cleanName.replace("\r", " ");
+        cleanName.replace("\n", " ");
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int32_t latCell = cellOf(latitude);
+        int32_t lonCell = cellOf(longitude);
+        int index = find(latCell, lonCell);
+        if (index < 0) {
+            if (count < GEOCODE_CACHE_MAX_ENTRIES) {
+                index = count++;
+            } else {
+                index = 0;
+                for (int i = 1; i < count; i++) {
+                    if (entries[i].fetchedAt < entries[index].fetchedAt) {
+                        index = i;
+                    }
+                }
+            }
+        }
+        entries[index].latCell = latCell;
+        entries[index].lonCell = lonCell;
+        entries[index].fetchedAt = now();
+        entries[index].name = cleanName;
+        save();
+        xSemaphoreGive(lock);
+    }
+};
 
-  return 0.0;  // Return 0.0 if no valid data
-}
+GeocodeCache geocodeCache;
 
 // This function uses the Google Maps API to obtain the name/address of the current location by providing coordinates 
 String getPlaceName(float latitude, float longitude) {
-    String reverseGeocodeUrl = createReverseGeocodeUrl(latitude, longitude);
-    
-    if (!makeHttpRequest(reverseGeocodeUrl)) {
+    String name;
+    if (!geocodeCache.lookup(latitude, longitude, name)) {
         return "Unknown Location";
     }
-
-    JsonArray results = doc["results"];
-    if (!results.isNull() && results.size() > 0) {
-        // Try to get the name from the first result
-        const char* name = results[0]["name"];
-        if (name) {
-            return String(name);
-        }
-        
-        // If no name, try to get the first line of the formatted address
-        const char* address = results[0]["formatted_address"];
-        if (address) {
-            String fullAddress = String(address);
-            int commaPos = fullAddress.indexOf(',');
-            if (commaPos > 0) {
-                return fullAddress.substring(0, commaPos);
-            }
-            return fullAddress;
-        }
+    if (name.length() > 0) {
+        return name;
     }
-    
     return "Some unknown location"; // Returns this so as to ensure the generateStory function works regardless of whether the GPS has a lock or not
 }
 
+
 //------------------------------------------------------------------------------------------
 
 // Function to read the file and extract the rating from Gemini's evaluation
 int readRatingFromFeedback(const char* filename) {
-    // Open the feedback file on the SD card
-    File file = SD.open(filename);
-    if (!file) {
+    String content = gameContext.get(filename);
+    if (content.length() == 0) {
         Serial.println("Failed to open file!");
         return -1;
     }
 
-    String content = "";
-    while (file.available()) {
-        content += (char)file.read();
-    }
-    file.close();
-
     int position = content.indexOf(" out of 10");
     if (position == -1) {
         Serial.println("Rating pattern not found!");
@@ -1060,233 +3410,268 @@ int findHighestRatedPlayer() {
     int highestRating = -1; // Initialize the highest rating
     int highestPlayer = -1; // Initialize the highest player number
 
-    // Cycle through all player rating files from p1_rating to p8_rating
-    for (int player = 1; player <= 4; player++) {
-        String filename = String("/p") + player + "_rating.txt"; // Create filename for each player
-        File file = SD.open(filename.c_str()); // Open the corresponding file
-
-        if (!file) {
-            Serial.print("Failed to open file for player ");
-            Serial.println(player);
-            continue; // Skip to the next player if the file doesn't open
-        }
+    for (int player = 1; player <= PLAYER_COUNT; player++) {
+        int rating = gameContext.rating(player);
 
-        // Read the number from the file
-        if (file.available()) {
-            String content = file.readStringUntil('\n'); // Read the line
-            int rating = content.toInt(); // Convert the string content to an integer
-            
-            // Check if this rating is the highest
-            if (rating > highestRating) {
-                highestRating = rating; // Update highest rating
-                highestPlayer = player; // Update highest player number
-            }
+        // Check if this rating is the highest
+        if (rating > highestRating) {
+            highestRating = rating; // Update highest rating
+            highestPlayer = player; // Update highest player number
         }
-        
-        file.close(); // Close the file
     }
 
     return highestPlayer; // Return the player number with the highest rating
 }
 
-// Function to create files for score-keeping
-void createFileWithZero(const char* filename) {
-    // Open the file for writing (this will create the file if it doesn't exist)
-    File file = SD.open(filename, FILE_WRITE);
-    if (!file) {
-        Serial.println("Failed to create file!");
-        return; // Exit the function if file creation fails
-    }
-
-    // Write the value '0' to the file
-    file.println(0);
-    file.close(); // Close the file after writing
-
-    Serial.println("File created with value 0.");
-}
+//----------------------------------------------------------------------------------
 
-// Function to add to the continuing story
-void addContextToStory(const char* story_context, const char* transc_file) {
-    // Open the master story context file in append mode
-    File context = SD.open(story_context, FILE_APPEND);
-    if (!context) {
-        Serial.println("Failed to open destination file for appending!");
-        return;
-    }
+// Construct an audio object
+Audio audio;
 
-    // Open the source file in read mode
-    File contribution = SD.open(transc_file, FILE_READ);
-    if (!contribution) {
-        Serial.println("Failed to open source file for reading!");
-        context.close();  // Close destination file if source file fails to open
-        return;
-    }
+//---------------------------------------------------------------------------------------------
 
-    // Append the contents of the source file to the destination file
-    while (contribution.available()) {
-        context.write(contribution.read());  // Read from source and write to destination
-    }
+// Function to generate winner's feedback; the game session already holds the whole story
+String evaluateWinner(int playerNumber, const char* evaluation) {
+  String prompt =
+    String("All the players have spoken, and player ") + playerNumber + " has the highest total rating, so he/she is the winner. " +
+    "Instead of assessing a single contribution, assess player " + playerNumber + "'s contributions across the whole story, specify why he/she won on the basis " +
+    "of the aforesaid factors, and provide a short constructive feedback in text that can be spoken in not more than two minutes. Use encouraging words and be enthusiastic. " +
+    "Write everything in a single paragraph. Don't use any special characters. Give a small buildup before announcing the number of the player who won. No rating is needed this time. ";
 
-    // Close both files
-    contribution.close();
-    context.close();
-    Serial.println("Player contribution copied to master story file.");
-}
+  GeminiRequest request(prompt, evaluation);
+  request.setMaxOutputTokens(WINNER_MAX_TOKENS).setTemperature(WINNER_TEMPERATURE).setSession(&gameSession);
 
-// Function to store player's rating
-void addNumberToFile(int numberToAdd, const char* filePath) {
-  // Open the file in read mode to get the current number
-  File file = SD.open(filePath, FILE_READ);
-  
-  int currentNumber = 0; // Default to 0 if the file is empty or unreadable
-  if (file) {
-    String content = file.readString(); // Read the file contents
-    currentNumber = content.toInt(); // Convert the contents to an integer
-    file.close();
-  } else {
-    Serial.println("Failed to open file for reading!");
+  String feedback;
+  if (!gemini.generate(request, feedback)) {
+    return "";
   }
-
-  // Calculate the new total
-  int newTotal = currentNumber + numberToAdd;
-
-  // Open the file in write mode to overwrite with the new total
-  file = SD.open(filePath, FILE_WRITE);
-  if (file) {
-    file.print(newTotal); // Write the new total to the file
-    file.close();
-    Serial.print("New total written to file: ");
-    Serial.println(newTotal);
+  Serial.println("Feedback: " + feedback);
+  
+  // Keep the winner feedback in the game context, which saves it to the SD card
+  if (gameContext.put(evaluation, feedback)) {
+    Serial.println("Winner feedback saved: " + String(evaluation));
   } else {
-    Serial.println("Failed to open file for writing!");
+    Serial.println("Failed to save winner feedback");
   }
+  return evaluation;
 }
 
-//----------------------------------------------------------------------------------
-
-// Construct an audio object
-Audio audio;
-
-//---------------------------------------------------------------------------------------------
-
-// Function to generate winner's feedback
-String evaluateWinner(const char* base_prompt, const char* story_path, const char* player_contribution1, const char* player_contribution2, const char* evaluation, int playerNumber) {
+// Define LED pin to act as an indicator time remaining
+const int LED = 15;
 
-  // Read the base story prompt 
-  String baseprompt = readTextFromSD(base_prompt);
+// Audio capture: a high priority task does nothing but drain I2S into the
+// capture ring, so the DMA buffers are emptied on time however long the SD
+// card or the network takes. Each consumer of the live audio reads the ring
+// through its own cursor: the SD copy is written by its own task, and the
+// recording loop streams to the STT API and meters the level.
+#define CAPTURE_RING_SIZE 32768 // one second of audio, in internal RAM
+#define CAPTURE_BLOCK 1024 // samples per I2S read
+#define CAPTURE_TASK_CORE 1
+#define CAPTURE_TASK_PRIORITY 5 // above every other task that touches the audio
+#define CAPTURE_TASK_STACK_SIZE 4096
+#define ARCHIVE_WRITE_SIZE 4096
+#define ARCHIVE_PRIORITY 1
+#define ARCHIVE_STACK_SIZE 4096
+#define CONSUMER_POLL_MS 10 // a consumer with nothing to read waits this long
+
+// Voice activity detection runs on the capture stream. The SD writer and the
+// uploader only take the audio from just before the player starts speaking
+// to shortly after they stop. Until speech starts they stay TRIM_HOLDBACK
+// behind the capture and skip what falls out of it, so leading silence is
+// never stored or sent. Trailing silence is cut from the SD copy by its WAV
+// header; the uploader holds back TRIM_HOLDBACK after the last voiced frame
+// in case the player carries on, so at most that much is cut from the stream.
+#define VAD_END_OF_TURN 1 // end a turn once the player has finished speaking
+#define VAD_TRAILING_SILENCE_MS 2500 // quiet this long after speech ends the turn
+#define VAD_MIN_TURN_MS 5000 // never end a turn earlier than this
+#define VAD_PREROLL_MS 200 // audio kept before the detected start of speech
+#define TRIM_HOLDBACK (CAPTURE_RING_SIZE / 2) // bytes; half a second of margin stays for slow consumers
+
+CaptureRing captureRing;
+Inmp441Converter micConverter; // DC blocker and gain, used by the capture task only
+SemaphoreHandle_t captureDone = NULL;
+volatile bool captureStopping = false;
+i2s_port_t capturePort;
+
+// The part of the recording worth keeping, as capture ring positions
+struct SpeechWindow {
+    volatile bool started; // start is set
+    volatile bool final;   // end will not move again
+    volatile uint32_t start;
+    volatile uint32_t end;
+};
+SpeechWindow speechWindow;
+
+SemaphoreHandle_t archiveDone = NULL;
+File archiveFile;
+CaptureCursor archiveCursor;
+uint32_t archiveDataSize = 0;
+uint32_t archiveStart = 0; // ring position of the first byte written
+
+// Task that reads I2S, converts the samples to 16 bits and adds them to the ring
+void captureTask(void* parameter) {
+    int32_t samples_32[CAPTURE_BLOCK];
+    int16_t samples_16[CAPTURE_BLOCK];
+    size_t bytesRead = 0;
 
-  // Read the story that has been contributed so far
-  String storySoFar = readTextFromSD(story_path);
-  
-  // Read the contributions of the winning player (round 1)
-  String playerStory1 = readTextFromSD(player_contribution1);
+    while (!captureStopping) {
+        if (i2s_read(capturePort, samples_32, sizeof(samples_32), &bytesRead, pdMS_TO_TICKS(100)) == ESP_OK &&
+            bytesRead > 0) {
+            size_t count = micConverter.convert(samples_32, bytesRead / sizeof(int32_t), samples_16);
+            captureRing.write((const uint8_t*)samples_16, count * MIC_BYTES_PER_SAMPLE);
+        }
+    }
+    captureRing.close();
+    xSemaphoreGive(captureDone);
+    vTaskDelete(NULL);
+}
 
-  // Read the contributions of the winning player (round 2)
-  String playerStory2 = readTextFromSD(player_contribution2);
+// Function to start capturing from an installed and started I2S port
+bool startCapture(i2s_port_t port) {
+    if (captureDone == NULL) {
+        captureDone = xSemaphoreCreateBinary();
+    }
+    if (captureDone == NULL || !captureRing.begin(CAPTURE_RING_SIZE)) {
+        Serial.println("Failed to create capture buffer!");
+        return false;
+    }
+    captureRing.reset();
+    micConverter.reset();
+    micConverter.setGain(MIC_GAIN, MIC_AGC ? MIC_MAX_GAIN : 0);
+    capturePort = port;
+    captureStopping = false;
+    return true;
+}
 
-  String consolidatedStory = playerStory1 + playerStory2; 
+// Function to start the capture task once every consumer has attached
+bool runCapture() {
+    if (xTaskCreatePinnedToCore(captureTask, "capture", CAPTURE_TASK_STACK_SIZE, NULL,
+                                CAPTURE_TASK_PRIORITY, NULL, CAPTURE_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start capture task!");
+        captureRing.close();
+        return false;
+    }
+    return true;
+}
 
-  // Construct the complete URL with API key
-  String url = String(gemini_url) + "?key=" + String(gemini_api_key);
-  
-  Serial.println("Connecting to Gemini API...");
-  Serial.println("URL: " + url);
-  
-  if (!http_client.begin(url)) {
-    Serial.println("Connection to API failed!");
-    http_client.end(); // Frees resources before returning
-    return "";
-  }
+// Function to stop capturing; consumers then read what is left and finish
+void stopCapture() {
+    captureStopping = true;
+    xSemaphoreTake(captureDone, portMAX_DELAY);
+}
 
-  // Set the request headers
-  http_client.addHeader("Content-Type", "application/json");
+// Function to read a consumer's next bytes of the speech window; holdBack
+// keeps it TRIM_HOLDBACK behind the capture after the last voiced frame
+size_t readSpeech(CaptureCursor& cursor, uint8_t* data, size_t length, bool holdBack) {
+    uint32_t head = captureRing.written();
+    if (!speechWindow.started) {
+        captureRing.skipTo(cursor, head - TRIM_HOLDBACK); // Speech may yet start in what is kept
+        return 0;
+    }
+    captureRing.skipTo(cursor, speechWindow.start);
 
-  // Create a JSON document for the request
-  JsonDocument requestDoc;
-  
-    // Build the JSON structure
-requestDoc["contents"][0]["parts"][0]["text"] = 
-    requestDoc["contents"][0]["parts"][0]["text"] = 
-    String("We hosted a collaborative storytelling contest for children. It consists of four players. A base story prompt was given. ") +
-    "Players take turns to speak. For the sake of fairness, each player has to ensure that they leave sufficient room for others to continue the story from where they stop. " +
-    "We assess the players on the basis of how well they speak, their articulation, contribution to the plot, usage of filler words, creativity, imagination, the story snippet they contributed, and whether they left sufficient room for others to continue the story from where they stopped. " +
-    "This was the base prompt we gave to the players (generated by the host): \"" + baseprompt + "\". This is the collaborative story that was stitched by the players together from the base prompt: \"" + storySoFar + "\". " +
-    "And this is player " + String(playerNumber) + "'s contribution to the consolidated story (the winner, whom we chose): \"" + consolidatedStory + "\". Assess the winner player’s contribution to the story, specify why he/she won on the basis " +
-    "of the aforesaid factors, and provide a short constructive feedback in text that can be spoken in not more than two minutes. Use encouraging words and be enthusiastic. " +
-    "Write everything in a single paragraph. Don't use any special characters. Give a small buildup before announcing the number of the player who won. ";
+    uint32_t limit = speechWindow.end;
+    if (!speechWindow.final) {
+        limit = holdBack ? head - TRIM_HOLDBACK : head;
+        if ((int32_t)(speechWindow.end - limit) > 0) {
+            limit = speechWindow.end;
+        }
+    }
+    return captureRing.read(cursor, data, length, limit);
+}
 
+// Function to tell a consumer it has read the whole speech window
+bool speechFinished(CaptureCursor& cursor) {
+    return speechWindow.final && (int32_t)(cursor.position - speechWindow.end) >= 0;
+}
 
-  // Serialize the request
-  String requestBody;
-  serializeJson(requestDoc, requestBody);
+// Task that writes the SD copy of a recording from its cursor on the capture ring
+void recordingArchiveTask(void* parameter) {
+    uint8_t* block = (uint8_t*)malloc(ARCHIVE_WRITE_SIZE);
+    while (block != NULL && !speechFinished(archiveCursor)) {
+        size_t size = readSpeech(archiveCursor, block, ARCHIVE_WRITE_SIZE, false);
+        if (size > 0) {
+            if (archiveDataSize == 0) {
+                // readSpeech may have skipped ahead to the speech, so count back from where it stopped
+                archiveStart = archiveCursor.position - size;
+            }
+            archiveDataSize += sdWriteBlocks(archiveFile, block, size);
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(CONSUMER_POLL_MS));
+        }
+    }
+    free(block);
+    xSemaphoreGive(archiveDone);
+    vTaskDelete(NULL);
+}
 
-  // Debug print the request body
-  Serial.println("Sending request with body:");
-  Serial.println(requestBody);
+// Function to open the SD copy of a recording and start its writer task
+bool startRecordingArchive(const String& filePath) {
+    // Remove existing file if it exists
+    if (SD.exists(filePath)) {
+        SD.remove(filePath);
+    }
 
-  // Send the request
-  int httpCode = http_client.POST(requestBody);
+    // Open file for writing
+    archiveFile = SD.open(filePath, FILE_WRITE);
+    if (!archiveFile) {
+        Serial.println("Failed to open file for writing");
+        return false;
+    }
 
-  // Debug print the response code
-  Serial.print("HTTP Response code: ");
-  Serial.println(httpCode);
+    // Placeholder header, patched with the real length once recording stops
+    byte wav_header[44];
+    buildWavHeader(wav_header, 0);
+    archiveFile.write(wav_header, sizeof(wav_header));
 
-  if (httpCode != 200) {
-    String error = http_client.getString();
-    Serial.println("Error response:");
-    Serial.println(error);
-    http_client.end();
-    return "Error: HTTP " + String(httpCode) + " - " + error;
-  }
+    if (archiveDone == NULL) {
+        archiveDone = xSemaphoreCreateBinary();
+    }
+    if (archiveDone == NULL) {
+        Serial.println("Failed to create recording buffer!");
+        archiveFile.close();
+        return false;
+    }
 
-  // Get the response
-  String response = http_client.getString();
-  Serial.println("Raw response:");
-  Serial.println(response);
-  
-  // Parse the response
-  JsonDocument responseDoc;
-  DeserializationError error = deserializeJson(responseDoc, response);
-  
-  if (error) {
-    Serial.print("JSON parsing failed: ");
-    Serial.println(error.c_str());
-    http_client.end();
-    return "Error: JSON parsing failed - " + String(error.c_str());
-  }
+    archiveDataSize = 0;
+    archiveStart = 0;
+    captureRing.attach(archiveCursor);
+    if (xTaskCreatePinnedToCore(recordingArchiveTask, "recordingArchive", ARCHIVE_STACK_SIZE, NULL,
+                                ARCHIVE_PRIORITY, NULL, 1) != pdPASS) {
+        Serial.println("Failed to start recording writer task!");
+        archiveFile.close();
+        return false;
+    }
+    return true;
+}
 
-  // Extract the feedback text
-  String feedback;
-  if (responseDoc["candidates"][0]["content"]["parts"][0]["text"].is<const char*>()) {
-    feedback = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
-  } else {
-    Serial.println("Unexpected response format");
-    Serial.println(response);
-    feedback = "Error: Unable to parse response - unexpected format";
-  }
+// Function to wait for the writer to catch up and finalise the WAV header
+void finishRecordingArchive() {
+    xSemaphoreTake(archiveDone, portMAX_DELAY);
 
-  Serial.println("Feedback: " + feedback);
-  
-  // Write the winner feedback to a file on the SD card
-  if (writeResponseToSD(feedback, evaluation)) {
-    Serial.println("Winner feedback saved to SD card: " + String(evaluation));
-  } else {
-    Serial.println("Failed to save winner feedback to SD card");
-  }
+    // Silence written after the end of speech is left out of the length
+    uint32_t speechLength = speechWindow.end - archiveStart;
+    if (archiveDataSize > 0 && speechLength < archiveDataSize) {
+        archiveDataSize = speechLength;
+    }
+    byte wav_header[44];
+    buildWavHeader(wav_header, archiveDataSize);
+    archiveFile.seek(0);
+    archiveFile.write(wav_header, sizeof(wav_header));
+    archiveFile.close();
 
-  http_client.end();
-  return evaluation;
+    if (archiveCursor.dropped > 0) {
+        Serial.printf("SD copy dropped %u bytes\n", (unsigned int)archiveCursor.dropped);
+    }
 }
 
-// Define LED pin to act as an indicator time remaining
-const int LED = 15;
-
-// Function to store audio clip at the specified file path
-bool recordAudio(const String& filePath) {
+// Function to store audio clip at the specified file path, optionally
+// streaming it to the STT API at the same time; voicedSeconds (if given)
+// receives how long the player spoke for
+bool recordAudio(const String& filePath, StreamingUploader* uploader = NULL, float* voicedSeconds = NULL) {
     // Local configuration constants
-    const int I2S_SAMPLE_RATE = 16000;
-    const int BYTES_PER_SAMPLE = 2; // 16-bit samples
-    const int BUFFER_SIZE = 1024;
+    const int I2S_SAMPLE_RATE = MIC_SAMPLE_RATE;
+    const int BUFFER_SIZE = CAPTURE_BLOCK;
 
     // Initialize I2S and SD
     const i2s_port_t I2S_PORT = I2S_NUM_1;
@@ -1318,6 +3703,9 @@ bool recordAudio(const String& filePath) {
         .data_in_num = 17     // Data-in from mic
     };
 
+    // A streamed recording still goes to SD, so a stream that fails can be retried
+    bool streaming = uploader != NULL && uploader->isStreaming();
+
     // Uninstall existing driver if any
     i2s_driver_uninstall(I2S_PORT);
 
@@ -1346,626 +3734,1067 @@ bool recordAudio(const String& filePath) {
     // Start I2S
     i2s_start(I2S_PORT);
 
-    // Remove existing file if it exists
-    if (SD.exists(filePath)) {
-        SD.remove(filePath);
+    // Attach every consumer before the first samples arrive
+    CaptureCursor cursor;
+    CaptureCursor uploadCursor;
+    if (!startCapture(I2S_PORT)) {
+        i2s_stop(I2S_PORT);
+        i2s_driver_uninstall(I2S_PORT);
+        return false;
     }
-
-    // Open file for writing
-    File audioFile = SD.open(filePath, FILE_WRITE);
-    if (!audioFile) {
-        Serial.println("Failed to open file for writing");
+    speechWindow.started = false;
+    speechWindow.final = false;
+    captureRing.attach(cursor);
+    captureRing.attach(uploadCursor);
+    if (!startRecordingArchive(filePath)) {
         i2s_stop(I2S_PORT);
         i2s_driver_uninstall(I2S_PORT);
         return false;
     }
-
-    // Prepare WAV header
-    const int waveDataSize = I2S_SAMPLE_RATE * 30 * BYTES_PER_SAMPLE;
-    byte wav_header[44];
-
-    // RIFF chunk descriptor
-    wav_header[0] = 'R'; wav_header[1] = 'I'; wav_header[2] = 'F'; wav_header[3] = 'F';
-    int totalDataSize = waveDataSize + 36;
-    wav_header[4] = (byte)(totalDataSize & 0xFF);
-    wav_header[5] = (byte)((totalDataSize >> 8) & 0xFF);
-    wav_header[6] = (byte)((totalDataSize >> 16) & 0xFF);
-    wav_header[7] = (byte)((totalDataSize >> 24) & 0xFF);
-    wav_header[8] = 'W'; wav_header[9] = 'A'; wav_header[10] = 'V'; wav_header[11] = 'E';
-    wav_header[12] = 'f'; wav_header[13] = 'm'; wav_header[14] = 't'; wav_header[15] = ' ';
-    wav_header[16] = 16; wav_header[17] = 0; wav_header[18] = 0; wav_header[19] = 0;
-    wav_header[20] = 1; wav_header[21] = 0; // Audio format (PCM)
-    wav_header[22] = 1; wav_header[23] = 0; // Mono channel
-    wav_header[24] = (byte)(I2S_SAMPLE_RATE & 0xFF);
-    wav_header[25] = (byte)((I2S_SAMPLE_RATE >> 8) & 0xFF);
-    wav_header[26] = (byte)((I2S_SAMPLE_RATE >> 16) & 0xFF);
-    wav_header[27] = (byte)((I2S_SAMPLE_RATE >> 24) & 0xFF);
-    int byteRate = I2S_SAMPLE_RATE * 1 * BYTES_PER_SAMPLE;
-    wav_header[28] = (byte)(byteRate & 0xFF);
-    wav_header[29] = (byte)((byteRate >> 8) & 0xFF);
-    wav_header[30] = (byte)((byteRate >> 16) & 0xFF);
-    wav_header[31] = (byte)((byteRate >> 24) & 0xFF);
-    wav_header[32] = 1 * BYTES_PER_SAMPLE; // Block align
-    wav_header[33] = 0;
-    wav_header[34] = BYTES_PER_SAMPLE * 8; // Bits per sample
-    wav_header[35] = 0;
-    wav_header[36] = 'd'; wav_header[37] = 'a'; wav_header[38] = 't'; wav_header[39] = 'a';
-    wav_header[40] = (byte)(waveDataSize & 0xFF);
-    wav_header[41] = (byte)((waveDataSize >> 8) & 0xFF);
-    wav_header[42] = (byte)((waveDataSize >> 16) & 0xFF);
-    wav_header[43] = (byte)((waveDataSize >> 24) & 0xFF);
-
-    // Write WAV header
-    audioFile.write(wav_header, sizeof(wav_header));
-
-    // Allocate buffers
-    uint8_t* i2s_read_buff = (uint8_t*)calloc(BUFFER_SIZE * 4, sizeof(uint8_t));
-    int16_t* processed_samples = (int16_t*)calloc(BUFFER_SIZE, sizeof(int16_t));
-
-    if (!i2s_read_buff || !processed_samples) {
-        Serial.println("Failed to allocate buffers");
-        audioFile.close();
+    if (!runCapture()) {
+        speechWindow.final = true;
+        finishRecordingArchive();
         i2s_stop(I2S_PORT);
         i2s_driver_uninstall(I2S_PORT);
         return false;
     }
 
-    // Recording loop
+    // Recording loop: this task is the level meter, voice detector and uploader
     uint32_t startTime = millis();
     const uint32_t recordingDuration = 30 * 1000; // 30 seconds
-    size_t bytesRead = 0;
+    int16_t samples[CAPTURE_BLOCK];
+    int16_t peak = 0;
+    bool capturing = true;
+    VoiceActivityDetector vad;
 
     Serial.println("Recording started!");
-    while (millis() - startTime < 30 * 1000) {
-        if (i2s_read(I2S_PORT, i2s_read_buff, BUFFER_SIZE * 4, &bytesRead, portMAX_DELAY) == ESP_OK) {
-            if (bytesRead > 0) {
-                int32_t* samples_32 = (int32_t*)i2s_read_buff;
-                for (int i = 0; i < (bytesRead / 4); i++) { // Adjust based on sample size
-                    processed_samples[i] = samples_32[i] >> 16; // Convert to 16-bit
+    while (!captureRing.finished(cursor) || (streaming && !speechFinished(uploadCursor))) {
+        uint32_t elapsed = millis() - startTime;
+        bool finished = VAD_END_OF_TURN && vad.heardSpeech() && elapsed >= VAD_MIN_TURN_MS &&
+                        vad.silenceSamples() >= (uint32_t)VAD_TRAILING_SILENCE_MS * (MIC_SAMPLE_RATE / 1000);
+        if (capturing && (elapsed >= recordingDuration || finished)) {
+            stopCapture(); // The samples already in the ring are still read below
+            capturing = false;
+            Serial.println("Recording stopped.");
+        }
+
+        // Meter and detect speech in everything captured
+        size_t length = captureRing.read(cursor, (uint8_t*)samples, sizeof(samples));
+        if (length > 0) {
+            vad.process(samples, length / MIC_BYTES_PER_SAMPLE);
+            for (size_t i = 0; i < length / 2; i++) {
+                int16_t level = samples[i] < 0 ? -(samples[i] + 1) : samples[i];
+                if (level > peak) {
+                    peak = level;
                 }
-                audioFile.write((const uint8_t*)processed_samples, bytesRead / 2); // Write processed data
             }
         }
-        // Calculate LED brightness based on elapsed time
-        float remainingTimeRatio = 1.0 - float(millis() - startTime) / recordingDuration;
-        int brightness = int(remainingTimeRatio * 255); // Convert ratio to PWM (0-255)
-        ledcWrite(0, brightness); // Adjust LED brightness
-    }
+        if (vad.heardSpeech()) {
+            if (!speechWindow.started) {
+                uint32_t preroll = (uint32_t)VAD_PREROLL_MS * (MIC_SAMPLE_RATE / 1000);
+                uint32_t start = vad.speechStart() > preroll ? vad.speechStart() - preroll : 0;
+                speechWindow.start = start * MIC_BYTES_PER_SAMPLE;
+                speechWindow.started = true;
+            }
+            speechWindow.end = vad.speechEnd() * MIC_BYTES_PER_SAMPLE;
+        }
+
+        // Once everything has been through the detector, the window is settled
+        if (!speechWindow.final && captureRing.finished(cursor)) {
+            uint32_t head = captureRing.written();
+            if (!speechWindow.started) {
+                // No speech: send the tail, so the API still gets a valid (silent) recording
+                speechWindow.start = head - TRIM_HOLDBACK < head ? head - TRIM_HOLDBACK : 0;
+                speechWindow.started = true;
+                speechWindow.end = head;
+            } else if ((int32_t)(speechWindow.end - head) > 0) {
+                speechWindow.end = head;
+            }
+            speechWindow.final = true;
+        }
+
+        // Stream the speech window to the STT API
+        size_t uploadLength = 0;
+        if (streaming) {
+            uploadLength = readSpeech(uploadCursor, (uint8_t*)samples, sizeof(samples), true);
+            if (uploadCursor.dropped > 0 ||
+                (uploadLength > 0 && !uploader->write((const uint8_t*)samples, uploadLength))) {
+                // Upload failed or fell behind: finish() now fails, so the worker sends the SD copy
+                uploader->abort();
+                streaming = false;
+            }
+        }
 
-    Serial.println("Recording stopped.");
+        if (capturing) {
+            // Calculate LED brightness based on elapsed time
+            float remainingTimeRatio = 1.0 - float(millis() - startTime) / recordingDuration;
+            int brightness = int(remainingTimeRatio * 255); // Convert ratio to PWM (0-255)
+            ledcWrite(0, brightness); // Adjust LED brightness
+        }
+        if (length == 0 && uploadLength == 0) {
+            vTaskDelay(pdMS_TO_TICKS(CONSUMER_POLL_MS));
+        }
+    }
 
     ledcWrite(0, 0); // Adjust LED brightness
+    float voiced = (float)vad.voicedSamples() / MIC_SAMPLE_RATE;
+    Serial.printf("Recording peak level %d%%, %.1f s of speech\n", peak * 100 / 32767, voiced);
+    if (uploadCursor.dropped > 0) {
+        Serial.printf("Upload fell behind and dropped %u bytes\n", (unsigned int)uploadCursor.dropped);
+    }
+    if (voicedSeconds != NULL) {
+        *voicedSeconds = voiced;
+    }
 
     // Cleanup
-    free(i2s_read_buff);
-    free(processed_samples);
-    audioFile.close();
+    finishRecordingArchive();
 
     // Stop I2S and uninstall driver
     i2s_stop(I2S_PORT);
     i2s_driver_uninstall(I2S_PORT);
     
-    return true;
-}
-
-//------------------------------------------------------------------------
-
-// Function to delete all files at the end
-void deleteGameFiles() {
-    // List of all file paths created during the game
-    const char* filesToDelete[] = {
-        p1_response1, p1_response2, p2_response1, p2_response2,
-        p3_response1, p3_response2, p4_response1, p4_response2,
-        p1_trans1, p1_trans2, p2_trans1, p2_trans2,
-        p3_trans1, p3_trans2, p4_trans1, p4_trans2,
-        p1_eval1, p1_eval2, p2_eval1, p2_eval2,
-        p3_eval1, p3_eval2, p4_eval1, p4_eval2,
-        p1_feed1, p1_feed2, p2_feed1, p2_feed2,
-        p3_feed1, p3_feed2, p4_feed1, p4_feed2,
-        winner_feedback, winner_feedback_speech,
-        fullstoryTTS, base_story, storySoFar
-    };
-
-    // Loop through each file and delete it if it exists
-    for (int i = 0; i < sizeof(filesToDelete) / sizeof(filesToDelete[0]); i++) {
-        if (SD.exists(filesToDelete[i])) {
-            SD.remove(filesToDelete[i]);
-            Serial.print("Deleted file: ");
-            Serial.println(filesToDelete[i]);
-        } else {
-            Serial.print("File not found: ");
-            Serial.println(filesToDelete[i]);
-        }
-    }
-}
-
-void setup() {
-
-    // Set baud rate
-    Serial.begin(115200);
-    
-    Serial.println("Starting up..."); 
-
-    // Initiate WiFi connection
-    connectToWiFi(); 
-
-    // Initiate SPI connection to SD card
-    initSDCard(); 
-
-    GPS.begin(GPS_BAUD, SERIAL_8N1, GPS_RX, GPS_TX); // initialising the GPS with the following configuration: 9600 baud rate, serial protocol (8N1 kind)
-
-    while(!GPS); // wait for the GPS receiver to initialise
-    
-    Serial.println("Initialising I2S speaker setup");
-    // Initialise I2S speaker setup
-    audio.setPinout(I2S_BCLK, I2S_LRC, I2S_DOUT);
-    audio.setVolume(VOLUME);
-    Serial.println("I2S speaker setup complete!");
-
+    return true;
 }
 
-void loop() {
-  
-   // Check and create rating files if they don’t exist
-    if (!SD.exists(p1_rating)) createFileWithZero(p1_rating);
-    if (!SD.exists(p2_rating)) createFileWithZero(p2_rating);
-    if (!SD.exists(p3_rating)) createFileWithZero(p3_rating);
-    if (!SD.exists(p4_rating)) createFileWithZero(p4_rating);
-
-  // Introductory announcement playback
-  audio.connecttoFS(SD, "/introduction.mp3");
-  while (audio.isRunning()) {
+//------------------------------------------------------------------------
+
+// Function to play an audio clip from the SD card until it ends
+void playAudioFile(const char* filePath) {
+    TraceScope trace("playback", filePath);
+    audio.connecttoFS(SD, filePath);
+    while (audio.isRunning()) {
         audio.loop();  // Continue playback
         delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
     }
     audio.stopSong();
-    Serial.println("Introduction over!");
+}
 
-    delay(1000);
+//------------------------------------------------------------------------
 
-  // Instruction announcement playback
-  audio.connecttoFS(SD, "/rules.mp3");
-  while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-    audio.stopSong();
-    Serial.println("Rules have been narrated!");
+// Streaming speech playback: the speech is synthesised by tasks on core 0
+// into a ring buffer, and the decoder reads it through a file-like stream as
+// it arrives, so narration starts after a short prebuffer instead of after
+// the whole MP3 has been saved. The download can also be teed to SD.
 
-  // One second delay
-  delay(1000);
+#define SPEECH_RING_SIZE 32768 // about two seconds of tts-1 audio
+#define SPEECH_PREBUFFER 8192 // bytes buffered before playback starts
 
-  float latitude = getGPSData("latitude"); // Invoke the GPS function to obtain the latitude
-  float longitude = getGPSData("longitude"); // Invoke the GPS function to obtain the longitude
+RingbufHandle_t speechRing = NULL;
+SemaphoreHandle_t speechDownloadFinished = NULL;
+volatile bool speechDownloadDone = false;
+volatile bool speechPlaybackStopped = false;
+volatile size_t speechBytesReceived = 0;
 
-  // Obtain the name/address of the device's current location
-  String location = getPlaceName(latitude, longitude);
+// Sink for the HTTPS response body: fills the ring buffer and, optionally, the SD copy
+class SpeechRingStream : public Stream {
+private:
+    File archive;
 
- // Generate the story prompt
- generateStory(fullstoryTTS, base_story, location);
- // fullstoryTTS points to the file path of the prompt to be read aloud: we use this to generate the speech
- // base_story points to the file path of the base story: stores the base prompt
+public:
+    SpeechRingStream(const char* archivePath) {
+        if (archivePath != NULL) {
+            archive = SD.open(archivePath, FILE_WRITE);
+            if (!archive) {
+                Serial.println("Failed to create audio file.");
+            }
+        }
+    }
 
- const char* first_prompt="/first_prompt.mp3"; // points to the file path of the speech generated
- convertTextToSpeech(fullstoryTTS, first_prompt); // converts text to speech 
- 
- // Announce prompt
- audio.connecttoFS(SD, first_prompt); // tether to audio clip
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    ~SpeechRingStream() {
+        if (archive) {
+            archive.close();
+        }
     }
-    audio.stopSong();
- delay(2000);
 
-// Player 1 Round 1 
+    size_t write(const uint8_t* data, size_t length) override {
+        // Wait for the decoder to make room, unless playback has been abandoned
+        while (xRingbufferSend(speechRing, data, length, pdMS_TO_TICKS(100)) != pdTRUE) {
+            if (speechPlaybackStopped) {
+                return 0;
+            }
+        }
+        if (archive) {
+            archive.write(data, length);
+        }
+        speechBytesReceived += length;
+        return length;
+    }
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
     }
-    audio.stopSong();
-delay(500);
 
-//Record response of player 1
-recordAudio(p1_response1);
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+};
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// File handed to the decoder: reads block until data arrives and only report
+// end of file once the download has finished and the ring buffer is empty
+class SpeechStreamFile : public fs::FileImpl {
+private:
+    size_t readPosition;
+
+public:
+    SpeechStreamFile() : readPosition(0) {}
+
+    size_t read(uint8_t* buf, size_t size) override {
+        while (true) {
+            bool done = speechDownloadDone;
+            size_t received = 0;
+            uint8_t* data = (uint8_t*)xRingbufferReceiveUpTo(speechRing, &received, pdMS_TO_TICKS(20), size);
+            if (data != NULL) {
+                memcpy(buf, data, received);
+                vRingbufferReturnItem(speechRing, data);
+                readPosition += received;
+                return received;
+            }
+            if (done || speechPlaybackStopped) {
+                return 0;
+            }
+        }
     }
-    audio.stopSong();
-delay(500);
 
- // Convert player 1's speech to text
- convertSpeechToText(p1_response1, p1_trans1);
+    // The length is unknown until the download completes
+    size_t size() const override {
+        return speechDownloadDone ? speechBytesReceived : 0x7FFFFFFF;
+    }
+
+    size_t position() const override { return readPosition; }
+    bool seek(uint32_t pos, SeekMode mode) override { return mode == SeekSet && pos == readPosition; }
+    size_t write(const uint8_t* buf, size_t size) override { return 0; }
+    void flush() override {}
+    void close() override {}
+    time_t getLastWrite() override { return 0; }
+    const char* name() const override { return "/speech.mp3"; }
+    boolean isDirectory(void) override { return false; }
+    fs::FileImplPtr openNextFile(const char* mode) override { return NULL; }
+    void rewindDirectory(void) override {}
+    operator bool() override { return true; }
+};
+
+// File system exposing the speech currently being downloaded
+class SpeechStreamFS : public fs::FSImpl {
+public:
+    fs::FileImplPtr open(const char* path, const char* mode) override {
+        return fs::FileImplPtr(new SpeechStreamFile());
+    }
+    bool exists(const char* path) override { return true; }
+    bool rename(const char* pathFrom, const char* pathTo) override { return false; }
+    bool remove(const char* path) override { return false; }
+    bool mkdir(const char* path) override { return false; }
+    bool rmdir(const char* path) override { return false; }
+};
 
- // Evaluate player 1's response
- evaluateFContribution(base_story, p1_trans1, p1_eval1);
+fs::FS speechStream(fs::FSImplPtr(new SpeechStreamFS()));
 
- // Add player 1's contribution to the story context
- addContextToStory(storySoFar, p1_trans1);
+// Function to set up the speech stream for a new producer; false if there is no memory for it
+bool openSpeechStream() {
+    if (speechDownloadFinished == NULL) {
+        speechDownloadFinished = xSemaphoreCreateBinary();
+    }
+    speechRing = xRingbufferCreate(SPEECH_RING_SIZE, RINGBUF_TYPE_BYTEBUF);
+    if (speechRing == NULL || speechDownloadFinished == NULL) {
+        Serial.println("Failed to create speech buffer!");
+        return false;
+    }
+    speechDownloadDone = false;
+    speechPlaybackStopped = false;
+    speechBytesReceived = 0;
+    return true;
+}
 
- // Read and store player 1's rating to their rating file
- addNumberToFile(readRatingFromFeedback(p1_eval1), p1_rating);
+// Function for the producer to mark the end of the speech
+void finishSpeechStream() {
+    speechDownloadDone = true;
+    xSemaphoreGive(speechDownloadFinished);
+}
 
- // Convert player 1's feedback to speech
- convertTextToSpeech(p1_eval1, p1_feed1);
+// Function to play the speech stream as its producer fills it, then tear it down;
+// label names it in logs and traces; returns false if nothing played
+bool playSpeechStream(const char* label) {
+    uint32_t startTime = millis();
 
- audio.connecttoFS(SD, p1_feed1);
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    // Prebuffer so a slow start of the download does not stutter the first words
+    while (!speechDownloadDone && speechBytesReceived < SPEECH_PREBUFFER) {
+        delay(10);
+    }
+    traceRecord("speech prebuffer", label, startTime);
+
+    bool played = speechBytesReceived > 0;
+    if (played) {
+        Serial.printf("Speech playback starting after %lu ms\n", (unsigned long)(millis() - startTime));
+        uint32_t playbackStart = millis();
+        audio.connecttoFS(speechStream, "/speech.mp3");
+        while (audio.isRunning()) {
+            audio.loop();  // Continue playback
+            delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+        }
+        audio.stopSong();
+        traceRecord("playback", label, playbackStart);
+    } else {
+        Serial.println("Speech stream ended before any audio arrived.");
     }
-audio.stopSong();
- delay(3000);
 
-// Player 2 Round 1
+    // Release the producer if playback ended early, then wait for it
+    speechPlaybackStopped = true;
+    xSemaphoreTake(speechDownloadFinished, portMAX_DELAY);
+    vRingbufferDelete(speechRing);
+    speechRing = NULL;
+    return played;
+}
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function called by chunked speech once it has written everything to a SpeechRingStream
+void closeSpeechOutput(Stream* output) {
+    delete output; // Closes the SD copy
+    finishSpeechStream();
+}
+
+// Function to start synthesising into the speech stream, keeping a copy at
+// archivePath (NULL for none); returns NULL if it could not be started
+ChunkedSpeech* startSpeechStream(const char* archivePath, const char* label) {
+    if (!openSpeechStream()) {
+        return NULL;
+    }
+    SpeechRingStream* output = new SpeechRingStream(archivePath);
+    ChunkedSpeech* speech = ChunkedSpeech::start(output, label, closeSpeechOutput);
+    if (speech == NULL) {
+        delete output;
+        vRingbufferDelete(speechRing);
+        speechRing = NULL;
     }
-audio.stopSong();
-    delay(500);
+    return speech;
+}
 
-//Record response of player 2
-recordAudio(p2_response1);
+// Function to narrate a text file while its speech is still downloading,
+// keeping a copy at archivePath (NULL for none); returns false if nothing played
+bool playSpeechWhileDownloading(const char* textPath, const char* archivePath, bool fixedLeadIn = false) {
+    Serial.println("Commencing streamed text to speech.");
+    String textContent = gameContext.get(textPath);
+    if (textContent.length() == 0) {
+        return false;
+    }
+    ChunkedSpeech* speech = startSpeechStream(archivePath, textPath);
+    if (speech == NULL) {
+        return false;
+    }
+    speech->addText(textContent, fixedLeadIn);
+    speech->detach();
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    bool played = playSpeechStream(textPath);
+    if (played && archivePath != NULL) {
+        Serial.println("Audio saved to " + String(archivePath));
     }
-    audio.stopSong();
+    return played;
+}
 
-delay(500);
- // Convert player 2's speech to text
- convertSpeechToText(p2_response1, p2_trans1);
+// Function to narrate a text file, falling back to download-then-play
+void speakText(const char* textPath, const char* audioPath, bool fixedLeadIn = false) {
+    if (!playSpeechWhileDownloading(textPath, audioPath, fixedLeadIn)) {
+        convertTextToSpeech(textPath, audioPath, fixedLeadIn);
+        playAudioFile(audioPath);
+    }
+}
 
- // Evaluate player 2's response
- evaluateContribution(base_story, storySoFar, p2_trans1, p2_eval1);
+//------------------------------------------------------------------------
 
- // Add player 2's contribution to the story context
- addContextToStory(storySoFar, p2_trans1);
+// Pipelined turn engine: the network-heavy half of a turn (speech to text,
+// Gemini evaluation, rating and feedback synthesis) runs in a task on core 0
+// while loop() on core 1 is already recording the next player. Player N's
+// feedback is played right after player N+1's stop cue, once the worker has
+// finished with it; the worker handles turns strictly in order, so every
+// evaluation still sees the story including all earlier contributions.
+
+#define PIPELINE_CORE 0 // loop() runs on core 1
+#define PIPELINE_PRIORITY 1
+#define PIPELINE_STACK_SIZE 20480 // TLS handshakes plus the 4 KB upload buffer
+#define PIPELINE_DEPTH 2 // turns that may be queued behind the one in progress
+
+// Which evaluation prompt a turn uses
+enum TurnRole {
+    FIRST_TURN,
+    MIDDLE_TURN,
+    LAST_TURN
+};
 
- // Read and store player 2's rating to their rating file
- addNumberToFile(readRatingFromFeedback(p2_eval1), p2_rating);
+// Everything the worker needs to finish one player's turn
+struct TurnJob {
+    const char* response;   // recorded speech
+    const char* transcript; // speech converted to text
+    const char* evaluation; // Gemini's feedback text
+    const char* feedback;   // feedback converted to speech
+    const char* rating;     // player's running score
+    TurnRole role;
+    uint8_t player; // 1-based
+    float voiced; // seconds of speech heard while recording
+    StreamingUploader* upload; // streamed recording whose transcript is pending, or NULL
+};
 
- // Convert player 2's feedback to speech
- convertTextToSpeech(p2_eval1, p2_feed1);
+// One entry of the game's turn order
+struct TurnSlot {
+    uint8_t player; // 1-based
+    uint8_t round;  // 1-based
+    TurnRole role;
+};
 
- audio.connecttoFS(SD, p2_feed1);
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+TurnSlot turnSchedule[MAX_PLAYERS * MAX_ROUNDS];
+int turnCount = 0;
+
+// Function to name every game file and lay out the turn order: each round
+// every player speaks in turn; the first and last turns of the game get
+// their own evaluation prompts
+void buildTurnSchedule() {
+    for (int player = 1; player <= PLAYER_COUNT; player++) {
+        snprintf(ratingFiles[player - 1], sizeof(ratingFiles[0]), "/p%d_rating.txt", player);
+        for (int round = 1; round <= ROUND_COUNT; round++) {
+            TurnFiles& files = turnFiles[player - 1][round - 1];
+            snprintf(files.response, sizeof(files.response), "/p%d_response%d.wav", player, round);
+            snprintf(files.transcript, sizeof(files.transcript), "/p%d_trans%d.txt", player, round);
+            snprintf(files.evaluation, sizeof(files.evaluation), "/p%d_eval%d.txt", player, round);
+            snprintf(files.feedback, sizeof(files.feedback), "/p%d_feed%d.mp3", player, round);
+        }
     }
-    audio.stopSong();
 
- delay(3000);
+    turnCount = 0;
+    for (int round = 1; round <= ROUND_COUNT; round++) {
+        for (int player = 1; player <= PLAYER_COUNT; player++) {
+            TurnSlot& slot = turnSchedule[turnCount++];
+            slot.player = player;
+            slot.round = round;
+            slot.role = MIDDLE_TURN;
+        }
+    }
+    turnSchedule[0].role = FIRST_TURN;
+    turnSchedule[turnCount - 1].role = LAST_TURN;
+}
 
- // Player 3 Round 1
+// Function to fill in the job for a scheduled turn
+TurnJob makeTurnJob(const TurnSlot& slot) {
+    const TurnFiles& files = turnFiles[slot.player - 1][slot.round - 1];
+    TurnJob job = {files.response, files.transcript, files.evaluation, files.feedback,
+                   ratingFiles[slot.player - 1], slot.role, slot.player, 0, NULL};
+    return job;
+}
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-    audio.stopSong();
+// Feedback ready to be played
+struct FeedbackItem {
+    const char* path; // the feedback speech on SD
+    bool live;        // still being synthesised into the speech stream
+};
 
-    delay(500);
+QueueHandle_t turnQueue = NULL; // turns waiting for the worker
+QueueHandle_t feedbackQueue = NULL; // feedback ready to be played, in turn order
+volatile bool feedbackAwaited = false; // loop() is blocked waiting for the next feedback
 
-// Record response of player 3
-recordAudio(p3_response1);
+// Feedback speech: the evaluation streams in from Gemini a sentence at a time.
+// If the player is already waiting for it, each sentence is handed to chunked
+// speech as soon as it is complete, which synthesises it into the speech
+// stream, so they hear the start of it while the rest is still being written
+// and the worker is not held to the pace of playback. Otherwise nobody is
+// listening yet and the whole text is synthesised at the end.
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+class FeedbackSpeaker : public SentenceListener {
+private:
+    const char* feedbackPath;
+    String pending; // sentences not synthesised yet
+    ChunkedSpeech* narration; // set while sentences are narrated live
+    bool posted;
+
+    // Function to start narrating live and tell loop() to play along
+    void goLive() {
+        narration = startSpeechStream(feedbackPath, feedbackPath); // Also keeps the SD copy
+        if (narration == NULL) {
+            return;
+        }
+        FeedbackItem item = {feedbackPath, true};
+        xQueueSend(feedbackQueue, &item, portMAX_DELAY);
+        posted = true;
     }
-audio.stopSong();
-delay(500);
- // Convert player 3's speech to text
- convertSpeechToText(p3_response1, p3_trans1);
-
- // Evaluate player 3's response
- evaluateContribution(base_story, storySoFar, p3_trans1, p3_eval1);
 
- // Add player 3's contribution to the story context
- addContextToStory(storySoFar, p3_trans1);
+    // Function to pass the sentences gathered so far to the narration
+    void narratePending() {
+        if (pending.length() > 0) {
+            narration->add(pending);
+            pending = "";
+        }
+    }
 
- // Read and store player 3's rating to their rating file
- addNumberToFile(readRatingFromFeedback(p3_eval1), p3_rating);
+public:
+    FeedbackSpeaker(const char* _feedbackPath) : feedbackPath(_feedbackPath), narration(NULL), posted(false) {}
 
- // Convert player 3's feedback to speech
- convertTextToSpeech(p3_eval1, p3_feed1);
+    void onSentence(const String& sentence) override {
+        if (pending.length() > 0) {
+            pending += " ";
+        }
+        pending += sentence;
 
- audio.connecttoFS(SD, p3_feed1);
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+        if (narration == NULL && feedbackAwaited) {
+            goLive();
+        }
+        if (narration != NULL) {
+            narratePending();
+        }
     }
-audio.stopSong();
- delay(3000);
 
-// Player 4 Round 1
+    // Function to synthesise whatever is left once the evaluation is complete,
+    // making sure loop() is handed the feedback exactly once
+    void finish(const char* evaluationPath) {
+        if (narration == NULL && feedbackAwaited && pending.length() > 0) {
+            goLive();
+        }
+        if (narration != NULL) {
+            narratePending();
+            narration->detach();
+            narration = NULL;
+        } else if (pending.length() > 0) {
+            File audioFile = SD.open(feedbackPath, FILE_WRITE);
+            if (audioFile) {
+                synthesiseSpeech(pending, &audioFile, feedbackPath);
+                audioFile.close();
+            } else {
+                Serial.println("Failed to create audio file.");
+            }
+        } else {
+            convertTextToSpeech(evaluationPath, feedbackPath); // Streaming failed: try the saved text
+        }
+        pending = "";
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+        if (!posted) {
+            FeedbackItem item = {feedbackPath, false};
+            xQueueSend(feedbackQueue, &item, portMAX_DELAY);
+            posted = true;
+        }
     }
-    audio.stopSong();
-    delay(500);
+};
 
-//Record response of player 4
-recordAudio(p4_response1);
+// Streaming uploads: one for the turn being recorded, one whose transcript the
+// worker is still collecting. The global client stays free for the SD fallback.
+#define STREAM_SLOTS 2
+WiFiClientSecure streamClients[STREAM_SLOTS];
+StreamingUploader streamUploaders[STREAM_SLOTS] = {
+    StreamingUploader(&streamClients[0]),
+    StreamingUploader(&streamClients[1])
+};
+SemaphoreHandle_t streamSlots = NULL; // uploaders not waiting on a reply
+volatile bool streamSlotBusy[STREAM_SLOTS] = {false, false};
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to hand an uploader back once its reply has been read
+void releaseStreamingUpload(StreamingUploader* uploader) {
+    streamSlotBusy[uploader - streamUploaders] = false;
+    xSemaphoreGive(streamSlots);
+}
+
+// Function to run the network stages of a turn
+void processTurn(const TurnJob& job) {
+    uint32_t startTime = millis();
+
+    // Convert the player's speech to text; a streamed recording only needs its reply collected
+    bool transcribed = false;
+    if (job.upload != NULL) {
+        uint32_t stageStart = millis();
+        String response = job.upload->readResponse();
+        traceRecord("stt wait", job.response, stageStart, 0, response.length());
+        releaseStreamingUpload(job.upload); // The next turn may reuse the connection
+        transcribed = response.length() > 0 && saveTranscription(response, job.transcript);
+        if (!transcribed) {
+            Serial.println("Streamed transcription failed, uploading the SD copy instead.");
+        } else if (!KEEP_RECORDINGS_ON_SD) {
+            SD.remove(job.response); // The copy was only kept in case the stream failed
+        }
+    }
+    if (!transcribed) {
+        convertSpeechToText(job.response, job.transcript);
+    }
+
+    // Evaluate the player's response, speaking the feedback as it is written
+    FeedbackSpeaker speaker(job.feedback);
+    if (job.role == FIRST_TURN) {
+        evaluateFContribution(job.player, job.voiced, job.transcript, job.evaluation, &speaker);
+    } else if (job.role == LAST_TURN) {
+        evaluateLContribution(job.player, job.voiced, job.transcript, job.evaluation, &speaker);
+    } else {
+        evaluateContribution(job.player, job.voiced, job.transcript, job.evaluation, &speaker);
     }
-audio.stopSong();
-    delay(500);
+    speaker.finish(job.evaluation);
 
- // Convert player 4's speech to text
- convertSpeechToText(p4_response1, p4_trans1);
+    // Add the player's contribution to the story context
+    uint32_t stageStart = millis();
+    gameContext.appendToStory(job.transcript);
+    traceRecord("story context", storySoFar, stageStart);
 
- // Evaluate player 4's response
- evaluateContribution(base_story, storySoFar, p4_trans1, p4_eval1);
+    // Add the player's rating to their total
+    stageStart = millis();
+    gameContext.addRating(job.player, readRatingFromFeedback(job.evaluation));
+    traceRecord("rating", job.rating, stageStart);
 
- // Add player 4's contribution to the story context
- addContextToStory(storySoFar, p4_trans1);
+    Serial.printf("Turn %s processed in %lu ms\n", job.response, (unsigned long)(millis() - startTime));
+    traceRecord("turn", job.response, startTime);
+}
 
- // Read and store player 4's rating to their rating file
- addNumberToFile(readRatingFromFeedback(p4_eval1), p4_rating);
+// Worker task that processes turns in submission order
+void turnPipelineTask(void* parameter) {
+    TurnJob job;
+    for (;;) {
+        if (xQueueReceive(turnQueue, &job, portMAX_DELAY) == pdTRUE) {
+            processTurn(job); // Hands the feedback to loop() as soon as it can be played
+        }
+    }
+}
 
- // Convert player 4's feedback to speech
- convertTextToSpeech(p4_eval1, p4_feed1);
+// Function to start the turn worker on the other core
+bool startTurnPipeline() {
+    if (turnQueue != NULL) {
+        return true; // Already running
+    }
 
- audio.connecttoFS(SD, p4_feed1);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    turnQueue = xQueueCreate(PIPELINE_DEPTH, sizeof(TurnJob));
+    feedbackQueue = xQueueCreate(PIPELINE_DEPTH + 1, sizeof(FeedbackItem));
+    streamSlots = xSemaphoreCreateCounting(STREAM_SLOTS, STREAM_SLOTS);
+    if (turnQueue == NULL || feedbackQueue == NULL || streamSlots == NULL) {
+        Serial.println("Failed to create turn pipeline queues!");
+        return false;
     }
-audio.stopSong();
- delay(3000);
 
-// Player 1 Round 2
+    if (xTaskCreatePinnedToCore(turnPipelineTask, "turnPipeline", PIPELINE_STACK_SIZE, NULL,
+                                PIPELINE_PRIORITY, NULL, PIPELINE_CORE) != pdPASS) {
+        Serial.println("Failed to start turn pipeline task!");
+        return false;
+    }
+#if STORY_SUMMARY
+    startStorySummary(); // Without it the story is simply kept verbatim
+#endif
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    Serial.println("Turn pipeline started.");
+    return true;
+}
+
+// Function to open a streaming upload for the next turn; NULL records to SD only
+StreamingUploader* beginStreamingUpload() {
+#if STREAM_STT_UPLOAD
+    // Both connections still waiting on replies means the worker has fallen far behind
+    if (xSemaphoreTake(streamSlots, 0) != pdTRUE) {
+        Serial.println("No free streaming upload, recording to SD only.");
+        return NULL;
     }
-audio.stopSong();
-    delay(500);
 
-//Record second response of player 1
-recordAudio(p1_response2);
+    // Take the lowest free slot, so one connection carries most turns and stays warm
+    int slot = 0;
+    while (streamSlotBusy[slot]) {
+        slot++;
+    }
+    streamSlotBusy[slot] = true;
+    StreamingUploader* uploader = &streamUploaders[slot];
+    if (uploader->begin()) {
+        return uploader;
+    }
+    releaseStreamingUpload(uploader);
+#endif
+    return NULL;
+}
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to run a player's turn: cues, recording, and hand-off to the worker
+void recordTurn(TurnJob job) {
+    // Connect before the start cue so the TLS handshake is out of the way
+    job.upload = beginStreamingUpload();
+
+    // Start cue
+    playAudioFile("/start.mp3");
+    pauseBetweenStages(500);
+
+    // Record the player's response, streaming it to the STT API as it is captured
+    uint32_t recordStart = millis();
+    recordAudio(job.response, job.upload, &job.voiced);
+    if (job.upload != NULL && !job.upload->finish()) {
+        releaseStreamingUpload(job.upload);
+        job.upload = NULL; // The worker will upload the SD copy instead
     }
-audio.stopSong();
-    delay(500);
+    traceRecord("record", job.response, recordStart);
 
- // Convert player 1's second speech to text
- convertSpeechToText(p1_response2, p1_trans2);
+    // Stop cue
+    playAudioFile("/stop.mp3");
+    pauseBetweenStages(500);
 
- // Evaluate player 1's second response
- evaluateContribution(base_story, storySoFar, p1_trans2, p1_eval2);
+    // Hand the turn to the worker; blocks only if the pipeline is full
+    xQueueSend(turnQueue, &job, portMAX_DELAY);
+}
+
+// Function to wait for the oldest outstanding turn and play its feedback
+void playNextFeedback() {
+    FeedbackItem feedback;
+    uint32_t waitStart = millis();
 
- // Add player 1's second contribution to the story context
- addContextToStory(storySoFar, p1_trans2);
+    // Let the worker know the player is waiting, so it narrates as it goes
+    feedbackAwaited = uxQueueMessagesWaiting(feedbackQueue) == 0;
+    xQueueReceive(feedbackQueue, &feedback, portMAX_DELAY);
+    feedbackAwaited = false;
+    Serial.printf("Waited %lu ms for feedback %s\n", (unsigned long)(millis() - waitStart), feedback.path);
+    traceRecord("feedback wait", feedback.path, waitStart);
 
- // Read and store player 1's second rating to their rating file
- addNumberToFile(readRatingFromFeedback(p1_eval2), p1_rating);
+    if (feedback.live) {
+        playSpeechStream(feedback.path);
+    } else {
+        playAudioFile(feedback.path);
+    }
+}
 
- // Convert player 1's second feedback to speech
- convertTextToSpeech(p1_eval2, p1_feed2);
+//------------------------------------------------------------------------
 
- audio.connecttoFS(SD, p1_feed2);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to delete all files at the end
+void deleteGameFiles() {
+    // List of all file paths created during the game
+    const char* filesToDelete[MAX_PLAYERS * MAX_ROUNDS * 4 + 5];
+    int fileCount = 0;
+    for (int player = 0; player < PLAYER_COUNT; player++) {
+        for (int round = 0; round < ROUND_COUNT; round++) {
+            const TurnFiles& files = turnFiles[player][round];
+            filesToDelete[fileCount++] = files.response;
+            filesToDelete[fileCount++] = files.transcript;
+            filesToDelete[fileCount++] = files.evaluation;
+            filesToDelete[fileCount++] = files.feedback;
+        }
     }
-audio.stopSong();
- delay(3000);
+    filesToDelete[fileCount++] = winner_feedback;
+    filesToDelete[fileCount++] = winner_feedback_speech;
+    filesToDelete[fileCount++] = fullstoryTTS;
+    filesToDelete[fileCount++] = base_story;
+    filesToDelete[fileCount++] = storySoFar;
 
- // Player 2 Round 2
+    // Loop through each file and delete it if it exists
+    for (int i = 0; i < fileCount; i++) {
+        if (SD.exists(filesToDelete[i])) {
+            SD.remove(filesToDelete[i]);
+            Serial.print("Deleted file: ");
+            Serial.println(filesToDelete[i]);
+        } else {
+            Serial.print("File not found: ");
+            Serial.println(filesToDelete[i]);
+        }
+    }
+}
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+//------------------------------------------------------------------------
+
+// Game state machine: loop() runs one stage per call and moves on to the
+// stage it returns. The pause after a stage is waited out across loop()
+// calls rather than inside the stage, and every stage is traced the same way.
+
+enum GameState {
+    GAME_START,
+    GAME_INTRO,
+    GAME_RULES,
+    GAME_LOCATE,
+    GAME_PROMPT,
+    GAME_RECORD_TURN,
+    GAME_PLAY_FEEDBACK,
+    GAME_DELIBERATION,
+    GAME_WINNER,
+    GAME_CLEANUP
+};
+
+// A stage of the game and the pause that follows it
+struct GameStage {
+    const char* name;
+    GameState (*run)();
+    uint32_t pauseAfter; // ms
+};
+
+GameState gameState = GAME_START;
+uint32_t gameStart = 0; // when the current game began
+uint32_t pauseStart = 0; // when the pause after the last stage began
+uint32_t pauseLength = 0;
+int turnsRecorded = 0;
+int feedbackPlayed = 0;
+int gamesPlayed = 0;
+String gameLocation;
+
+// Prompt preparation: while loop() plays the introduction and the rules,
+// a task on core 0 gets a GPS fix, looks up the place name and readies the
+// story prompt, taking it from the pool or else generating and synthesising
+// it. The narration lasts over a minute, so the prompt is usually ready by
+// the time the rules end; if the task fails, the prompt is generated live.
+
+#define PREPARE_TASK_CORE 0 // loop() runs on core 1
+#define PREPARE_TASK_PRIORITY 1
+#define PREPARE_TASK_STACK_SIZE 16384 // TLS handshake plus HTTPClient
+
+SemaphoreHandle_t promptPrepared = NULL; // given when the preparation task is done
+volatile bool preparedStory = false;  // the prompt's text is in the game context
+volatile bool preparedSpeech = false; // and its speech is in first_prompt
+
+// Task that locates the device and readies the game's story prompt
+void promptPreparationTask(void* parameter) {
+    promptPool.pause(); // The prompt needs the network more than the pool does
+
+    // The narration leaves time to wait for a receiver that has only just been powered up
+    uint32_t gpsStart = millis();
+    float latitude, longitude;
+    getGPSFix(latitude, longitude, GPS_FIX_WAIT_MS);
+    traceRecord("gps", NULL, gpsStart);
+
+    gameLocation = getPlaceName(latitude, longitude);
+    String location = storyLocation(gameLocation);
+    promptPool.setLocation(location); // Prompts for the next game are set here too
+
+    // fullstoryTTS points to the file path of the prompt to be read aloud: we use this to generate the speech
+    // base_story points to the file path of the base story: stores the base prompt
+    String fullStory;
+    if (promptPool.take(location, fullStory, first_prompt)) {
+        Serial.println("Prompt taken from the pool.");
+        saveStory(fullstoryTTS, base_story, fullStory);
+        preparedStory = true;
+        preparedSpeech = true;
+    } else if (generateStory(fullstoryTTS, base_story, gameLocation).length() > 0) {
+        preparedStory = true;
+        preparedSpeech = convertTextToSpeech(fullstoryTTS, first_prompt, true); // "Hmmm... Seems that we are at ...:" recurs
     }
-audio.stopSong();
-    delay(500);
 
-//Record second response of player 2
-recordAudio(p2_response2);
+    xSemaphoreGive(promptPrepared);
+    vTaskDelete(NULL);
+}
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
- while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to start readying the prompt; false if the task could not be started
+bool startPromptPreparation() {
+    preparedStory = false;
+    preparedSpeech = false;
+    if (promptPrepared == NULL) {
+        promptPrepared = xSemaphoreCreateBinary();
+    }
+    if (promptPrepared == NULL ||
+        xTaskCreatePinnedToCore(promptPreparationTask, "preparePrompt", PREPARE_TASK_STACK_SIZE, NULL,
+                                PREPARE_TASK_PRIORITY, NULL, PREPARE_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start prompt preparation task!");
+        return false;
     }
-audio.stopSong();
-    delay(500);
+    return true;
+}
 
- // Convert player 2's second speech to text
- convertSpeechToText(p2_response2, p2_trans2);
+bool preparingPrompt = false; // the preparation task is running for this game
 
- // Evaluate player 2's second response
- evaluateContribution(base_story, storySoFar, p2_trans2, p2_eval2);
+// Function to set up a new game
+GameState startGame() {
+    gameStart = millis();
+    turnsRecorded = 0;
+    feedbackPlayed = 0;
+    buildTurnSchedule();
+    Serial.printf("Starting a game of %d players over %d rounds\n", PLAYER_COUNT, ROUND_COUNT);
 
- // Add player 2's second contribution to the story context
- addContextToStory(storySoFar, p2_trans2);
+    // Start from the rating files, creating any that don’t exist
+    gameContext.reset();
 
- // Read and store player 2's second rating to their rating file
- addNumberToFile(readRatingFromFeedback(p2_eval2), p2_rating);
+    // Locate the device and ready the prompt during the narration
+    preparingPrompt = startPromptPreparation();
+    return GAME_INTRO;
+}
 
- // Convert player 2's second feedback to speech
- convertTextToSpeech(p2_eval2, p2_feed2);
+// Function to play the introductory announcement
+GameState narrateIntroduction() {
+    playAudioFile("/introduction.mp3");
+    Serial.println("Introduction over!");
+    return GAME_RULES;
+}
 
- audio.connecttoFS(SD, p2_feed2);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to play the instruction announcement
+GameState narrateRules() {
+    playAudioFile("/rules.mp3");
+    Serial.println("Rules have been narrated!");
+    return GAME_LOCATE;
+}
+
+// Function to find the name/address of the device's current location, waiting
+// for the preparation task if it is doing so
+GameState locateDevice() {
+    if (preparingPrompt) {
+        xSemaphoreTake(promptPrepared, portMAX_DELAY);
+        preparingPrompt = false;
+        return GAME_PROMPT;
     }
-audio.stopSong();
- delay(3000);
 
-// Player 3 Round 2
+    promptPool.pause();
+    uint32_t gpsStart = millis();
+    float latitude, longitude;
+    getGPSFix(latitude, longitude, 0);
+    traceRecord("gps", NULL, gpsStart);
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-audio.stopSong();
-delay(500);
-//Record second response of player 3
-recordAudio(p3_response2);
+    gameLocation = getPlaceName(latitude, longitude);
+    promptPool.setLocation(storyLocation(gameLocation)); // Prompts for the next game are set here too
+    return GAME_PROMPT;
+}
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to announce the story prompt: the one readied during the narration,
+// or one from the pool, or else one generated now
+GameState announcePrompt() {
+    if (preparedStory) {
+        startGameSession(base_story); // Every evaluation continues this conversation
+        if (preparedSpeech) {
+            playAudioFile(first_prompt);
+        } else {
+            speakText(fullstoryTTS, first_prompt, true);
+        }
+        return GAME_RECORD_TURN;
     }
-audio.stopSong();
-    delay(500);
 
- // Convert player 3's second speech to text
- convertSpeechToText(p3_response2, p3_trans2);
+    // fullstoryTTS points to the file path of the prompt to be read aloud: we use this to generate the speech
+    // base_story points to the file path of the base story: stores the base prompt
+    String fullStory;
+    if (promptPool.take(storyLocation(gameLocation), fullStory, first_prompt)) {
+        Serial.println("Prompt taken from the pool.");
+        saveStory(fullstoryTTS, base_story, fullStory);
+        startGameSession(base_story); // Every evaluation continues this conversation
+        playAudioFile(first_prompt);
+        return GAME_RECORD_TURN;
+    }
 
- // Evaluate player 3's second response
- evaluateContribution(base_story, storySoFar, p3_trans2, p3_eval2);
+    generateStory(fullstoryTTS, base_story, gameLocation);
+    startGameSession(base_story);
 
- // Add player 3's second contribution to the story context
- addContextToStory(storySoFar, p3_trans2);
+    // Narrate while the speech is still being synthesised
+    speakText(fullstoryTTS, first_prompt, true);
+    return GAME_RECORD_TURN;
+}
 
- // Read and store player 3's second rating to their rating file
- addNumberToFile(readRatingFromFeedback(p3_eval2), p3_rating);
+// Function to record the next scheduled turn. Each turn is recorded while the
+// worker is still busy with the previous one, so a player's feedback is played
+// after the next player has spoken.
+GameState recordNextTurn() {
+    const TurnSlot& slot = turnSchedule[turnsRecorded++];
+    Serial.printf("Player %d, round %d\n", slot.player, slot.round);
+    recordTurn(makeTurnJob(slot));
+
+    // The first player's feedback waits until the second player has spoken
+    if (turnsRecorded == 1 && turnCount > 1) {
+        return GAME_RECORD_TURN;
+    }
+    return GAME_PLAY_FEEDBACK;
+}
 
- // Convert player 3's second feedback to speech
- convertTextToSpeech(p3_eval2, p3_feed2);
+// Function to play the oldest outstanding feedback
+GameState playFeedback() {
+    playNextFeedback();
+    feedbackPlayed++;
 
- audio.connecttoFS(SD, p3_feed2);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+    if (turnsRecorded < turnCount) {
+        return GAME_RECORD_TURN;
     }
-audio.stopSong();
- delay(3000);
+    // Nobody is left to record, so wait for the remaining evaluations
+    return feedbackPlayed < turnCount ? GAME_PLAY_FEEDBACK : GAME_DELIBERATION;
+}
 
-// Player 4 Round 2
+// Function to announce that the judges are deliberating
+GameState announceDeliberation() {
+    playAudioFile("/deliberation.mp3");
+    return GAME_WINNER;
+}
 
-// Start cue
-audio.connecttoFS(SD, "/start.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+// Function to evaluate and announce the winner
+GameState announceWinner() {
+    int bestPlayer = findHighestRatedPlayer();
+    if (bestPlayer > 0) {
+        evaluateWinner(bestPlayer, winner_feedback);
     }
-audio.stopSong();
-    delay(500);
+    promptPool.refill(); // Ready the next game's prompt while this one ends
+
+    speakText(winner_feedback, winner_feedback_speech);
+    Serial.println("Game over!");
+    printConnectionStats();
+    gemini.printStats();
+    speechCache.printStats();
+    return GAME_CLEANUP;
+}
 
-//Record second response of player 4
-recordAudio(p4_response2);
+// Function to delete the game's files and save its trace
+GameState cleanUpGame() {
+    gameContext.flush(); // Nothing may be left to write once the files are gone
+    Serial.println("Deleting game files!");
+    deleteGameFiles(); // Deleting all the stored player data
+
+    traceRecord("game", NULL, gameStart);
+    writeTraceToSD(); // Kept on the SD card for offline analysis
+    speechCache.save(); // Keeps the order phrases were last played in
+    gamesPlayed++;
+    //All good things come to an end, alas
+    return GAME_START;
+}
 
- // Stop cue
- audio.connecttoFS(SD, "/stop.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-audio.stopSong();
-    delay(500);
+// Stages in GameState order
+const GameStage gameStages[] = {
+    {"start", startGame, 0},
+    {"intro", narrateIntroduction, 1000},
+    {"rules", narrateRules, 1000},
+    {"locate", locateDevice, 0},
+    {"prompt", announcePrompt, 2000},
+    {"record turn", recordNextTurn, 0},
+    {"feedback", playFeedback, 3000},
+    {"deliberation", announceDeliberation, 3000},
+    {"winner", announceWinner, 10000},
+    {"cleanup", cleanUpGame, 40000}
+};
+
+void setup() {
+
+    // Set baud rate
+    Serial.begin(115200);
+    
+    Serial.println("Starting up..."); 
 
- // Convert player 4's second speech to text
- convertSpeechToText(p4_response2, p4_trans2);
+    // Initiate WiFi connection
+    connectToWiFi(); 
 
- // Evaluate player 4's second response
- evaluateLContribution(base_story, storySoFar, p4_trans2, p4_eval2);
+    // Resolve the API hosts and set up the kept-alive connections
+    initConnectionPool();
 
- // Add player 4's second contribution to the story context
- addContextToStory(storySoFar, p4_trans2);
+    // Initiate SPI connection to SD card
+    initSDCard(); 
 
- // Read and store player 4's second rating to their rating file
- addNumberToFile(readRatingFromFeedback(p4_eval2), p4_rating);
+    // Keep the game's texts in RAM, saving them to the SD card in the background
+    gameContext.begin();
 
- // Convert player 4's second feedback to speech
- convertTextToSpeech(p4_eval2, p4_feed2);
+    // Load the index of phrases already synthesised
+    speechCache.begin();
 
- audio.connecttoFS(SD, p4_feed2);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-audio.stopSong();
- delay(3000);
+    // Load the place names already looked up
+    geocodeCache.begin();
 
-audio.connecttoFS(SD, "/deliberation.mp3");
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
-    }
-audio.stopSong();
-delay(3000);
+    // Find the prompts left from earlier games and start generating more
+    promptPool.begin();
 
-int bestPlayer = findHighestRatedPlayer();
+    GPS.begin(GPS_BAUD, SERIAL_8N1, GPS_RX, GPS_TX); // initialising the GPS with the following configuration: 9600 baud rate, serial protocol (8N1 kind)
+
+    while(!GPS); // wait for the GPS receiver to initialise
+
+    // Parse the receiver's sentences from now on, so a fix is ready when a game needs one
+    startGpsTask();
+    
+    Serial.println("Initialising I2S speaker setup");
+    // Initialise I2S speaker setup
+    audio.setPinout(I2S_BCLK, I2S_LRC, I2S_DOUT);
+    audio.setVolume(VOLUME);
+    Serial.println("I2S speaker setup complete!");
+
+    // Start the worker that processes turns while the next player records
+    startTurnPipeline();
 
-if(bestPlayer==1)
-{
-  evaluateWinner(base_story, storySoFar, p1_trans1, p1_trans2, winner_feedback, 1);
-}
-else if(bestPlayer==2)
-{
-  evaluateWinner(base_story, storySoFar, p2_trans1, p2_trans2, winner_feedback, 2);
-}
-else if(bestPlayer==3)
-{
-  evaluateWinner(base_story, storySoFar, p3_trans1, p3_trans2, winner_feedback, 3);
-}
-else if(bestPlayer==4)
-{
-  evaluateWinner(base_story, storySoFar, p4_trans1, p4_trans2, winner_feedback, 4);
 }
 
-convertTextToSpeech(winner_feedback, winner_feedback_speech);
-audio.connecttoFS(SD, winner_feedback_speech);
-while (audio.isRunning()) {
-        audio.loop();  // Continue playback
-        delay(IN_AUDIO_PAUSE);     // Small delay to prevent a tight loop
+void loop() {
+    // Let the pause after the last stage run out
+    if (pauseLength > 0) {
+        if (millis() - pauseStart < pauseLength) {
+            delay(IN_AUDIO_PAUSE);
+            return;
+        }
+        traceRecord("pause", NULL, pauseStart);
+        pauseLength = 0;
     }
-audio.stopSong();
-Serial.println("Game over!");
 
-delay(10000);
+    const GameStage& stage = gameStages[gameState];
+    uint32_t stageStart = millis();
+    GameState next = stage.run();
+    if (next != GAME_START) { // The trace was written when the game ended
+        traceRecord(stage.name, NULL, stageStart);
+    }
 
-Serial.println("Deleting game files!");
-deleteGameFiles(); // Deleting all the stored player data
-delay(40000);
-//All good things come to an end, alas
-}
\ No newline at end of file
+    gameState = next;
+    pauseStart = millis();
+    pauseLength = stage.pauseAfter;
+}
@@ -0,0 +1,312 @@
+#!/usr/bin/env python3
+"""End-to-end game benchmark for the native build.
+
+Plays full 4-player, 2-round games with the [env:native] binary against
+tools/mock_api_server.py and reports the game's total time and per-turn
+latency, all in device seconds:
+
+  stop->feedback   from a player's stop cue to the start of their feedback clip
+  processing       the worker's speech-to-text, evaluation and TTS for the turn
+  stall            how long the game loop waited for that feedback
+
+  pio run -e native
+  tools/bench_game.py --runs 3 --json result.json
+  tools/bench_game.py --baseline result.json      # exit 1 on a regression
+
+It also exits 1 if the stand-in rejected any request (a 4xx), since the
+real API would reject it too.
+
+Microphone and GPS fixtures are synthesised unless --mic-wav / --gps-nmea
+are given; the SD card is a fresh temporary directory seeded with audio/.
+"""
+
+import argparse
+import json
+import math
+import os
+import random
+import re
+import shutil
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import wave
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SAMPLE_RATE = 16000
+
+LINE = re.compile(r"^\[\s*(\d+)\] (.*)$")
+
+
+def write_mic_fixture(path, speech_seconds, seed):
+    """Speech-like bursts for speech_seconds, then silence up to 40 s."""
+    rng = random.Random(seed)
+    total = 40 * SAMPLE_RATE
+    speech_end = int(speech_seconds * SAMPLE_RATE)
+    samples = []
+    while len(samples) < total:
+        if len(samples) >= speech_end:
+            samples.append(rng.randint(-30, 30))
+            continue
+        # One syllable: a few harmonics under a raised-cosine envelope, then a gap
+        length = int(rng.uniform(0.12, 0.30) * SAMPLE_RATE)
+        pitch = rng.uniform(110, 260)
+        amplitude = rng.uniform(3000, 9000)
+        for n in range(length):
+            t = n / SAMPLE_RATE
+            envelope = 0.5 - 0.5 * math.cos(2 * math.pi * n / length)
+            value = sum(math.sin(2 * math.pi * pitch * k * t) / k for k in (1, 2, 3, 5))
+            samples.append(int(amplitude * envelope * value / 2) + rng.randint(-60, 60))
+        samples.extend(rng.randint(-30, 30) for _ in range(int(rng.uniform(0.04, 0.15) * SAMPLE_RATE)))
+    with wave.open(path, "wb") as out:
+        out.setnchannels(1)
+        out.setsampwidth(2)
+        out.setframerate(SAMPLE_RATE)
+        out.writeframes(struct.pack("<%dh" % total, *(max(-32768, min(32767, s)) for s in samples[:total])))
+
+
+def nmea(body):
+    checksum = 0
+    for c in body.encode():
+        checksum ^= c
+    return "$%s*%02X\r\n" % (body, checksum)
+
+
+def write_gps_fixture(path):
+    """One GGA/RMC pair per second at the Sydney Opera House."""
+    with open(path, "w", newline="") as out:
+        for second in range(60):
+            utc = "0230%02d.00" % second
+            out.write(nmea("GPGGA,%s,3351.4080,S,15112.9180,E,1,08,0.9,4.0,M,22.0,M,," % utc))
+            out.write(nmea("GPRMC,%s,A,3351.4080,S,15112.9180,E,0.0,0.0,170626,,," % utc))
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def parse_game(lines, time_scale, wall_seconds):
+    """Turn the firmware's serial log into per-turn timings (device ms)."""
+    events = []
+    for raw in lines:
+        match = LINE.match(raw)
+        if match:
+            events.append((int(match.group(1)), match.group(2)))
+
+    stops, processing, feedback, players = [], [], [], []
+    game_over = None
+    expected_turns = None
+    for ms, text in events:
+        size = re.match(r"Starting a game of (\d+) players over (\d+) rounds", text)
+        player = re.match(r"Player (\d+), round (\d+)$", text)
+        if size and expected_turns is None:
+            expected_turns = int(size.group(1)) * int(size.group(2))
+        elif player:
+            players.append((int(player.group(1)), int(player.group(2))))
+        elif text == "Recording stopped.":
+            stops.append(ms)
+        elif text.startswith("Turn ") and " processed in " in text:
+            processing.append(int(re.search(r"processed in (\d+) ms", text).group(1)))
+        elif text.startswith("Waited ") and " for feedback " in text:
+            feedback.append((ms, int(re.search(r"Waited (\d+) ms", text).group(1))))
+        elif text == "Game over!" and game_over is None:
+            game_over = ms
+
+    turns = []
+    for i, stop in enumerate(stops):
+        turn = {"turn": i + 1}
+        if i < len(players):
+            turn["player"], turn["round"] = players[i]
+        if i < len(processing):
+            turn["processing_ms"] = processing[i]
+        if i < len(feedback):
+            turn["stop_to_feedback_ms"] = feedback[i][0] - stop
+            turn["stall_ms"] = feedback[i][1]
+        turns.append(turn)
+
+    return {
+        "total_s": (game_over - events[0][0]) / 1000.0 if game_over and events else None,
+        "wall_s": wall_seconds,
+        "turns": turns,
+        "completed": game_over is not None and len(turns) == expected_turns,
+    }
+
+
+def parse_mock_log(path, time_scale):
+    endpoints = {}
+    if not os.path.exists(path):
+        return endpoints
+    with open(path) as f:
+        for line in f:
+            entry = json.loads(line)
+            stats = endpoints.setdefault(entry["endpoint"], {"requests": 0, "errors": 0, "rejected": 0,
+                                                             "seconds": 0.0, "bytes_in": 0, "bytes_out": 0})
+            stats["requests"] += 1
+            stats["errors"] += entry["status"] != 200
+            # A 4xx is a request the real API would refuse too, not an injected failure
+            stats["rejected"] += 400 <= entry["status"] < 500
+            stats["seconds"] += (entry["end"] - entry["start"]) * time_scale
+            stats["bytes_in"] += entry["bytes_in"]
+            stats["bytes_out"] += entry["bytes_out"]
+    return endpoints
+
+
+def run_game(args, run, workdir):
+    sd_dir = os.path.join(workdir, "sd%d" % run)
+    shutil.rmtree(sd_dir, ignore_errors=True)
+    os.makedirs(sd_dir)
+    for name in os.listdir(os.path.join(REPO, "audio")):
+        shutil.copy(os.path.join(REPO, "audio", name), sd_dir)
+
+    port = free_port()
+    mock_log = os.path.join(workdir, "mock%d.jsonl" % run)
+    mock_cmd = [sys.executable, os.path.join(REPO, "tools", "mock_api_server.py"),
+                "--port", str(port), "--time-scale", str(args.time_scale),
+                "--seed", str(args.seed + run), "--log", mock_log]
+    if args.config:
+        mock_cmd += ["--config", args.config]
+    mock = subprocess.Popen(mock_cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    mock.stdout.readline()  # "listening on ..."
+
+    env = dict(os.environ,
+               STORYBOX_SD_DIR=sd_dir,
+               STORYBOX_API_HOST="127.0.0.1",
+               STORYBOX_API_PORT=str(port),
+               STORYBOX_MIC_WAV=args.mic_wav,
+               STORYBOX_GPS_NMEA=args.gps_nmea,
+               STORYBOX_TIME_SCALE=str(args.time_scale),
+               STORYBOX_GAMES="1")
+    started = time.time()
+    try:
+        result = subprocess.run([args.binary], env=env, cwd=workdir, capture_output=True, text=True,
+                                timeout=args.timeout)
+        output = result.stdout
+    except subprocess.TimeoutExpired as e:
+        output = e.stdout.decode() if isinstance(e.stdout, bytes) else (e.stdout or "")
+    finally:
+        mock.terminate()
+        mock.wait()
+    wall = time.time() - started
+
+    with open(os.path.join(workdir, "game%d.log" % run), "w") as f:
+        f.write(output)
+
+    game = parse_game(output.splitlines(), args.time_scale, wall)
+    game["endpoints"] = parse_mock_log(mock_log, args.time_scale)
+    return game
+
+
+def summarise(games):
+    totals = [g["total_s"] for g in games if g["completed"]]
+    summary = {"runs": len(games), "completed": len(totals),
+               "rejected": sum(e.get("rejected", 0) for g in games for e in g["endpoints"].values())}
+    if totals:
+        summary.update(total_mean_s=statistics.mean(totals), total_min_s=min(totals), total_max_s=max(totals))
+    for key in ("stop_to_feedback_ms", "processing_ms", "stall_ms"):
+        values = [t[key] for g in games for t in g["turns"] if key in t]
+        if values:
+            summary[key.replace("_ms", "_mean_ms")] = statistics.mean(values)
+            summary[key.replace("_ms", "_max_ms")] = max(values)
+    return summary
+
+
+def report(games, summary):
+    for run, game in enumerate(games):
+        total = "%.1f s" % game["total_s"] if game["total_s"] else "incomplete"
+        print("run %d: game %s (wall %.1f s)" % (run + 1, total, game["wall_s"]))
+        print("  turn  player  round  stop->feedback  processing   stall")
+        for t in game["turns"]:
+            print("  %4d  %6d  %5d  %12.1f s  %8.1f s  %5.1f s" % (
+                t["turn"], t.get("player", 0), t.get("round", 0), t.get("stop_to_feedback_ms", 0) / 1000.0,
+                t.get("processing_ms", 0) / 1000.0, t.get("stall_ms", 0) / 1000.0))
+        for name, e in sorted(game["endpoints"].items()):
+            print("  %-15s %3d requests  %6.1f s server time  %8d B in  %8d B out  %d errors" % (
+                name, e["requests"], e["seconds"], e["bytes_in"], e["bytes_out"], e["errors"]))
+    print("summary: %d/%d games completed" % (summary["completed"], summary["runs"]))
+    if summary["rejected"]:
+        print("FAILED: %d requests rejected by the API stand-in" % summary["rejected"])
+    if "total_mean_s" in summary:
+        print("  total          mean %.1f s  min %.1f s  max %.1f s" % (
+            summary["total_mean_s"], summary["total_min_s"], summary["total_max_s"]))
+    for key, label in (("stop_to_feedback", "stop->feedback"), ("processing", "processing"), ("stall", "stall")):
+        if key + "_mean_ms" in summary:
+            print("  %-14s mean %.1f s  max %.1f s" % (
+                label, summary[key + "_mean_ms"] / 1000.0, summary[key + "_max_ms"] / 1000.0))
+
+
+def check_baseline(summary, baseline_path, tolerance):
+    with open(baseline_path) as f:
+        baseline = json.load(f)["summary"]
+    ok = summary["completed"] == summary["runs"]
+    if not ok:
+        print("REGRESSION: %d of %d games did not complete" % (summary["runs"] - summary["completed"], summary["runs"]))
+    for key in ("total_mean_s", "stop_to_feedback_mean_ms"):
+        if key in baseline and key in summary:
+            limit = baseline[key] * (1 + tolerance)
+            if summary[key] > limit:
+                print("REGRESSION: %s %.1f exceeds baseline %.1f by more than %d%%" % (
+                    key, summary[key], baseline[key], tolerance * 100))
+                ok = False
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default=os.path.join(REPO, ".pio", "build", "native", "program"))
+    parser.add_argument("--runs", type=int, default=1)
+    parser.add_argument("--time-scale", type=float, default=20.0,
+                        help="replay this many times faster than real time (default 20)")
+    parser.add_argument("--seed", type=int, default=1, help="mock latency seed of the first run")
+    parser.add_argument("--config", help="mock server latency/payload/error config (JSON)")
+    parser.add_argument("--mic-wav", help="16-bit WAV used as every player's speech")
+    parser.add_argument("--speech-seconds", type=float, default=30.0,
+                        help="length of speech in the synthesised microphone fixture")
+    parser.add_argument("--gps-nmea", help="NMEA log replayed on the GPS UART")
+    parser.add_argument("--timeout", type=float, default=900.0, help="wall-clock limit per game")
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--baseline", help="results file to compare against; exit 1 on regression")
+    parser.add_argument("--tolerance", type=float, default=0.05, help="allowed slowdown against --baseline")
+    parser.add_argument("--keep", action="store_true", help="keep the work directory with logs and SD contents")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.binary):
+        parser.error("%s not found; build it with `pio run -e native`" % args.binary)
+
+    workdir = tempfile.mkdtemp(prefix="storybox-bench-")
+    if not args.mic_wav:
+        args.mic_wav = os.path.join(workdir, "mic.wav")
+        write_mic_fixture(args.mic_wav, args.speech_seconds, args.seed)
+    if not args.gps_nmea:
+        args.gps_nmea = os.path.join(workdir, "gps.nmea")
+        write_gps_fixture(args.gps_nmea)
+    args.mic_wav = os.path.abspath(args.mic_wav)
+    args.gps_nmea = os.path.abspath(args.gps_nmea)
+    args.binary = os.path.abspath(args.binary)
+
+    games = [run_game(args, run, workdir) for run in range(args.runs)]
+    summary = summarise(games)
+    report(games, summary)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"summary": summary, "games": games, "time_scale": args.time_scale}, f, indent=2)
+
+    ok = summary["completed"] == summary["runs"] and summary["rejected"] == 0
+    if args.baseline:
+        ok = check_baseline(summary, args.baseline, args.tolerance) and ok
+
+    if args.keep:
+        print("work directory: %s" % workdir)
+    else:
+        shutil.rmtree(workdir, ignore_errors=True)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
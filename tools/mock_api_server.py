@@ -0,0 +1,549 @@
+#!/usr/bin/env python3
+"""Local stand-in for the cloud APIs used by source_code.c.
+
+Serves the exact endpoints the firmware calls, over plain HTTP/1.1 with
+keep-alive, so the native build (hal/native) can play whole games offline:
+
+  POST /v1/audio/transcriptions                 OpenAI Whisper (multipart, chunked or sized)
+  POST /v1/audio/speech                         OpenAI TTS (streams a silent MP3 of realistic length)
+  POST /v1/models/<model>:generateContent       Gemini (also under /v1beta)
+  POST /v1/models/<model>:streamGenerateContent Gemini, as server-sent events with ?alt=sse
+  GET  /maps/api/geocode/json                   Google reverse geocoding
+
+Every endpoint has a configurable latency distribution, payload size and
+error rate (see DEFAULT_CONFIG and --config). The first request on each new
+TCP connection additionally pays the "handshake" latency, standing in for the
+TLS handshake the device performs, and idle connections are dropped after
+"keepalive_timeout" like the real front ends. --time-scale divides every
+latency so the server stays consistent with a firmware build run with
+STORYBOX_TIME_SCALE.
+
+Each request is appended to --log as one JSON line (endpoint, start/end time,
+bytes in/out, injected latency, status, whether the body was chunked) for
+tools/bench_game.py and tools/upload_overrun_test.py; an upload the client
+abandoned is logged with status 0.
+"""
+
+import argparse
+import json
+import math
+import random
+import re
+import socketserver
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+DEFAULT_CONFIG = {
+    # Latencies are in seconds: {"fixed": x}, {"uniform": [a, b]} or
+    # {"lognormal": [median, sigma]}
+    "handshake": {"lognormal": [1.5, 0.3]},
+    # Idle keep-alive connections are closed after this many seconds
+    "keepalive_timeout": 300,
+    "endpoints": {
+        "transcriptions": {
+            "latency": {"lognormal": [2.0, 0.4]},
+            # Server-side time spent per second of uploaded audio
+            "per_audio_second": 0.05,
+            # Seconds the server stops reading a streamed (chunked) upload after
+            # its first chunk, like a congested uplink; long enough and the
+            # firmware's capture ring overruns and it abandons the stream
+            "stall_streamed_upload": 0.0,
+            "error_rate": 0.0,
+        },
+        "speech": {
+            "latency": {"lognormal": [1.2, 0.3]},
+            # Audio is produced this many times faster than real time
+            "realtime_factor": 4.0,
+            "bitrate_kbps": 64,
+            "error_rate": 0.0,
+        },
+        "generate": {
+            "latency": {"lognormal": [3.0, 0.4]},
+            # Extra seconds per generated word (decode time)
+            "per_word": 0.01,
+            "feedback_words": 75,
+            "winner_words": 250,
+            "summary_words": 110,
+            "chunked": True,
+            # Words carried by each server-sent event of streamGenerateContent
+            "words_per_event": 12,
+            "error_rate": 0.0,
+        },
+        "geocode": {
+            "latency": {"lognormal": [0.4, 0.3]},
+            "payload_bytes": 6000,
+            "error_rate": 0.0,
+        },
+    },
+}
+
+# Top-level request fields each Gemini API version accepts; anything else is
+# rejected with a 400, as the real service does
+GEMINI_FIELDS = {
+    "v1": {"contents", "generationConfig", "safetySettings"},
+    "v1beta": {"contents", "generationConfig", "safetySettings", "systemInstruction", "tools", "toolConfig",
+               "cachedContent"},
+}
+# Models that take no system instruction on any API version
+MODELS_WITHOUT_SYSTEM_INSTRUCTION = {"gemini-pro", "gemini-1.0-pro"}
+
+WORDS = ("the koala found a glowing map beneath the old gum tree and decided to follow it "
+         "towards the harbour where a lighthouse keeper was waiting with a secret").split()
+
+TRANSCRIPTS = [
+    "Once upon a time a curious koala named Kip found a glowing map under the old gum tree.",
+    "The map led Kip to the harbour where a grumpy pelican guarded a tiny wooden boat.",
+    "Kip offered the pelican a eucalyptus sandwich and together they sailed towards the lighthouse.",
+    "At the lighthouse a kind old keeper told them the map showed a hidden reef full of treasure.",
+    "A storm rolled in, but Kip used the glowing map to guide the boat safely between the rocks.",
+    "Under the waves they found a chest, but inside was a note asking them to protect the reef.",
+    "Kip and the pelican decided the real treasure was the reef itself and promised to guard it.",
+    "They sailed home at sunset and told everyone in the bush about the magical reef. The end.",
+]
+
+
+def merge(base, override):
+    out = dict(base)
+    for key, value in override.items():
+        if isinstance(value, dict) and isinstance(out.get(key), dict):
+            out[key] = merge(out[key], value)
+        else:
+            out[key] = value
+    return out
+
+
+def sample(dist, rng):
+    if dist is None:
+        return 0.0
+    if isinstance(dist, (int, float)):
+        return float(dist)
+    if "fixed" in dist:
+        return float(dist["fixed"])
+    if "uniform" in dist:
+        low, high = dist["uniform"]
+        return rng.uniform(low, high)
+    if "lognormal" in dist:
+        median, sigma = dist["lognormal"]
+        return median * math.exp(rng.gauss(0.0, sigma))
+    raise ValueError("unknown latency distribution %r" % dist)
+
+
+def wav_seconds(body):
+    """Length of the WAV file in a multipart upload, from its byte rate."""
+    start = body.find(b"RIFF")
+    if start < 0 or len(body) < start + 44:
+        return max(0, len(body) - 44) / 32000.0
+    byte_rate = struct.unpack_from("<I", body, start + 28)[0] or 32000
+    data = body.find(b"data", start + 12)
+    header = (data + 8 - start) if data >= 0 else 44
+    return max(0, len(body) - start - header) / float(byte_rate)
+
+
+def silent_mp3(seconds, bitrate_kbps):
+    """MPEG-1 Layer III, 32 kHz mono frames of silence (36 ms each)."""
+    index = {32: 1, 40: 2, 48: 3, 56: 4, 64: 5, 80: 6, 96: 7, 112: 8, 128: 9}.get(bitrate_kbps, 5)
+    kbps = [0, 32, 40, 48, 56, 64, 80, 96, 112, 128][index]
+    frame_len = 144 * kbps * 1000 // 32000
+    header = bytes([0xFF, 0xFB, (index << 4) | 0x08, 0xC0])
+    frame = header + bytes(frame_len - 4)
+    frames = max(1, int(seconds / 0.036))
+    return frame * frames
+
+
+def spoken_seconds(text):
+    # Roughly 2.5 words per second for the TTS voice
+    return max(1.0, len(text.split()) / 2.5)
+
+
+class MockState:
+    def __init__(self, config, time_scale, seed, log_path):
+        self.config = config
+        self.time_scale = time_scale
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+        self.transcript_index = 0
+        self.log = open(log_path, "a") if log_path else None
+
+    def latency(self, dist):
+        with self.lock:
+            return sample(dist, self.rng) / self.time_scale
+
+    def chance(self, rate):
+        with self.lock:
+            return self.rng.random() < rate
+
+    def next_transcript(self):
+        with self.lock:
+            text = TRANSCRIPTS[self.transcript_index % len(TRANSCRIPTS)]
+            self.transcript_index += 1
+            return text
+
+    def words(self, count):
+        """count filler words in sentences of 8-20 words; the caller ends the last one."""
+        with self.lock:
+            words = [self.rng.choice(WORDS) for _ in range(count)]
+            sentence_start = 0
+            next_break = self.rng.randint(8, 20)
+            for i in range(count):
+                if i == sentence_start:
+                    words[i] = words[i].capitalize()
+                if i - sentence_start + 1 == next_break and i < count - 1:
+                    words[i] += "."
+                    sentence_start = i + 1
+                    next_break = self.rng.randint(8, 20)
+            return " ".join(words)
+
+    def rating(self):
+        with self.lock:
+            return self.rng.randint(4, 9)
+
+    def record(self, entry):
+        if not self.log:
+            return
+        with self.lock:
+            self.log.write(json.dumps(entry) + "\n")
+            self.log.flush()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "StoryboxMock/1.0"
+
+    def setup(self):
+        # Applied to the socket by StreamRequestHandler; an idle timeout ends the connection
+        self.timeout = self.server.state.config["keepalive_timeout"] / self.server.state.time_scale
+        super().setup()
+        self.handshake_pending = True
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write("%s - %s\n" % (self.address_string(), fmt % args))
+
+    # ---------------------------------------------------------------- helpers
+
+    def read_body(self, stall=0.0):
+        """The request body, or None if a chunked body was cut off before its last chunk."""
+        self.chunked_in = self.headers.get("Transfer-Encoding", "").lower() == "chunked"
+        if self.chunked_in:
+            body = bytearray()
+            while True:
+                line = self.rfile.readline()
+                if not line:
+                    return None
+                try:
+                    size = int(line.split(b";")[0].strip() or b"0", 16)
+                except ValueError:
+                    return None
+                if size == 0:
+                    # Trailer section ends with an empty line
+                    while self.rfile.readline() not in (b"\r\n", b"\n", b""):
+                        pass
+                    break
+                body += self.rfile.read(size)
+                self.rfile.readline()
+                if stall > 0:
+                    time.sleep(stall)
+                    stall = 0
+            return bytes(body)
+        length = int(self.headers.get("Content-Length", "0"))
+        return self.rfile.read(length) if length else b""
+
+    def begin(self, endpoint):
+        self.endpoint = endpoint
+        self.started = time.time()
+        self.injected = 0.0
+        if self.handshake_pending:
+            self.handshake_pending = False
+            self.pause(self.server.state.latency(self.server.state.config["handshake"]))
+
+    def pause(self, seconds):
+        if seconds > 0:
+            time.sleep(seconds)
+            self.injected += seconds
+
+    def send_body(self, status, body, content_type, chunked=False):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        if chunked:
+            # Like the Google front ends: the body arrives in pieces
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for offset in range(0, len(body), 1024):
+                part = body[offset:offset + 1024]
+                self.wfile.write(b"%x\r\n" % len(part) + part + b"\r\n")
+            self.wfile.write(b"0\r\n\r\n")
+        else:
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        self.finish_record(status, len(body))
+
+    def send_json(self, status, obj, chunked=False):
+        self.send_body(status, json.dumps(obj, indent=2).encode() if chunked else json.dumps(obj).encode(),
+                       "application/json; charset=UTF-8", chunked)
+
+    def finish_record(self, status, bytes_out):
+        self.server.state.record({
+            "endpoint": self.endpoint,
+            "path": self.path.split("?")[0],
+            "start": self.started,
+            "end": time.time(),
+            "bytes_in": self.bytes_in,
+            "bytes_out": bytes_out,
+            "injected": self.injected,
+            "status": status,
+            "chunked": self.chunked_in,
+        })
+
+    def maybe_fail(self, cfg):
+        if self.server.state.chance(cfg.get("error_rate", 0.0)):
+            self.send_json(503, {"error": {"code": 503, "message": "injected failure"}})
+            return True
+        return False
+
+    # ---------------------------------------------------------------- routing
+
+    def normalise_path(self):
+        # Raw clients may send the absolute URI in the request line
+        match = re.match(r"^https?://[^/]+(/.*)$", self.path)
+        if match:
+            self.path = match.group(1)
+
+    def do_GET(self):
+        self.normalise_path()
+        self.bytes_in = 0
+        self.chunked_in = False
+        if self.path.startswith("/maps/api/geocode/json"):
+            return self.geocode()
+        self.begin("unknown")
+        self.send_json(404, {"error": "not found"})
+
+    def do_POST(self):
+        self.normalise_path()
+        path = self.path.split("?")[0]
+        stall = 0.0
+        if path == "/v1/audio/transcriptions":
+            cfg = self.server.state.config["endpoints"]["transcriptions"]
+            stall = cfg.get("stall_streamed_upload", 0.0) / self.server.state.time_scale
+        started = time.time()
+        try:
+            body = self.read_body(stall)
+        except ConnectionError:
+            body = None
+        if body is None:
+            # The client gave up part way through the upload, so there is no one to answer
+            self.close_connection = True
+            self.server.state.record({
+                "endpoint": "transcriptions" if path == "/v1/audio/transcriptions" else "unknown",
+                "path": path,
+                "start": started,
+                "end": time.time(),
+                "bytes_in": 0,
+                "bytes_out": 0,
+                "injected": 0.0,
+                "status": 0,
+                "chunked": True,
+            })
+            return
+        self.bytes_in = len(body)
+        if path == "/v1/audio/transcriptions":
+            return self.transcriptions(body)
+        if path == "/v1/audio/speech":
+            return self.speech(body)
+        match = re.match(r"^/(v1(?:beta)?)/models/([^/:]+):(generateContent|streamGenerateContent)$", path)
+        if match:
+            return self.generate(body, match.group(1), match.group(2),
+                                 stream=match.group(3) == "streamGenerateContent")
+        self.begin("unknown")
+        self.send_json(404, {"error": "not found"})
+
+    # ---------------------------------------------------------------- endpoints
+
+    def transcriptions(self, body):
+        cfg = self.server.state.config["endpoints"]["transcriptions"]
+        self.begin("transcriptions")
+        audio_seconds = wav_seconds(body)
+        self.pause(self.server.state.latency(cfg["latency"]) +
+                   cfg.get("per_audio_second", 0.0) * audio_seconds / self.server.state.time_scale)
+        if self.maybe_fail(cfg):
+            return
+        self.send_json(200, {"text": self.server.state.next_transcript()})
+
+    def speech(self, body):
+        cfg = self.server.state.config["endpoints"]["speech"]
+        self.begin("speech")
+        try:
+            text = json.loads(body or b"{}").get("input", "")
+        except ValueError:
+            text = body.decode(errors="replace")
+        self.pause(self.server.state.latency(cfg["latency"]))
+        if self.maybe_fail(cfg):
+            return
+
+        seconds = spoken_seconds(text)
+        audio = silent_mp3(seconds, cfg.get("bitrate_kbps", 64))
+        # Stream the clip as it is "synthesised", faster than real time
+        self.send_response(200)
+        self.send_header("Content-Type", "audio/mpeg")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        chunk = 4096
+        bytes_per_second = len(audio) / seconds * cfg.get("realtime_factor", 4.0) * self.server.state.time_scale
+        for offset in range(0, len(audio), chunk):
+            part = audio[offset:offset + chunk]
+            self.wfile.write(b"%x\r\n" % len(part) + part + b"\r\n")
+            self.wfile.flush()
+            time.sleep(len(part) / bytes_per_second)
+        self.wfile.write(b"0\r\n\r\n")
+        self.finish_record(200, len(audio))
+
+    def reject(self, message):
+        self.send_json(400, {"error": {"code": 400, "message": message, "status": "INVALID_ARGUMENT"}})
+
+    def generate(self, body, version, model, stream=False):
+        cfg = self.server.state.config["endpoints"]["generate"]
+        self.begin("generate")
+        try:
+            request = json.loads(body or b"{}")
+        except ValueError:
+            self.reject("invalid JSON")
+            return
+        for field in request:
+            if field not in GEMINI_FIELDS[version]:
+                self.reject('Invalid JSON payload received. Unknown name "%s": Cannot find field.' % field)
+                return
+        if "systemInstruction" in request and model in MODELS_WITHOUT_SYSTEM_INSTRUCTION:
+            self.reject("Developer instruction is not enabled for models/%s" % model)
+            return
+        prompt = json.dumps(request)
+        # A session resends its history; only the newest message says what is asked
+        contents = request.get("contents") or [{}]
+        asked = json.dumps(contents[-1])
+        state = self.server.state
+
+        if "very short story prompt" in asked:
+            match = re.search(r"Seems that we are at ([^.]*)\.", asked)
+            place = match.group(1) if match else "the university"
+            text = ("Hmmm... Seems that we are at %s. Let me create a plot around this: "
+                    "A curious koala discovers a glowing map near %s that leads to a hidden reef." % (place, place))
+            words = len(text.split())
+        elif "Write a single summary" in asked:
+            words = cfg.get("summary_words", 110)
+            text = state.words(words) + "."
+        elif "winner" in asked:
+            words = cfg.get("winner_words", 250)
+            text = "What a wonderful story everyone! " + state.words(words) + ". And the winner is player two!"
+        else:
+            words = cfg.get("feedback_words", 75)
+            text = state.words(words) + ". I rate your contribution %d out of 10." % state.rating()
+
+        # Honour generationConfig.maxOutputTokens at about 0.75 words per token
+        finish = "STOP"
+        max_tokens = request.get("generationConfig", {}).get("maxOutputTokens")
+        if max_tokens and words > max_tokens * 3 // 4:
+            words = max_tokens * 3 // 4
+            text = " ".join(text.split()[:words])
+            finish = "MAX_TOKENS"
+
+        def reply(piece, finish_reason, count):
+            candidate = {
+                "content": {"parts": [{"text": piece}], "role": "model"},
+                "index": 0,
+                "safetyRatings": [{"category": "HARM_CATEGORY_HARASSMENT", "probability": "NEGLIGIBLE"}],
+            }
+            if finish_reason:
+                candidate["finishReason"] = finish_reason
+            return {
+                "candidates": [candidate],
+                "usageMetadata": {
+                    "promptTokenCount": len(prompt) // 4,
+                    "candidatesTokenCount": count,
+                    "totalTokenCount": len(prompt) // 4 + count,
+                },
+            }
+
+        if not stream:
+            self.pause(state.latency(cfg["latency"]) + cfg.get("per_word", 0.0) * words / state.time_scale)
+            if self.maybe_fail(cfg):
+                return
+            self.send_json(200, reply(text, finish, words), cfg.get("chunked", False))
+            return
+
+        # Streaming: the latency is the time to the first event, then each
+        # event carries the next few words as they are decoded
+        self.pause(state.latency(cfg["latency"]))
+        if self.maybe_fail(cfg):
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        pieces = text.split(" ")
+        step = cfg.get("words_per_event", 12)
+        sent = 0
+        for offset in range(0, len(pieces), step):
+            last = offset + step >= len(pieces)
+            piece = " ".join(pieces[offset:offset + step]) + ("" if last else " ")
+            self.pause(cfg.get("per_word", 0.0) * len(pieces[offset:offset + step]) / state.time_scale)
+            event = b"data: " + json.dumps(reply(piece, finish if last else None, min(offset + step, len(pieces)))).encode() + b"\r\n\r\n"
+            self.wfile.write(b"%x\r\n" % len(event) + event + b"\r\n")
+            self.wfile.flush()
+            sent += len(event)
+        self.wfile.write(b"0\r\n\r\n")
+        self.finish_record(200, sent)
+
+    def geocode(self):
+        cfg = self.server.state.config["endpoints"]["geocode"]
+        self.begin("geocode")
+        self.pause(self.server.state.latency(cfg["latency"]))
+        if self.maybe_fail(cfg):
+            return
+        result = {
+            "formatted_address": "Sydney Opera House, Bennelong Point, Sydney NSW 2000, Australia",
+            "place_id": "ChIJ3S-JXmauEmsRUcIaWtf4MzE",
+            "types": ["establishment", "point_of_interest"],
+        }
+        # Pad with further results, like the real API's nested address levels
+        results = [result]
+        filler = {"formatted_address": "Sydney NSW 2000, Australia", "types": ["locality", "political"]}
+        while len(json.dumps(results)) < cfg.get("payload_bytes", 6000):
+            results.append(filler)
+        self.send_json(200, {"results": results, "status": "OK"})
+
+
+class Server(socketserver.ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--config", help="JSON file merged over the default latency/payload/error settings")
+    parser.add_argument("--time-scale", type=float, default=1.0, help="divide all latencies by this factor")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--log", help="append one JSON line per request to this file")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    config = DEFAULT_CONFIG
+    if args.config:
+        with open(args.config) as f:
+            config = merge(DEFAULT_CONFIG, json.load(f))
+
+    server = Server((args.host, args.port), Handler)
+    server.state = MockState(config, args.time_scale, args.seed, args.log)
+    server.verbose = args.verbose
+    print("mock API server listening on %s:%d" % (args.host, server.server_address[1]), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Native test: a streamed upload that falls behind is retried from the SD copy.
+
+Plays one game with the [env:native] binary against tools/mock_api_server.py
+configured to stop reading every streamed (chunked) transcription upload for
+a minute. With the device's small TCP send buffer the recording task's
+write() blocks, its upload cursor is overrun by the capture ring, and the
+firmware must abandon the stream so the worker uploads the SD copy instead
+of sending a recording with a gap in it.
+
+  pio run -e native
+  tools/upload_overrun_test.py
+
+Exits 1 unless every turn's stream was abandoned after its cursor dropped
+bytes, no streamed upload was answered, and every turn was transcribed from
+a sized (SD copy) upload.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import sys
+import tempfile
+
+import bench_game
+
+REPO = bench_game.REPO
+STALL_SECONDS = 60  # device seconds; longer than the longest recording
+
+
+def check(output, mock_log):
+    lines = [line for _, line in (bench_game.LINE.match(raw).groups() for raw in output.splitlines()
+                                  if bench_game.LINE.match(raw))]
+    turns = sum(1 for line in lines if line == "Recording stopped.")
+    overruns = sum(1 for line in lines if line.startswith("Upload fell behind and dropped"))
+    abandoned = sum(1 for line in lines if line == "Streaming upload abandoned.")
+    transcribed = sum(1 for line in lines if line == "Transcription saved successfully!")
+
+    answered_streams, sd_uploads = 0, 0
+    with open(mock_log) as f:
+        for raw in f:
+            entry = json.loads(raw)
+            if entry["endpoint"] != "transcriptions" or entry["status"] != 200:
+                continue
+            if entry["chunked"]:
+                answered_streams += 1
+            else:
+                sd_uploads += 1
+
+    failures = []
+    if turns == 0:
+        failures.append("no turns were recorded")
+    if overruns != turns:
+        failures.append("%d of %d turns overran the upload cursor" % (overruns, turns))
+    if abandoned != overruns:
+        failures.append("%d overrun streams but %d abandoned" % (overruns, abandoned))
+    if answered_streams:
+        failures.append("%d truncated streams were answered" % answered_streams)
+    if sd_uploads != turns:
+        failures.append("%d of %d turns uploaded their SD copy" % (sd_uploads, turns))
+    if transcribed != turns:
+        failures.append("%d of %d turns transcribed" % (transcribed, turns))
+    return turns, failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", default=os.path.join(REPO, ".pio", "build", "native", "program"))
+    parser.add_argument("--time-scale", type=float, default=20.0)
+    parser.add_argument("--timeout", type=float, default=900.0, help="wall-clock limit for the game")
+    parser.add_argument("--keep", action="store_true", help="keep the work directory with logs and SD contents")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.binary):
+        parser.error("%s not found; build it with `pio run -e native`" % args.binary)
+    args.binary = os.path.abspath(args.binary)
+    args.seed = 1
+
+    workdir = tempfile.mkdtemp(prefix="storybox-overrun-")
+    args.mic_wav = os.path.join(workdir, "mic.wav")
+    bench_game.write_mic_fixture(args.mic_wav, 10.0, args.seed)
+    args.gps_nmea = os.path.join(workdir, "gps.nmea")
+    bench_game.write_gps_fixture(args.gps_nmea)
+    args.config = os.path.join(workdir, "stall.json")
+    with open(args.config, "w") as f:
+        json.dump({"endpoints": {"transcriptions": {"stall_streamed_upload": STALL_SECONDS}}}, f)
+
+    game = bench_game.run_game(args, 0, workdir)
+    with open(os.path.join(workdir, "game0.log")) as f:
+        output = f.read()
+    turns, failures = check(output, os.path.join(workdir, "mock0.jsonl"))
+    if not game["completed"]:
+        failures.append("the game did not complete")
+
+    for failure in failures:
+        print("FAILED: %s" % failure)
+    if not failures:
+        print("ok: all %d overrun streams were abandoned and sent from the SD copy" % turns)
+
+    if args.keep:
+        print("work directory: %s" % workdir)
+    else:
+        shutil.rmtree(workdir, ignore_errors=True)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,132 @@
+// Voice activity detector for the capture stream: decides, 20 ms at a time,
+// whether a player is speaking, from the frame's energy against a running
+// noise floor and its zero-crossing rate.
+//
+// Voiced speech is loud relative to the room and crosses zero at a low rate.
+// Hiss and fan noise cross zero often, so a frame that is only moderately
+// loud must also have a low zero-crossing rate to count. Clicks are ignored
+// by requiring a few voiced frames in a row before speech is said to start.
+//
+// Positions are counted in samples from the start of the recording.
+// Header-only and free of sketch globals, like the other stream stages.
+#pragma once
+
+#include <Arduino.h>
+
+#define VAD_FRAME_SAMPLES 320 // 20 ms at 16 kHz
+#define VAD_MIN_RMS 200 // frames quieter than this (about -44 dBFS) are never speech
+#define VAD_FLOOR_RATIO 3 // a voiced frame is this many times louder than the noise floor...
+#define VAD_MAX_ZCR 25 // ...and crosses zero in at most this percentage of samples,
+#define VAD_LOUD_RATIO 8 // unless it is this many times louder than the floor
+#define VAD_ONSET_FRAMES 3 // voiced frames in a row that start speech
+#define VAD_HANGOVER_FRAMES 15 // speech is taken to end this long after its last voiced frame
+
+class VoiceActivityDetector {
+private:
+    int16_t frame[VAD_FRAME_SAMPLES];
+    size_t frameCount;
+    uint32_t framesSeen;
+    uint32_t noiseFloor; // RMS of the background, tracked as it changes
+    int run; // consecutive voiced frames
+    uint32_t voicedFrames;
+    bool speaking;
+    uint32_t firstVoiced; // sample positions, valid once speech has started
+    uint32_t lastVoiced;
+
+    // Function to classify the completed frame and update the detector
+    void processFrame() {
+        int64_t energy = 0;
+        int crossings = 0;
+        for (size_t i = 0; i < VAD_FRAME_SAMPLES; i++) {
+            energy += (int32_t)frame[i] * frame[i];
+            if (i > 0 && (frame[i] < 0) != (frame[i - 1] < 0)) {
+                crossings++;
+            }
+        }
+        uint32_t rms = (uint32_t)sqrt((double)energy / VAD_FRAME_SAMPLES);
+        int zcr = crossings * 100 / VAD_FRAME_SAMPLES;
+
+        // The floor falls quickly to a quieter background and rises slowly, so speech does not lift it
+        if (framesSeen == 0) {
+            noiseFloor = rms;
+        } else if (rms < noiseFloor) {
+            noiseFloor -= (noiseFloor - rms) / 4;
+        } else {
+            noiseFloor += (rms - noiseFloor) / 256 + 1;
+        }
+
+        bool voiced = rms >= VAD_MIN_RMS &&
+                      ((rms >= noiseFloor * VAD_FLOOR_RATIO && zcr <= VAD_MAX_ZCR) ||
+                       rms >= noiseFloor * VAD_LOUD_RATIO);
+        uint32_t start = framesSeen * VAD_FRAME_SAMPLES;
+        framesSeen++;
+
+        run = voiced ? run + 1 : 0;
+        if (!voiced) {
+            return;
+        }
+        if (speaking) {
+            voicedFrames++;
+        } else if (run >= VAD_ONSET_FRAMES) {
+            speaking = true;
+            firstVoiced = start - (VAD_ONSET_FRAMES - 1) * VAD_FRAME_SAMPLES;
+            voicedFrames += run;
+        } else {
+            return; // Too short to be speech yet
+        }
+        lastVoiced = start + VAD_FRAME_SAMPLES;
+    }
+
+public:
+    VoiceActivityDetector() {
+        reset();
+    }
+
+    // Function to start a new recording
+    void reset() {
+        frameCount = 0;
+        framesSeen = 0;
+        noiseFloor = 0;
+        run = 0;
+        voicedFrames = 0;
+        speaking = false;
+        firstVoiced = 0;
+        lastVoiced = 0;
+    }
+
+    // Function to feed captured samples; they need not be whole frames
+    void process(const int16_t* samples, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            frame[frameCount++] = samples[i];
+            if (frameCount == VAD_FRAME_SAMPLES) {
+                processFrame();
+                frameCount = 0;
+            }
+        }
+    }
+
+    // Function to tell whether any speech has been heard yet
+    bool heardSpeech() {
+        return speaking;
+    }
+
+    // Function to return the first sample of speech
+    uint32_t speechStart() {
+        return firstVoiced;
+    }
+
+    // Function to return the sample after the end of speech, including the hangover
+    uint32_t speechEnd() {
+        return lastVoiced + VAD_HANGOVER_FRAMES * VAD_FRAME_SAMPLES;
+    }
+
+    // Function to return how long it has been quiet since the last voiced frame, in samples
+    uint32_t silenceSamples() {
+        return framesSeen * VAD_FRAME_SAMPLES - (speaking ? lastVoiced : 0);
+    }
+
+    // Function to return the total length of the voiced frames, in samples
+    uint32_t voicedSamples() {
+        return voicedFrames * VAD_FRAME_SAMPLES;
+    }
+};